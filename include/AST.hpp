@@ -1,101 +1,271 @@
 #ifndef AST_H
 #define AST_H
 
+#include <algorithm>
 #include <string>
 #include <map>
+#include <type_traits>
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/Casting.h"
+
+#include "SymbolTable.hpp"
 
 class IRConstructor; // forward declaration
 
+// All nodes are owned by an ASTArena, child pointers are non-owning.
+// The set of expression nodes is closed, passes dispatch on getKind() with a
+// switch (or llvm::isa/cast) instead of virtual calls. Expression accessors
+// are inline so traversals do not pay a call per node.
+
 // Base Expression for all AST members
 class ExprAST {
 public:
-    virtual ~ExprAST() = default;
-    virtual llvm::Value* codegen(IRConstructor& visitor) = 0;
+    enum ExprKind : uint8_t {
+        Number,
+        Variable,
+        Binary,
+        Call,
+        If,
+        For
+    };
+
+    ExprKind getKind() const { return kind; }
+
+    llvm::Value* codegen(IRConstructor& visitor);
+
+protected:
+    ExprAST(ExprKind kind) : kind(kind) {}
+
+private:
+    ExprKind kind;
 };
 
 // NumExprAST -> Expression class for numeric literals
 class NumberExprAST : public ExprAST {
     double value;
-    
-public: 
-    NumberExprAST(double value) : value(value) {}
-    llvm::Value* codegen(IRConstructor& visitor) override;
-    double getValue() const;
+
+public:
+    NumberExprAST(double value) : ExprAST(Number), value(value) {}
+    double getValue() const { return value; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == Number; }
 };
 
 // VariableExprAST -> Expression class for variable names such as 'a'
 class VariableExprAST : public ExprAST {
-    std::string value;
+    SymbolID symbol;
+
+public:
+    VariableExprAST(SymbolID symbol) : ExprAST(Variable), symbol(symbol) {}
 
-public: 
-    VariableExprAST(const std::string& value) : value(value) {}
-    
-    llvm::Value* codegen(IRConstructor& visitor) override;
-    std::string getValue() const; 
+    SymbolID getSymbol() const { return symbol; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == Variable; }
 };
 
 // A binary operation between two ExprAST (such as an addition)
 class BinaryExprAST : public ExprAST {
     char op; // The operation to perform
-    std::unique_ptr<ExprAST> LHS, RHS; // Left and right hand side of operation
-
-public: 
-    BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS) 
-        : op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
-    
-    llvm::Value* codegen(IRConstructor& visitor) override;
-    ExprAST& getLHSRef() const;
-    ExprAST& getRHSRef() const;
-    char getOp() const;
+    ExprAST *LHS, *RHS; // Left and right hand side of operation
+
+public:
+    BinaryExprAST(char op, ExprAST* LHS, ExprAST* RHS)
+        : ExprAST(Binary), op(op), LHS(LHS), RHS(RHS) {}
+
+    ExprAST& getLHSRef() const { return *LHS; }
+    ExprAST& getRHSRef() const { return *RHS; }
+    char getOp() const { return op; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == Binary; }
 };
 
 // CallExprAST -> represents a function call
 class CallExprAST : public ExprAST {
-    std::string callee;
-    std::vector<std::unique_ptr<ExprAST>> args;
+    SymbolID callee;
+    llvm::ArrayRef<ExprAST*> args; // stored in the arena
+
+public:
+    CallExprAST(SymbolID callee, llvm::ArrayRef<ExprAST*> args)
+            : ExprAST(Call), callee(callee), args(args) {}
+
+    SymbolID getCallee() const { return callee; }
+    llvm::ArrayRef<ExprAST*> getArgs() const { return args; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == Call; }
+};
+
+// IfExprAST -> if cond then a else b, cond is true if it is neither 0 nor NaN
+class IfExprAST : public ExprAST {
+    ExprAST *cond, *thenExpr, *elseExpr;
 
 public:
-    CallExprAST(const std::string& callee, std::vector<std::unique_ptr<ExprAST>> args) 
-            : callee(callee), args(std::move(args)) {}
-    
-    llvm::Value* codegen(IRConstructor& visitor) override;
-    std::string getCallee() const;
-    std::vector<std::unique_ptr<ExprAST>>& getArgs();
+    IfExprAST(ExprAST* cond, ExprAST* thenExpr, ExprAST* elseExpr)
+        : ExprAST(If), cond(cond), thenExpr(thenExpr), elseExpr(elseExpr) {}
+
+    ExprAST& getCond() const { return *cond; }
+    ExprAST& getThen() const { return *thenExpr; }
+    ExprAST& getElse() const { return *elseExpr; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == If; }
+};
+
+// ForExprAST -> for var = start, cond, step in body
+// The condition is checked before every iteration, step defaults to 1 and
+// the loop evaluates to 0. var is only visible in cond, step and body.
+class ForExprAST : public ExprAST {
+    SymbolID var;
+    ExprAST *start, *cond, *step, *body; // step may be null
+
+public:
+    ForExprAST(SymbolID var, ExprAST* start, ExprAST* cond, ExprAST* step, ExprAST* body)
+        : ExprAST(For), var(var), start(start), cond(cond), step(step), body(body) {}
+
+    SymbolID getVar() const { return var; }
+    ExprAST& getStart() const { return *start; }
+    ExprAST& getCond() const { return *cond; }
+    ExprAST* getStep() const { return step; }
+    ExprAST& getBody() const { return *body; }
+
+    static bool classof(const ExprAST* expr) { return expr->getKind() == For; }
 };
 
 // PrototypeExprAST -> The signature of a function definition
 class PrototypeAST {
-    std::string name; 
-    std::vector<std::string> args;
+    SymbolID name;
+    llvm::ArrayRef<SymbolID> args; // stored in the arena
 
 public:
-    PrototypeAST(const std::string& name, std::vector<std::string> args)
-        : name(name), args(std::move(args)) {}
-    
+    PrototypeAST(SymbolID name, llvm::ArrayRef<SymbolID> args)
+        : name(name), args(args) {}
+
     llvm::Function* codegen(IRConstructor& visitor);
-    
-    std::string getName() const;
-    std::vector<std::string>& getArgs();
+
+    SymbolID getName() const;
+    llvm::ArrayRef<SymbolID> getArgs() const;
 };
 
 // FunctionExprAST -> The signature and function body
 class FunctionAST {
-    std::unique_ptr<PrototypeAST> proto;
-    std::unique_ptr<ExprAST> body;
+    PrototypeAST* proto;
+    ExprAST* body;
 
 public:
-    FunctionAST(std::unique_ptr<PrototypeAST> proto, std::unique_ptr<ExprAST> body) 
-        : proto(std::move(proto)), body(std::move(body)) {}
-    
+    FunctionAST(PrototypeAST* proto, ExprAST* body)
+        : proto(proto), body(body) {}
+
     llvm::Function* codegen(IRConstructor& visitor);
 
-    PrototypeAST& getProto() const; 
+    PrototypeAST& getProto() const;
     ExprAST& getBody() const;
 };
 
-#endif // AST_H
\ No newline at end of file
+// Calls fn on every direct child of expr, in evaluation order
+template <typename Fn>
+void forEachChild(ExprAST& expr, Fn&& fn) {
+    switch (expr.getKind()) {
+        case ExprAST::Number:
+        case ExprAST::Variable:
+            return;
+        case ExprAST::Binary: {
+            auto& binExpr = llvm::cast<BinaryExprAST>(expr);
+            fn(binExpr.getLHSRef());
+            fn(binExpr.getRHSRef());
+            return;
+        }
+        case ExprAST::Call:
+            for (ExprAST* arg : llvm::cast<CallExprAST>(expr).getArgs()) {
+                fn(*arg);
+            }
+            return;
+        case ExprAST::If: {
+            auto& ifExpr = llvm::cast<IfExprAST>(expr);
+            fn(ifExpr.getCond());
+            fn(ifExpr.getThen());
+            fn(ifExpr.getElse());
+            return;
+        }
+        case ExprAST::For: {
+            auto& forExpr = llvm::cast<ForExprAST>(expr);
+            fn(forExpr.getStart());
+            fn(forExpr.getCond());
+            fn(forExpr.getBody());
+            if (forExpr.getStep()) {
+                fn(*forExpr.getStep());
+            }
+            return;
+        }
+    }
+}
+
+// Calls fn on root and every node below it in pre-order, children in
+// evaluation order. Walks an explicit stack, so the depth of the tree does
+// not matter. If fn returns bool, false skips the children of that node.
+template <typename Fn>
+void forEachNode(ExprAST& root, Fn&& fn) {
+    llvm::SmallVector<ExprAST*, 32> stack{&root};
+    while (!stack.empty()) {
+        ExprAST& expr = *stack.pop_back_val();
+        if constexpr (std::is_same_v<decltype(fn(expr)), bool>) {
+            if (!fn(expr)) {
+                continue;
+            }
+        } else {
+            fn(expr);
+        }
+        size_t firstChild = stack.size();
+        forEachChild(expr, [&](ExprAST& child) { stack.push_back(&child); });
+        std::reverse(stack.begin() + firstChild, stack.end());
+    }
+}
+
+// Appends the functions expr calls to callees, each once, in the order of
+// their first call. Names already in callees are not appended again.
+inline void collectCallees(ExprAST& expr, llvm::SmallVectorImpl<SymbolID>& callees) {
+    forEachNode(expr, [&](ExprAST& node) {
+        if (auto* callExpr = llvm::dyn_cast<CallExprAST>(&node)) {
+            if (llvm::find(callees, callExpr->getCallee()) == callees.end()) {
+                callees.push_back(callExpr->getCallee());
+            }
+        }
+    });
+}
+
+// Bump allocator owning every AST node of one compilation unit. Creating a
+// node is a pointer bump and all nodes are released at once with the arena,
+// node destructors never run so nodes must not own any resources.
+class ASTArena {
+    llvm::BumpPtrAllocator allocator;
+
+public:
+    template <typename T, typename... Args>
+    T* create(Args&&... args) {
+        return new (allocator.Allocate<T>()) T(std::forward<Args>(args)...);
+    }
+
+    template <typename T>
+    llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> values) {
+        if (values.empty()) {
+            return {};
+        }
+        T* data = allocator.Allocate<T>(values.size());
+        std::uninitialized_copy(values.begin(), values.end(), data);
+        return llvm::ArrayRef<T>(data, values.size());
+    }
+
+    // Bytes handed out to nodes
+    size_t getBytesUsed() const;
+    // Bytes reserved from the system, including unused slab space
+    size_t getBytesReserved() const;
+    // Releases all nodes at once
+    void reset();
+};
+
+#endif // AST_H
@@ -0,0 +1,79 @@
+#ifndef ASTOPTIMIZER_H
+#define ASTOPTIMIZER_H
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+#include "AST.hpp"
+#include "CompilerOptions.hpp"
+
+struct ASTOptimizerStats {
+    size_t functions = 0;
+    size_t nodesBefore = 0; // nodes as parsed
+    size_t nodesAfter = 0;  // distinct nodes left for codegen
+    size_t foldedConstants = 0;
+    size_t simplifiedIdentities = 0;
+    size_t mergedSubexpressions = 0; // nodes replaced by an identical one
+
+    size_t getNodesRemoved() const { return nodesBefore - nodesAfter; }
+};
+
+// Source-level cleanup run on every definition before codegen:
+//  - binary operations on two literals are evaluated
+//  - x * 1, x - 0 and x + -0 become x (x + 0 only without signed zeros)
+//  - literals are moved to the right of + and *, which is exact in IEEE 754
+//  - if with a literal condition becomes the branch taken
+//  - structurally identical call-free subexpressions share one node, so the
+//    body becomes a DAG that IRConstructor emits once per node. A for loop
+//    variable is a different variable than one of the same name outside.
+// Nothing is reassociated, results are bit-identical to the unoptimized AST.
+// New nodes are allocated in the parser's arena.
+class ASTOptimizer {
+    struct NodeKey {
+        ExprAST::ExprKind kind;
+        char op;
+        uint64_t first; // literal bits, symbol or LHS
+        uint64_t second; // RHS
+
+        bool operator==(const NodeKey& other) const {
+            return kind == other.kind && op == other.op && first == other.first && second == other.second;
+        }
+    };
+    struct NodeKeyHash {
+        size_t operator()(const NodeKey& key) const;
+    };
+
+    ASTArena& arena;
+    ASTOptimizerStats stats;
+    // Canonical node per structure, reset for every function
+    std::unordered_map<NodeKey, ExprAST*, NodeKeyHash> canonicalNodes;
+    llvm::DenseSet<const ExprAST*> canonical;
+    // Innermost for loop binding a variable, 0 for arguments
+    llvm::DenseMap<SymbolID, unsigned> loopScopes;
+    unsigned numLoops = 0;
+    FPMode fpMode = FPMode::Strict;
+
+public:
+    explicit ASTOptimizer(ASTArena& arena) : arena(arena) {}
+
+    // Returns funcAST itself if nothing changed
+    FunctionAST* optimize(FunctionAST& funcAST, FPMode mode);
+
+    const ASTOptimizerStats& getStats() const;
+
+private:
+    ExprAST* optimize(ExprAST& root);
+    // Combine a node with its already optimized children
+    ExprAST* optimizeBinary(BinaryExprAST& binExpr, ExprAST* lhs, ExprAST* rhs);
+    ExprAST* optimizeCall(CallExprAST& callExpr, llvm::ArrayRef<ExprAST*> args);
+    ExprAST* optimizeIf(IfExprAST& ifExpr, ExprAST* cond, ExprAST* thenExpr, ExprAST* elseExpr);
+    ExprAST* optimizeFor(ForExprAST& forExpr, ExprAST* start, ExprAST* cond, ExprAST* step, ExprAST* body);
+    // Returns the canonical node for key, create() makes it on first sight
+    template <typename CreateFn>
+    ExprAST* intern(const NodeKey& key, CreateFn create);
+};
+
+#endif // ASTOPTIMIZER_H
@@ -0,0 +1,82 @@
+#ifndef COMPILEROPTIONS_H
+#define COMPILEROPTIONS_H
+
+#include <string>
+#include <unordered_map>
+
+#include "llvm/ADT/StringRef.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Passes/OptimizationLevel.h"
+
+#include "TargetConfig.hpp"
+
+enum class OptLevel { O0, O1, O2, O3 };
+
+// What CompileModuleToObject emits
+enum class LTOMode {
+    None, // object code
+    Thin, // bitcode with a module summary for ThinLTO links
+    Full, // bitcode for monolithic LTO links
+};
+
+// Floating-point semantics of the generated arithmetic
+enum class FPMode {
+    Strict,   // IEEE 754, every operation rounds on its own
+    Contract, // a*b+c may be fused into an FMA
+    Fast,     // reassoc, nsz, arcp and contract
+};
+
+struct CompilerOptions {
+    // Selects PassBuilder's default module pipeline
+    OptLevel optLevel = OptLevel::O2;
+    // Print every pass as it runs
+    bool debugPassManager = false;
+    // Fold and deduplicate each definition's AST before codegen (see ASTOptimizer)
+    bool optimizeAST = true;
+    // Emit LTO bitcode instead of object code, optimized with the pre-link pipeline
+    LTOMode lto = LTOMode::None;
+    // Sets the modules' triple and data layout and tunes code generation
+    TargetConfig target;
+    // Applies to every function without an entry in functionFPModes
+    FPMode fpMode = FPMode::Strict;
+    std::unordered_map<std::string, FPMode> functionFPModes;
+
+    FPMode getFPMode(llvm::StringRef function) const {
+        auto mode = functionFPModes.find(function.str());
+        return mode == functionFPModes.end() ? fpMode : mode->second;
+    }
+};
+
+inline llvm::FastMathFlags ToFastMathFlags(FPMode mode) {
+    llvm::FastMathFlags flags;
+    switch (mode) {
+        case FPMode::Strict:
+            break;
+        case FPMode::Contract:
+            flags.setAllowContract();
+            break;
+        case FPMode::Fast:
+            flags.setAllowReassoc();
+            flags.setNoSignedZeros();
+            flags.setAllowReciprocal();
+            flags.setAllowContract();
+            break;
+    }
+    return flags;
+}
+
+inline llvm::OptimizationLevel ToLLVMOptLevel(OptLevel level) {
+    switch (level) {
+        case OptLevel::O0:
+            return llvm::OptimizationLevel::O0;
+        case OptLevel::O1:
+            return llvm::OptimizationLevel::O1;
+        case OptLevel::O2:
+            return llvm::OptimizationLevel::O2;
+        case OptLevel::O3:
+            return llvm::OptimizationLevel::O3;
+    }
+    return llvm::OptimizationLevel::O2;
+}
+
+#endif // COMPILEROPTIONS_H
@@ -0,0 +1,68 @@
+#ifndef COMPILERSESSION_H
+#define COMPILERSESSION_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "CompilerOptions.hpp"
+#include "IRConstructor.hpp"
+
+// Compiles one small program after another to object code, keeping what
+// CompileToObjectBuffer sets up for every call: the TargetMachine, the
+// optimization pipeline with its analysis managers, the codegen pass manager
+// and the IRConstructor with its LLVMContext. For snippets of a few
+// functions this setup costs more than the compilation itself.
+//
+//     session->addSource("def f(x y) x * y");
+//     session->compile(object);
+//     session->reset();
+//
+// The context interns every type and constant it sees, so it is replaced
+// after modulesPerContext resets to bound its memory. A session belongs to
+// one thread, give every thread its own.
+class CompilerSession {
+    CompilerOptions options;
+    size_t modulesPerContext;
+    size_t numModules = 0; // in the current context
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    // Built once, every compilation appends its object to codegenOutput
+    llvm::SmallVector<char, 0> codegenOutput;
+    llvm::raw_svector_ostream codegenStream{codegenOutput};
+    llvm::legacy::PassManager codegen;
+    // Both belong to the current context
+    std::shared_ptr<IRConstructor> irConst;
+    std::unique_ptr<ModuleOptimizer> optimizer;
+
+    CompilerSession(const CompilerOptions& options, size_t modulesPerContext,
+                    std::unique_ptr<llvm::TargetMachine> targetMachine);
+
+public:
+    // Object code only, LTO bitcode skips the codegen this session keeps
+    static llvm::Expected<std::unique_ptr<CompilerSession>> Create(const CompilerOptions& options = CompilerOptions(),
+                                                                   size_t modulesPerContext = 1000);
+
+    // Parses the externs and definitions of source and generates code for
+    // them into the current module. False on the first error, earlier items stay.
+    bool addSource(std::string_view source);
+
+    // Optimizes the current module and emits it as object code into object,
+    // like CompileToObjectBuffer. Call reset before adding the next program.
+    void compile(llvm::SmallVectorImpl<char>& object);
+
+    // Starts an empty module, earlier definitions are forgotten
+    void reset();
+
+    IRConstructor& getIRConstructor();
+
+private:
+    void createContext();
+};
+
+#endif // COMPILERSESSION_H
@@ -0,0 +1,57 @@
+#ifndef DRIVER_H
+#define DRIVER_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "CompilerOptions.hpp"
+
+enum class OutputKind {
+    Object,  // one object file for the whole program
+    Archive, // a static archive with one object per source file
+};
+
+struct DriverOptions {
+    std::vector<std::string> inputs;
+    std::string output = "build/output.o";
+    OutputKind outputKind = OutputKind::Object;
+    unsigned jobs = 0; // 0 uses every core
+    CompilerOptions compilerOptions;
+};
+
+struct FileTiming {
+    std::string path;
+    double parseSeconds = 0.0;
+    double compileSeconds = 0.0;
+    size_t astBytes = 0;        // of the file's AST arena
+    size_t astNodesRemoved = 0; // by the AST optimizer
+};
+
+// Compiles many source files into one output. Every file gets its own Parser,
+// IRConstructor and LLVMContext and is handled by a job pool:
+//   1. all files are parsed in parallel
+//   2. the definitions of all files are collected, extern prototypes are
+//      checked against them and calls to functions of other files resolve
+//      without an extern
+//   3. each file is compiled in parallel
+// For an archive every file is optimized and emitted on its own, which is
+// what scales with the number of cores. For a single object the files' IR is
+// linked into one module that is optimized (inlining across files) and
+// emitted once.
+class Driver {
+    DriverOptions options;
+    std::vector<FileTiming> fileTimings;
+
+public:
+    explicit Driver(DriverOptions options);
+
+    // 0 on success
+    int run();
+
+    // Of the last run, in input order
+    const std::vector<FileTiming>& getFileTimings() const;
+    void printFileTimings(std::ostream& os) const;
+};
+
+#endif // DRIVER_H
@@ -2,7 +2,9 @@
 #define IRCONSTRUCTOR_H
 
 #include <string>
-#include <map>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
 
 // Core llvm types 
 #include "llvm/IR/Value.h"
@@ -10,48 +12,141 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Verifier.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
 
-// Analysis Managers 
+// Optimization
 #include "llvm/IR/PassManager.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/StandardInstrumentations.h"
-
-// Optimization Passes 
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar/Reassociate.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Scalar/SimplifyCFG.h"
+#include "llvm/Target/TargetMachine.h"
 
 #include "AST.hpp"
+#include "CompilerOptions.hpp"
 
 class IRConstructor {
 private:
-    std::map<std::string, llvm::Value*> namedValues;
-    std::unique_ptr<llvm::LLVMContext> context;
+    // A node of the expression visit is emitting
+    struct ExprFrame {
+        ExprAST* expr;
+        unsigned stage = 0; // children requested so far
+        llvm::Value* value = nullptr; // once finished, nullptr on error
+        size_t checkpoint = 0; // of exprValueLog when entering a branch or loop
+        llvm::BasicBlock* blocks[3] = {};
+        llvm::Value* saved[2] = {};
+    };
+
+    std::shared_ptr<StringInterner> symbols;
+    // Flat tables indexed by SymbolID
+    std::vector<llvm::Value*> namedValues;
+    std::vector<SymbolID> boundValues; // slots of namedValues set for the current function
+    std::vector<llvm::Function*> functions; // functions declared in the current module
+    std::vector<int32_t> functionArity; // every prototype seen so far, -1 if unknown
+    // Values of the current function's nodes, the AST optimizer shares identical subexpressions
+    llvm::DenseMap<const ExprAST*, llvm::Value*> exprValues;
+    // Keys of exprValues in insertion order, entries added inside a branch or
+    // loop are dropped when leaving it since their values no longer dominate
+    std::vector<const ExprAST*> exprValueLog;
+    // Self-recursive calls in tail position of the current function jump
+    // back to this block, which binds the arguments to the phis
+    llvm::BasicBlock* tailRecursionHeader = nullptr;
+    llvm::SmallVector<llvm::PHINode*, 8> tailRecursionArgs;
+
+    llvm::orc::ThreadSafeContext tsContext;
+    llvm::LLVMContext* context; // owned by tsContext
     std::unique_ptr<llvm::IRBuilder<>> builder;
 
-    // Optimization
-    std::unique_ptr<llvm::FunctionPassManager> FPM;
-    std::unique_ptr<llvm::LoopAnalysisManager> LAM; 
-    std::unique_ptr<llvm::FunctionAnalysisManager> FAM;
-    std::unique_ptr<llvm::CGSCCAnalysisManager> CGAM;
-    std::unique_ptr<llvm::ModuleAnalysisManager> MAM;
-    std::unique_ptr<llvm::PassInstrumentationCallbacks> PIC;
-    std::unique_ptr<llvm::StandardInstrumentations> SI;
+    // Applied by whoever consumes the finished module (see OptimizeModule)
+    CompilerOptions options;
+    // Resolved from options.target once
+    std::string targetTriple;
+    std::string dataLayout;
 
 public:
     std::unique_ptr<llvm::Module> module;
 
-    IRConstructor();
+    IRConstructor(std::shared_ptr<StringInterner> symbols = std::make_shared<StringInterner>(),
+                  const CompilerOptions& options = CompilerOptions());
 
-    llvm::Value* visit(NumberExprAST& numExpr);
-    llvm::Value* visit(VariableExprAST& varExpr);
-    llvm::Value* visit(BinaryExprAST& binExpr);
-    llvm::Value* visit(CallExprAST& callExp);
+    llvm::Value* visit(ExprAST& expr);
     llvm::Function* visit(PrototypeAST& protoAST);
     llvm::Function* visit(FunctionAST& funcAST);
 
     llvm::Module& getModule() const;
     llvm::LLVMContext& getContext() const;
+    StringInterner& getSymbols() const;
+    std::shared_ptr<StringInterner> getSharedSymbols() const;
+
+    const CompilerOptions& getOptions() const;
+
+    // Declares a function defined elsewhere (e.g. in another file), as an
+    // extern prototype would. nullptr if it is known with another arity.
+    llvm::Function* declareExtern(llvm::StringRef name, size_t numArgs);
+
+    // Emits `void <name>_batch(const double* arg0, ..., double* out, size_t n)`
+    // computing out[i] = name(arg0[i], ...) into the current module. The
+    // function has to be defined in the current module: it is inlined into the
+    // loop so the vectorizer sees plain arithmetic. The pointers are noalias,
+    // the arrays must not overlap. Returns nullptr on error.
+    llvm::Function* createBatchKernel(const std::string& functionName);
+
+    // Hands out the current module (e.g. to the JIT) and starts a new one.
+    // Functions of earlier modules stay callable, they are re-declared on use.
+    llvm::orc::ThreadSafeModule takeModule();
+
+    // Drops the current module and forgets every function seen so far. The
+    // context, and with it the types and constants it interned, is kept.
+    void reset();
+
+private:
+    std::unique_ptr<llvm::Module> createModule();
+    llvm::Function* lookupFunction(SymbolID name);
+    llvm::Function* declareFunction(SymbolID name, size_t numArgs);
+    void bindValue(SymbolID name, llvm::Value* value);
+    void clearValues();
+    void forgetValuesSince(size_t checkpoint);
+    // Emit one node of visit's walk. Each returns the child to emit next,
+    // whose value is then pushed to values, or nullptr once frame.value is set.
+    ExprAST* visit(NumberExprAST& numExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    ExprAST* visit(VariableExprAST& varExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    ExprAST* visit(BinaryExprAST& binExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    ExprAST* visit(CallExprAST& callExp, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    ExprAST* visit(IfExprAST& ifExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    ExprAST* visit(ForExprAST& forExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values);
+    llvm::Value* emitCondition(llvm::Value* condV);
+    // Emits expr as the function's result, ending the current block. False on error.
+    bool emitTail(ExprAST& expr);
+    bool hasSelfTailCall(ExprAST& expr, llvm::Function* func);
 };
+
+// PassBuilder's default module pipeline for options.optLevel with its
+// analysis managers. Functions are emitted unoptimized, so the inliner sees
+// every definition of the module. With options.lto the matching LTO pre-link
+// pipeline runs instead. Building all of this costs about as much as
+// optimizing a small module, so it can be kept and run over one module
+// after another.
+class ModuleOptimizer {
+    llvm::PassInstrumentationCallbacks pic;
+    std::unique_ptr<llvm::StandardInstrumentations> si;
+    llvm::PassBuilder pb;
+    llvm::LoopAnalysisManager lam;
+    llvm::FunctionAnalysisManager fam;
+    llvm::CGSCCAnalysisManager cgam;
+    llvm::ModuleAnalysisManager mam;
+    llvm::ModulePassManager mpm;
+
+public:
+    ModuleOptimizer(llvm::LLVMContext& context, const CompilerOptions& options,
+                    llvm::TargetMachine* targetMachine = nullptr);
+    // The analysis managers refer to each other
+    ModuleOptimizer(const ModuleOptimizer&) = delete;
+    ModuleOptimizer& operator=(const ModuleOptimizer&) = delete;
+
+    // Drops every analysis result afterwards, nothing refers to module once it returns
+    void run(llvm::Module& module);
+};
+
+// Runs a ModuleOptimizer for options once over the finished module
+void OptimizeModule(llvm::Module& module, const CompilerOptions& options,
+                    llvm::TargetMachine* targetMachine = nullptr);
+
 #endif // IRCONSTRUCTOR_H
\ No newline at end of file
@@ -0,0 +1,72 @@
+#ifndef INCREMENTALCOMPILER_H
+#define INCREMENTALCOMPILER_H
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+
+#include "CompilerOptions.hpp"
+#include "JIT.hpp"
+#include "ObjectCache.hpp"
+#include "SymbolTable.hpp"
+
+struct IncrementalStats {
+    size_t functions = 0;  // definitions in the source
+    size_t changed = 0;    // new or edited definitions
+    size_t recompiled = 0; // changed ones and everything calling them
+    size_t removed = 0;
+};
+
+// Recompiles a program that is edited over time, one definition at a time.
+// Every update re-parses the whole source and fingerprints each definition
+// and extern. A function is recompiled if its fingerprint changed or if it
+// (transitively) calls one that changed or disappeared. A caller has to be
+// recompiled because its callee may have been inlined and its calls are
+// bound to the old code.
+//
+// Every function is compiled into a module of its own, together with
+// available_externally copies of its direct callees so the inliner still
+// sees them. The result lives in a persistent JIT session, where every
+// function owns a resource tracker, or as per-function object code that
+// writeArchive links into a static archive.
+//
+// An update that fails to parse or compile leaves the previous state in place.
+// If the JIT rejects a module, the functions not added yet are gone from the
+// session until the next successful update compiles them again.
+class IncrementalCompiler {
+    struct FunctionState {
+        std::string fingerprint;
+        llvm::orc::ResourceTrackerSP tracker; // JIT mode
+        llvm::SmallVector<char, 0> object;    // object mode
+    };
+
+    CompilerOptions options;
+    std::shared_ptr<JITSession> jit;
+    std::shared_ptr<ObjectFileCache> objectCache;
+    // Shared by all updates so symbol IDs stay stable
+    std::shared_ptr<StringInterner> symbols;
+    std::map<std::string, FunctionState> functions; // ordered, archives are deterministic
+    std::map<std::string, std::string> externs; // name to fingerprint
+    IncrementalStats stats;
+
+public:
+    // Adds the code to jit
+    IncrementalCompiler(std::shared_ptr<JITSession> jit, const CompilerOptions& options = CompilerOptions());
+    // Keeps object code per function, optionally backed by an ObjectFileCache
+    explicit IncrementalCompiler(const CompilerOptions& options = CompilerOptions(),
+                                 std::shared_ptr<ObjectFileCache> objectCache = nullptr);
+
+    // Brings the compiled program up to date with source, false on errors
+    bool update(const std::string& source);
+
+    // Object mode only, one member per function
+    int writeArchive(const std::string& fileName) const;
+
+    // Of the last update
+    const IncrementalStats& getStats() const;
+};
+
+#endif // INCREMENTALCOMPILER_H
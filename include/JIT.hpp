@@ -0,0 +1,133 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/ExecutionEngine/Orc/ThreadSafeModule.h"
+#include "llvm/ExecutionEngine/Orc/Core.h"
+#include "llvm/Support/Error.h"
+
+#include "../include/CompilerOptions.hpp"
+#include "../include/ObjectCache.hpp"
+
+struct JITOptions {
+    // Compile functions on first call (LLLazyJIT) instead of when added
+    bool lazy = false;
+    // Optimization level every added module is optimized with
+    CompilerOptions compilerOptions;
+    // Reuse object code from disk instead of running codegen
+    std::shared_ptr<ObjectFileCache> objectCache;
+    // Give every compilation its own TargetMachine so modules can be added
+    // and looked up from several threads at once
+    bool concurrentCompilation = false;
+};
+
+// Number of parameters of a function type Kaleidoscope can emit, which takes
+// and returns doubles only. Other signatures do not compile.
+template <typename Signature>
+struct KaleidoscopeArity;
+
+template <typename... Args>
+struct KaleidoscopeArity<double(Args...)> {
+    static_assert((std::is_same_v<Args, double> && ...), "Kaleidoscope functions only take doubles");
+    static constexpr size_t value = sizeof...(Args);
+};
+
+// Long-lived JIT session built on ORC LLJIT. Modules are added incrementally
+// and everything added earlier stays callable. Code owned by a resource
+// tracker is freed when the tracker is removed, the rest with the session.
+//
+// Modules are optimized as a whole right before they are compiled. In lazy
+// mode (LLLazyJIT) adding a module only emits a callable stub per function.
+// A function is optimized and compiled the first time it is called.
+//
+// With an ObjectFileCache, modules whose object code is already on disk skip
+// codegen in either mode.
+//
+// Thread safety: with concurrentCompilation, addModule and lookup may be
+// called from any thread. Each thread builds its modules with its own Parser,
+// since a Parser and its IRConstructor (and LLVMContext) are single-threaded.
+class JITSession {
+    // LLJIT's destructor is not virtual, so each kind keeps its own owner
+    std::unique_ptr<llvm::orc::LLJIT> eagerJIT;
+    std::unique_ptr<llvm::orc::LLLazyJIT> lazyJIT;
+    llvm::orc::LLJIT* jit; // whichever of the two is in use
+    std::shared_ptr<std::atomic<size_t>> numCompiled; // shared with the transform layer
+    std::shared_ptr<ObjectFileCache> objectCache;
+    // Parameters of every function defined by an added module, -1 if it does
+    // not take and return doubles only. Registered with the ExecutionSession,
+    // so an entry goes away with the resource tracker its module was added under.
+    class ArityTable : public llvm::orc::ResourceManager {
+        struct Entry {
+            int arity;
+            llvm::orc::ResourceKey key; // of the tracker that owns the definition
+        };
+        std::mutex mutex;
+        llvm::StringMap<Entry> entries;
+        // Names recorded per tracker, some may since be owned by another one
+        llvm::DenseMap<llvm::orc::ResourceKey, std::vector<std::string>> namesByKey;
+
+    public:
+        void record(const llvm::Module& module, llvm::orc::ResourceKey key);
+        llvm::Error check(llvm::StringRef name, size_t numArgs);
+
+        llvm::Error handleRemoveResources(llvm::orc::JITDylib& dylib, llvm::orc::ResourceKey key) override;
+        void handleTransferResources(llvm::orc::JITDylib& dylib, llvm::orc::ResourceKey dstKey,
+                                     llvm::orc::ResourceKey srcKey) override;
+    };
+    ArityTable arities;
+
+    JITSession(std::unique_ptr<llvm::orc::LLJIT> eagerJIT, std::unique_ptr<llvm::orc::LLLazyJIT> lazyJIT,
+               std::shared_ptr<ObjectFileCache> objectCache);
+
+public:
+    static llvm::Expected<std::unique_ptr<JITSession>> Create(const JITOptions& options = JITOptions());
+    ~JITSession();
+
+    // Adds the module to the main JITDylib. Without a tracker the code lives
+    // as long as the session.
+    llvm::Error addModule(llvm::orc::ThreadSafeModule module,
+                          llvm::orc::ResourceTrackerSP tracker = nullptr);
+
+    // Adds object code compiled elsewhere (e.g. by CompileModuleToObject) as is
+    llvm::Error addObject(std::unique_ptr<llvm::MemoryBuffer> object,
+                          llvm::orc::ResourceTrackerSP tracker = nullptr);
+
+    llvm::orc::ResourceTrackerSP createResourceTracker();
+
+    // Looks up (and materializes) a JIT'd symbol
+    llvm::Expected<llvm::orc::ExecutorAddr> lookup(llvm::StringRef name);
+
+    // Same, as a native pointer to call the function directly, e.g.
+    // lookup<double(double, double)>("f"). Fails unless the function was
+    // added in a module that is still there and takes as many arguments as
+    // Signature. Object code added with addObject carries no signature to
+    // check against.
+    template <typename Signature>
+    llvm::Expected<Signature*> lookup(llvm::StringRef name) {
+        if (llvm::Error error = arities.check(name, KaleidoscopeArity<Signature>::value)) {
+            return std::move(error);
+        }
+        auto address = lookup(name);
+        if (!address) {
+            return address.takeError();
+        }
+        return address->toPtr<Signature*>();
+    }
+
+    const llvm::DataLayout& getDataLayout() const;
+
+    bool isLazy() const;
+    // Number of functions optimized so far, in lazy mode only those called
+    size_t getNumCompiledFunctions() const;
+};
+
+#endif // JIT_H
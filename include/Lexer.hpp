@@ -2,7 +2,13 @@
 #define LEXER_H
 
 #include <string>
-#include <stack>
+#include <string_view>
+#include <memory>
+#include <cstdint>
+
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "SymbolTable.hpp"
 
 // Define enum for different tokens
 enum Tokens {
@@ -11,34 +17,69 @@ enum Tokens {
     tok_eof = -1,
 
     // commands
-    tok_def = -2, 
+    tok_def = -2,
     tok_extern = -3,
 
     // primary
     tok_identifier = -4,
-    tok_number = -5
+    tok_number = -5,
+
+    // control flow
+    tok_if = -6,
+    tok_then = -7,
+    tok_else = -8,
+    tok_for = -9,
+    tok_in = -10
 };
 
-// Struct to hold token information
+// Token offsets and lengths are 32-bit, so a source holds at most this many bytes
+constexpr uint64_t MaxSourceSize = UINT32_MAX;
+
+// Compact token record. The token text is not copied, it is a span
+// (offset/length) into the source buffer owned by the Lexer.
 struct Token {
     int type;
-    std::string identifier;
+    uint32_t offset;
+    uint32_t length;
+    SymbolID symbol; // interned name of tok_identifier tokens
     double number_value;
-
-    Token(int t, const std::string& id = "", double num_val = 0.0)
-        : type(t), identifier(id), number_value(num_val) {}
 };
 
+// Zero-copy view over caller-owned memory, the caller must keep it alive.
+// nullptr if the source is larger than MaxSourceSize.
+std::unique_ptr<llvm::MemoryBuffer> ViewSource(std::string_view source);
+
+// Opens a source file, large files are memory-mapped instead of read.
+// nullptr if it cannot be opened or is larger than MaxSourceSize.
+std::unique_ptr<llvm::MemoryBuffer> MapSourceFile(const std::string& path);
+
 class Lexer {
-std::stack<char> st;
+    std::unique_ptr<llvm::MemoryBuffer> buffer;
+    std::shared_ptr<StringInterner> symbols;
+    const char* begin;
+    const char* cur; // cursor into the buffer
+    const char* end;
+    bool valid = true;
 
 public:
+    // Copies the input once into a buffer owned by the lexer
     Lexer(const std::string& input);
+    // Lexes directly over the buffer (see ViewSource and MapSourceFile)
+    Lexer(std::unique_ptr<llvm::MemoryBuffer> buffer,
+          std::shared_ptr<StringInterner> symbols = std::make_shared<StringInterner>());
 
     Token gettok();
 
-private: 
-    char getStrChar();
+    // Text of a token, valid as long as the lexer is alive
+    std::string_view GetText(const Token& tok) const;
+    // False if there was no buffer or it was larger than MaxSourceSize, the
+    // lexer then only returns tok_eof
+    bool IsValid() const;
+    std::string_view GetSource() const;
+    StringInterner& GetSymbols() const;
+
+private:
+    Token makeToken(int type, const char* start) const;
 };
 
-#endif // LEXER_H
\ No newline at end of file
+#endif // LEXER_H
@@ -0,0 +1,54 @@
+#ifndef OBJECTCACHE_H
+#define OBJECTCACHE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "llvm/IR/Module.h"
+#include "llvm/Target/TargetMachine.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+// Persistent, content-addressed store of emitted object code, keyed by a
+// hash of the module IR and the target configuration. Entries are published
+// with an atomic rename, so several processes and threads can share one
+// directory. Once the directory grows past maxSizeBytes the least recently
+// used entries are evicted, down to 7/8 of it so the next eviction scan is a
+// number of stores away. Entries are never evicted for their age or for the
+// free disk space.
+//
+// Each cache counts the bytes it stores, starting from the size of the
+// directory when it was opened and again after each eviction. The directory is only scanned for eviction
+// when that count passes maxSizeBytes, so with several processes sharing
+// one directory it can outgrow the cap until one of them notices.
+class ObjectFileCache {
+    std::string directory;
+    uint64_t maxSizeBytes;
+    std::atomic<uint64_t> storedBytes{0}; // upper bound of the directory size
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+
+public:
+    ObjectFileCache(std::string directory, uint64_t maxSizeBytes = 512 * 1024 * 1024);
+
+    // Hash of the module IR, triple, CPU, features and codegen settings
+    static std::string ComputeKey(const llvm::Module& module, const llvm::TargetMachine& targetMachine);
+
+    // nullptr on a miss
+    std::unique_ptr<llvm::MemoryBuffer> lookup(const std::string& key);
+    void store(const std::string& key, llvm::StringRef object);
+
+    // Adapter for the JIT compile layer, keys objects with the JIT's target machine
+    std::unique_ptr<llvm::ObjectCache> createJITCache(const llvm::TargetMachine& targetMachine);
+
+    uint64_t getHits() const;
+    uint64_t getMisses() const;
+
+private:
+    std::string getEntryPath(const std::string& key) const;
+    void evict();
+};
+
+#endif // OBJECTCACHE_H
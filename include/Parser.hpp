@@ -1,44 +1,102 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "llvm/ADT/STLFunctionalExtras.h"
+#include "llvm/ADT/SmallVector.h"
+
 #include "Lexer.hpp"
+#include "BoundedQueue.hpp"
 #include "AST.hpp"
+#include "ASTOptimizer.hpp"
 #include "IRConstructor.hpp"
+#include "JIT.hpp"
+
+// Tokens lexed on one thread and parsed on another, in chunks
+using TokenQueue = BoundedQueue<std::vector<Token>>;
 
+// A Parser and the IRConstructor (with its LLVMContext) it owns are meant for
+// one thread. To compile concurrently give every thread its own Parser; they
+// may share a JITSession created with concurrentCompilation, but not a
+// StringInterner.
 class Parser {
+    // A construct ParseExpression is inside of, it continues once the
+    // expression parsed at the top of the operand stack ends
+    struct PendingExpr {
+        enum Kind : uint8_t { Paren, CallArgs, IfCond, IfThen, IfElse, ForStart, ForCond, ForStep, ForBody };
+        Kind kind;
+        SymbolID symbol;     // callee or loop variable
+        size_t operatorBase; // operators of enclosing expressions lie below
+        size_t operandBase;  // first finished part (argument, condition, ...) on the operand stack
+    };
+
     Lexer lexer;
     Token curToken;
-    std::unordered_map<char, int> binopPrecedence;
     std::shared_ptr<IRConstructor> irConst;
+    std::shared_ptr<StringInterner> symbols;
+    ASTArena arena; // owns all AST nodes built by this parser
+    ASTOptimizer astOptimizer{arena};
+    std::shared_ptr<JITSession> jit;
+    // Set when another thread lexes (see SetTokenQueue)
+    TokenQueue* tokenQueue = nullptr;
+    std::vector<Token> queuedTokens;
+    size_t nextQueuedToken = 0;
+    size_t numAnonExprs = 0; // top-level expressions kept in the module
 
 public:
-    Parser(const std::string& input) : lexer(input), curToken(lexer.gettok()) {
-        binopPrecedence.emplace('+', 10);
-        binopPrecedence.emplace('-', 20);
-        binopPrecedence.emplace('*', 30);
+    Parser(const std::string& input, const CompilerOptions& options = CompilerOptions())
+        : Parser(llvm::MemoryBuffer::getMemBufferCopy(input, "<input>"), std::make_shared<StringInterner>(), options) {}
+
+    // Parses directly over the buffer without copying it (see ViewSource and MapSourceFile)
+    Parser(std::unique_ptr<llvm::MemoryBuffer> source, std::shared_ptr<StringInterner> symbols = std::make_shared<StringInterner>(),
+           const CompilerOptions& options = CompilerOptions())
+        : Parser(std::move(source), std::make_shared<IRConstructor>(symbols, options)) {}
 
-        irConst = std::make_shared<IRConstructor>();
-    }
+    // Generates code into an existing IRConstructor, using its symbols and options
+    Parser(std::unique_ptr<llvm::MemoryBuffer> source, std::shared_ptr<IRConstructor> irConst)
+        : lexer(std::move(source), irConst->getSharedSymbols()), curToken(lexer.gettok()), irConst(irConst),
+          symbols(irConst->getSharedSymbols()) {}
 
+    // Parses, generates code for and reports every top-level item of the input.
+    // 1 without doing anything if the lexer has no valid source (see Lexer::IsValid).
     int parse();
+    // Parses the whole input into ASTs without generating code. Top-level
+    // expressions are not allowed. Returns false on the first syntax error
+    // or if the lexer has no valid source.
+    bool ParseDefinitions(std::vector<PrototypeAST*>& externs, std::vector<FunctionAST*>& definitions);
+    // Same, but hands every item over as soon as it is parsed. Stops and
+    // returns false when a callback does.
+    bool ParseDefinitions(llvm::function_ref<bool(PrototypeAST*)> onExtern,
+                          llvm::function_ref<bool(FunctionAST*)> onDefinition);
     std::shared_ptr<IRConstructor> GetIRConstructor();
+    const ASTArena& GetArena() const;
+    const ASTOptimizerStats& GetASTStats() const;
+
+    // Adds each definition to the JIT as its own module and evaluates
+    // top-level expressions instead of leaving them in the IRConstructor module
+    void SetJIT(std::shared_ptr<JITSession> jit);
+
+    // Takes every following token from queue instead of lexing it. The
+    // parser's lexer then belongs to the thread filling the queue, which has
+    // to finish with a tok_eof token or close the queue.
+    void SetTokenQueue(TokenQueue* queue);
+    Lexer& GetLexer();
 
 private: 
     void NextToken();
+    char CurChar() const;
     void HandleDefinition();
     void HandleExtern();
     void HandleTopLevelExpression();
-    std::unique_ptr<FunctionAST> ParseDefinition();
-    std::unique_ptr<PrototypeAST> ParseExtern();
-    std::unique_ptr<PrototypeAST> ParseProto();
-    std::unique_ptr<ExprAST> ParseExpression();
-    std::unique_ptr<ExprAST> ParsePrimary();
-    std::unique_ptr<ExprAST> ParseNumberExpr();
-    std::unique_ptr<ExprAST> ParseIdentifierExpr();
-    std::unique_ptr<ExprAST> ParseParenExpr();
-    std::unique_ptr<ExprAST> ParseBinOpRHS(int exprPrecedence, std::unique_ptr<ExprAST> lhs);
-
-    int GetOperatorPrecedence();
+    void EvaluateTopLevelExpression();
+    FunctionAST* ParseDefinition();
+    FunctionAST* OptimizeDefinition(FunctionAST* fnAST);
+    PrototypeAST* ParseExtern();
+    PrototypeAST* ParseProto();
+    ExprAST* ParseExpression();
+    ExprAST* ParseNumberExpr();
+    bool ContinuePending(llvm::SmallVectorImpl<PendingExpr>& pending, llvm::SmallVectorImpl<ExprAST*>& operands);
+
+    int GetOperatorPrecedence() const;
 };
 
 #endif // PARSER_H
\ No newline at end of file
@@ -0,0 +1,51 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "CompilerOptions.hpp"
+
+struct PipelineOptions {
+    CompilerOptions compilerOptions;
+    // Codegen and optimization workers, 0 uses every core
+    unsigned jobs = 0;
+    // Definitions compiled into one module and object. Together with the
+    // input this fixes the output, the number of workers never changes it.
+    size_t definitionsPerModule = 16;
+    // Tokens the lexer hands to the parser at once
+    size_t tokensPerChunk = 4096;
+    // Token chunks and work items that may wait between two stages
+    size_t queueCapacity = 16;
+};
+
+// Compiles one large input in three stages that run at the same time:
+//   1. a lexer thread fills a bounded queue with chunks of tokens
+//   2. the calling thread parses and AST-optimizes definitions from the
+//      queue and groups them into work items of definitionsPerModule
+//   3. a pool of workers generates, optimizes and emits one object per item
+// Every worker has its own IRConstructor and LLVMContext. Functions of
+// earlier items are declared, at O1+ they are also copied into the module as
+// available_externally so the inliner still sees them. Only definitions and
+// externs are allowed at the top level.
+class Pipeline {
+    PipelineOptions options;
+    std::vector<llvm::SmallVector<char, 0>> objects;
+
+public:
+    explicit Pipeline(PipelineOptions options);
+
+    // False on the first parse or compile error
+    bool compile(std::unique_ptr<llvm::MemoryBuffer> source);
+
+    // Of the last compile, one object (or LTO bitcode) per work item in input order
+    const std::vector<llvm::SmallVector<char, 0>>& getObjects() const;
+    // Writes them as a static archive, 0 on success
+    int writeArchive(const std::string& fileName) const;
+};
+
+#endif // PIPELINE_H
@@ -0,0 +1,49 @@
+#ifndef SYMBOLTABLE_H
+#define SYMBOLTABLE_H
+
+#include <string_view>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "llvm/ADT/StringMap.h"
+
+// Dense integer id of an interned identifier
+using SymbolID = uint32_t;
+
+// Keywords are interned first so the lexer can recognise them by id
+enum KeywordSymbols : SymbolID {
+    sym_def = 0,
+    sym_extern,
+    sym_if,
+    sym_then,
+    sym_else,
+    sym_for,
+    sym_in,
+    sym_num_keywords
+};
+
+// Interns identifier strings, shared by the Lexer, Parser, AST and IRConstructor.
+// Ids are dense so they can index flat tables.
+//
+// Only one thread may intern at a time. Names are stored in segments that
+// never move, so other threads may call getName and size meanwhile, for ids
+// that were handed to them after being interned (see Pipeline).
+class StringInterner {
+    // Segment k holds FirstSegmentSize << k names, enough for every SymbolID
+    static constexpr size_t FirstSegmentSize = 64;
+    static constexpr size_t NumSegments = 27;
+
+    llvm::StringMap<SymbolID> ids; // owns the string data
+    std::unique_ptr<llvm::StringRef[]> segments[NumSegments]; // id -> name, points into ids
+    std::atomic<size_t> numNames{0};
+
+public:
+    StringInterner();
+
+    SymbolID intern(std::string_view name);
+    std::string_view getName(SymbolID id) const;
+    size_t size() const;
+};
+
+#endif // SYMBOLTABLE_H
@@ -0,0 +1,45 @@
+#ifndef TARGETCONFIG_H
+#define TARGETCONFIG_H
+
+#include <string>
+#include <memory>
+#include <optional>
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CodeGen.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Target/TargetMachine.h"
+
+// What to generate code for, shared by the AOT and JIT paths. By default code
+// is tuned for the machine the compiler runs on, including its ISA extensions
+// (e.g. AVX2 and FMA). Use Generic() for portable objects.
+struct TargetConfig {
+    // Empty selects the host triple
+    std::string triple;
+    // "host" detects the host CPU and adds all of its features
+    std::string cpu = "host";
+    // Extra features on top of the CPU's, e.g. "+avx2,-fma"
+    std::string features;
+    std::optional<llvm::Reloc::Model> relocModel = llvm::Reloc::PIC_;
+    // Unset uses the target's default code model
+    std::optional<llvm::CodeModel::Model> codeModel;
+    llvm::CodeGenOptLevel codeGenOptLevel = llvm::CodeGenOptLevel::Default;
+
+    // Baseline CPU of the host triple without optional features
+    static TargetConfig Generic();
+
+    std::string getTriple() const;
+    // The CPU and feature string after resolving "host"
+    std::string getCPU() const;
+    std::string getFeatures() const;
+
+    llvm::orc::JITTargetMachineBuilder createJITTargetMachineBuilder() const;
+    // Requires the targets to be initialized (see InitializeTargets)
+    llvm::Expected<std::unique_ptr<llvm::TargetMachine>> createTargetMachine() const;
+};
+
+// Sets the triple and data layout the module will be optimized and emitted for
+void ConfigureModule(llvm::Module& module, const llvm::TargetMachine& targetMachine);
+
+#endif // TARGETCONFIG_H
@@ -0,0 +1,111 @@
+#ifndef TIEREDJIT_H
+#define TIEREDJIT_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/Error.h"
+
+#include "AST.hpp"
+#include "BoundedQueue.hpp"
+#include "CompilerOptions.hpp"
+#include "JIT.hpp"
+
+class Parser;
+class IRConstructor;
+
+struct TieredJITOptions {
+    // Tier 1 optimization level and target. Tier 0 is always O0 without codegen optimizations.
+    CompilerOptions compilerOptions;
+    // Calls plus loop iterations after which a function is recompiled at tier 1
+    uint64_t hotThreshold = 1000;
+    // Hand the tier 0 counts to tier 1 as entry counts and branch weights
+    bool profileGuided = true;
+};
+
+// Counts collected by a function's tier 0 code
+struct FunctionProfile {
+    uint64_t calls = 0;
+    // Taken and not taken count of every conditional branch, in block order
+    std::vector<std::pair<uint64_t, uint64_t>> branches;
+};
+
+// JIT that starts every function in a cheap tier and recompiles hot ones.
+//
+// Tier 0 is compiled at O0 when a definition is added. It counts calls, loop
+// iterations and the direction of every branch. Once calls plus iterations
+// reach hotThreshold, a background thread recompiles the function with the
+// full pipeline, using the counts as profile data, and callees copied in for
+// inlining. Every function is entered through a small stub that calls the
+// current tier through a pointer, switching it is a single atomic store, so
+// callers (JIT'd or holding an address from lookup) pick up tier 1 with
+// their next call. Calls already running finish in tier 0.
+//
+// Only externs and definitions are accepted, addSource must be called from
+// one thread at a time. Compiled functions may be called from any thread.
+class TieredJIT {
+    struct FunctionState;
+
+    TieredJITOptions options;
+    std::unique_ptr<JITSession> session;
+    std::shared_ptr<StringInterner> symbols;
+    std::unique_ptr<IRConstructor> tier0;
+    std::vector<std::unique_ptr<Parser>> parsers; // own the ASTs
+    // Shared with the background compiler
+    std::mutex mutex;
+    llvm::DenseMap<SymbolID, std::unique_ptr<FunctionState>> functions;
+    llvm::StringMap<FunctionState*> functionsByName;
+    llvm::DenseMap<SymbolID, PrototypeAST*> prototypes; // of externs and definitions
+
+    // Never blocks, since the tier 0 code pushes to it
+    BoundedQueue<FunctionState*> requests{SIZE_MAX};
+    std::condition_variable idle;
+    size_t pendingTierUps = 0;
+    std::atomic<size_t> numTierUps{0};
+    std::atomic<bool> stopping{false};
+    std::thread compiler;
+
+    explicit TieredJIT(const TieredJITOptions& options);
+
+public:
+    static llvm::Expected<std::unique_ptr<TieredJIT>> Create(const TieredJITOptions& options = TieredJITOptions());
+    // Skips recompilations that have not started yet
+    ~TieredJIT();
+
+    // Parses the externs and definitions of source and compiles the
+    // definitions at tier 0. False on the first error, earlier items stay.
+    bool addSource(const std::string& source);
+
+    // Entry of a function, it always runs the newest tier
+    llvm::Expected<llvm::orc::ExecutorAddr> lookup(llvm::StringRef name);
+    // Typed like JITSession::lookup<Signature>
+    template <typename Signature>
+    llvm::Expected<Signature*> lookup(llvm::StringRef name) {
+        return session->lookup<Signature>(name);
+    }
+
+    // Blocks until every requested recompilation is installed
+    void waitForTierUps();
+
+    // 0 or 1, -1 for unknown functions
+    int getTier(llvm::StringRef name);
+    FunctionProfile getProfile(llvm::StringRef name);
+    size_t getNumTierUps() const;
+
+private:
+    FunctionState* find(llvm::StringRef name);
+    bool addDefinition(FunctionAST* funcAST);
+    void runCompiler();
+    bool compileTier1(FunctionState& state, IRConstructor& irConst);
+    static void RequestTierUp(FunctionState* state);
+};
+
+#endif // TIEREDJIT_H
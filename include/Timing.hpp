@@ -0,0 +1,93 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "llvm/ADT/StringRef.h"
+
+// Process-wide compile time instrumentation. While timing is disabled a
+// TimeScope costs one relaxed atomic load. Once enabled every scope records
+// its wall and thread CPU time, the phase and a detail such as the function
+// name. Scopes may be nested and used from any thread, nested phases are
+// included in the times of the phases around them.
+//
+// Phases recorded by the compiler:
+//   Parse       one definition, lexing included since tokens are read on demand
+//   ASTOptimize one definition
+//   Codegen     IR construction of one function
+//   Optimize    the module pipeline (OptimizeModule)
+//   Emit        MC code generation of one module or partition
+//   JITLookup   a JIT lookup, including materializing the symbol
+//   JITCodegen  MC code generation of one JIT module
+//   ParseFile, CompileFile and Link  the steps of the Driver
+
+struct TimingEvent {
+    const char* phase; // a string literal
+    std::string detail;
+    uint64_t startNanos; // since timing was enabled
+    uint64_t wallNanos;
+    uint64_t cpuNanos;
+    uint32_t thread;
+};
+
+namespace timing_detail {
+extern std::atomic<bool> enabled;
+}
+
+inline bool IsTimingEnabled() {
+    return timing_detail::enabled.load(std::memory_order_relaxed);
+}
+
+// Starts recording, events of an earlier run are dropped
+void EnableTiming();
+// Stops recording, the events stay available
+void DisableTiming();
+
+std::vector<TimingEvent> GetTimingEvents();
+
+// Totals per phase and the slowest functions, sorted by wall time
+void PrintTimingSummary(std::ostream& os);
+
+// Writes the events in Chrome's trace event format (chrome://tracing, Perfetto)
+bool WriteChromeTrace(const std::string& fileName);
+
+class TimeScope {
+    const char* phase;
+    bool active;
+    std::string detail;
+    uint64_t startWall;
+    uint64_t startCPU;
+
+public:
+    TimeScope(const char* phase, llvm::StringRef detail = llvm::StringRef())
+        : phase(phase), active(IsTimingEnabled()) {
+        if (active) {
+            start(detail);
+        }
+    }
+    ~TimeScope() {
+        if (active) {
+            finish();
+        }
+    }
+
+    TimeScope(const TimeScope&) = delete;
+    TimeScope& operator=(const TimeScope&) = delete;
+
+    // For details only known once the phase is done, e.g. the parsed function's name
+    void setDetail(llvm::StringRef newDetail) {
+        if (active) {
+            detail = newDetail.str();
+        }
+    }
+
+private:
+    void start(llvm::StringRef detail);
+    void finish();
+};
+
+#endif // TIMING_H
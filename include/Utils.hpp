@@ -2,15 +2,64 @@
 #define UTILS_H
 
 #include "../include/IRConstructor.hpp"
+#include "../include/JIT.hpp"
+#include "../include/ObjectCache.hpp"
 
 #include <string>
+#include <vector>
 
 #include "llvm/IR/Value.h"
-#include "llvm/ExecutionEngine/GenericValue.h"
+#include "llvm/TargetParser/Triple.h"
 
 llvm::Value* LogErrorV(const std::string error);
 
-int CompileToObjectFile(std::shared_ptr<IRConstructor> irConst, std::string fileName);
+// Prints and consumes the error, returns true if there was one
+bool LogIfError(llvm::Error error);
+
+// Registers all targets once, safe to call from any thread
+void InitializeTargets();
+
+// Optimizes the module with options and emits it as object code into object.
+// With options.lto it emits LTO bitcode instead, which clang and lld link
+// like their own -flto output, and the cache is not used.
+int CompileModuleToObject(llvm::Module& module, const CompilerOptions& options, llvm::SmallVectorImpl<char>& object,
+                          ObjectFileCache* cache = nullptr);
+
+// Optimizes the module with the IRConstructor's options and emits it as object
+// code into object. Like CompileToObjectFile this may run on several threads
+// at once, each with its own IRConstructor.
+int CompileToObjectBuffer(std::shared_ptr<IRConstructor> irConst, llvm::SmallVectorImpl<char>& object,
+                          ObjectFileCache* cache = nullptr);
+
+// Same as CompileToObjectBuffer, but emits textual assembly
+int CompileToAssembly(std::shared_ptr<IRConstructor> irConst, llvm::SmallVectorImpl<char>& assembly);
+
+// Emits the module as an object file, or as LTO bitcode with options.lto.
+// With a cache, codegen is skipped when the same module was compiled for the
+// same target before.
+int CompileToObjectFile(std::shared_ptr<IRConstructor> irConst, std::string fileName,
+                        ObjectFileCache* cache = nullptr);
+
+// Splits the module by function into numPartitions parts and runs codegen on
+// up to numThreads threads (0 uses every core). Writes an archive with one
+// object per part. The output only depends on the module and numPartitions,
+// never on the number of threads.
+int CompileToArchive(std::shared_ptr<IRConstructor> irConst, std::string fileName, unsigned numPartitions,
+                     unsigned numThreads = 0, ObjectFileCache* cache = nullptr);
+
+// Writes a static archive with one member per object, member order is kept
+int WriteObjectArchive(const std::string& fileName, llvm::ArrayRef<std::string> memberNames,
+                       llvm::ArrayRef<llvm::SmallVector<char, 0>> objects, const llvm::Triple& triple);
+
+// Moves the parsed module into the JIT session and calls functionName with args,
+// at most 4 of them. The IRConstructor stays usable and can keep adding to the
+// same session; if functionName or the argument count is wrong, it keeps its
+// module too.
+llvm::Expected<double> RunParsedFunction(JITSession& jit, std::shared_ptr<IRConstructor> irConst,
+                                         const std::string functionName, const std::vector<double>& args = {});
+
+// Same as above in a session that only lives for this call
+llvm::Expected<double> RunParsedFunction(std::shared_ptr<IRConstructor> irConst, const std::string functionName,
+                                         const std::vector<double>& args = {});
 
-llvm::GenericValue RunParsedFunction(std::shared_ptr<IRConstructor> irConst, const std::string functionName);
 #endif // UTILS_H
\ No newline at end of file
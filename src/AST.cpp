@@ -2,48 +2,43 @@
 #include "../include/Utils.hpp"
 
 #include <iostream>
+#include <type_traits>
 
+// Nodes live in an ASTArena which never runs destructors
+static_assert(std::is_trivially_destructible<NumberExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<VariableExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<BinaryExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<CallExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<IfExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<ForExprAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<PrototypeAST>::value, "AST nodes must not own resources");
+static_assert(std::is_trivially_destructible<FunctionAST>::value, "AST nodes must not own resources");
 
-double NumberExprAST::getValue() const {
-    return value;
-}
-
-std::string VariableExprAST::getValue() const {
-    return value;
-}
-
-ExprAST& BinaryExprAST::getLHSRef() const {
-    return *LHS;
-}
 
-ExprAST& BinaryExprAST::getRHSRef() const {
-    return *RHS;
+SymbolID PrototypeAST::getName() const {
+    return name;
 }
 
-char BinaryExprAST::getOp() const {
-    return op;
+llvm::ArrayRef<SymbolID> PrototypeAST::getArgs() const {
+    return args;
 }
 
-std::string CallExprAST::getCallee() const {
-    return callee;
+PrototypeAST& FunctionAST::getProto() const {
+    return *proto;
 }
 
-std::vector<std::unique_ptr<ExprAST>>& CallExprAST::getArgs() {
-    return args; 
+ExprAST& FunctionAST::getBody() const {
+    return *body;
 }
 
-std::string PrototypeAST::getName() const {
-    return name;
+size_t ASTArena::getBytesUsed() const {
+    return allocator.getBytesAllocated();
 }
 
-std::vector<std::string>& PrototypeAST::getArgs() {
-    return args;
+size_t ASTArena::getBytesReserved() const {
+    return allocator.getTotalMemory();
 }
 
-PrototypeAST& FunctionAST::getProto() const {
-    return *proto;
+void ASTArena::reset() {
+    allocator.Reset();
 }
-
-ExprAST& FunctionAST::getBody() const {
-    return *body;
-}
\ No newline at end of file
@@ -0,0 +1,280 @@
+#include "../include/ASTOptimizer.hpp"
+
+#include <cmath>
+#include <utility>
+
+#include "llvm/ADT/Hashing.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/bit.h"
+
+size_t ASTOptimizer::NodeKeyHash::operator()(const NodeKey& key) const {
+    return llvm::hash_combine(key.kind, key.op, key.first, key.second);
+}
+
+static uint64_t Address(const ExprAST* expr) {
+    return reinterpret_cast<uintptr_t>(expr);
+}
+
+// Shared nodes are counted once
+static size_t CountNodes(ExprAST& expr, llvm::DenseSet<const ExprAST*>& seen) {
+    size_t count = 0;
+    forEachNode(expr, [&](ExprAST& node) {
+        if (!seen.insert(&node).second) {
+            return false;
+        }
+        count++;
+        return true;
+    });
+    return count;
+}
+
+// Same semantics as the IR IRConstructor emits for the operator
+static bool Fold(char op, double l, double r, double& result) {
+    switch (op) {
+        case '+':
+            result = l + r;
+            return true;
+        case '-':
+            result = l - r;
+            return true;
+        case '*':
+            result = l * r;
+            return true;
+        case '<':
+            result = !(l >= r) ? 1.0 : 0.0; // unordered or less than, like fcmp ult
+            return true;
+        default:
+            return false;
+    }
+}
+
+// True if x op literal == x for every x, including NaN, infinities and -0
+static bool IsIdentity(char op, double literal, FPMode mode) {
+    bool signedZeros = mode != FPMode::Fast;
+    switch (op) {
+        case '*':
+            return literal == 1.0;
+        case '+': // +0 + -0 is +0, so only -0 is neutral
+            return literal == 0.0 && (std::signbit(literal) || !signedZeros);
+        case '-': // -0 - +0 is -0, so only +0 is neutral
+            return literal == 0.0 && (!std::signbit(literal) || !signedZeros);
+        default:
+            return false;
+    }
+}
+
+FunctionAST* ASTOptimizer::optimize(FunctionAST& funcAST, FPMode mode) {
+    fpMode = mode;
+    canonicalNodes.clear();
+    canonical.clear();
+    loopScopes.clear();
+    numLoops = 0;
+
+    llvm::DenseSet<const ExprAST*> seen;
+    stats.functions++;
+    stats.nodesBefore += CountNodes(funcAST.getBody(), seen);
+    ExprAST* body = optimize(funcAST.getBody());
+    seen.clear();
+    stats.nodesAfter += CountNodes(*body, seen);
+
+    if (body == &funcAST.getBody()) {
+        return &funcAST;
+    }
+    return arena.create<FunctionAST>(&funcAST.getProto(), body);
+}
+
+const ASTOptimizerStats& ASTOptimizer::getStats() const {
+    return stats;
+}
+
+// Post-order walk over an explicit stack, so the depth of the tree does not
+// matter. Children are optimized in evaluation order and leave their result
+// on results, where their parent picks them up once it has all of them.
+ExprAST* ASTOptimizer::optimize(ExprAST& root) {
+    struct Frame {
+        ExprAST* expr;
+        unsigned stage = 0; // children started so far
+        unsigned outerScope = 0; // of a for loop's variable
+    };
+    llvm::SmallVector<Frame, 32> frames{{&root}};
+    llvm::SmallVector<ExprAST*, 32> results;
+
+    while (!frames.empty()) {
+        Frame& frame = frames.back();
+        ExprAST& expr = *frame.expr;
+        ExprAST* child = nullptr; // optimized next
+        ExprAST* result = nullptr; // of the whole frame
+        switch (expr.getKind()) {
+            case ExprAST::Number: {
+                double value = llvm::cast<NumberExprAST>(expr).getValue();
+                result = intern({ExprAST::Number, 0, llvm::bit_cast<uint64_t>(value), 0}, [&] { return &expr; });
+                break;
+            }
+            case ExprAST::Variable: {
+                SymbolID symbol = llvm::cast<VariableExprAST>(expr).getSymbol();
+                result = intern({ExprAST::Variable, 0, symbol, loopScopes.lookup(symbol)}, [&] { return &expr; });
+                break;
+            }
+            case ExprAST::Binary: {
+                auto& binExpr = llvm::cast<BinaryExprAST>(expr);
+                if (frame.stage == 0) {
+                    child = &binExpr.getLHSRef();
+                } else if (frame.stage == 1) {
+                    child = &binExpr.getRHSRef();
+                } else {
+                    ExprAST* rhs = results.pop_back_val();
+                    ExprAST* lhs = results.pop_back_val();
+                    result = optimizeBinary(binExpr, lhs, rhs);
+                }
+                break;
+            }
+            case ExprAST::Call: {
+                auto& callExpr = llvm::cast<CallExprAST>(expr);
+                size_t numArgs = callExpr.getArgs().size();
+                if (frame.stage < numArgs) {
+                    child = callExpr.getArgs()[frame.stage];
+                } else {
+                    result = optimizeCall(callExpr, llvm::ArrayRef<ExprAST*>(results).take_back(numArgs));
+                    results.resize(results.size() - numArgs);
+                }
+                break;
+            }
+            case ExprAST::If: {
+                auto& ifExpr = llvm::cast<IfExprAST>(expr);
+                if (frame.stage == 0) {
+                    child = &ifExpr.getCond();
+                } else if (frame.stage == 1) {
+                    if (auto* num = llvm::dyn_cast<NumberExprAST>(results.back())) {
+                        // Only the branch taken is left, it takes the place of the if
+                        stats.foldedConstants++;
+                        results.pop_back();
+                        // Same test as IRConstructor's fcmp one
+                        bool taken = num->getValue() != 0.0 && !std::isnan(num->getValue());
+                        frame = Frame{taken ? &ifExpr.getThen() : &ifExpr.getElse()};
+                        continue;
+                    }
+                    child = &ifExpr.getThen();
+                } else if (frame.stage == 2) {
+                    child = &ifExpr.getElse();
+                } else {
+                    ExprAST* elseExpr = results.pop_back_val();
+                    ExprAST* thenExpr = results.pop_back_val();
+                    ExprAST* cond = results.pop_back_val();
+                    result = optimizeIf(ifExpr, cond, thenExpr, elseExpr);
+                }
+                break;
+            }
+            case ExprAST::For: {
+                auto& forExpr = llvm::cast<ForExprAST>(expr);
+                SymbolID var = forExpr.getVar();
+                if (frame.stage == 0) {
+                    child = &forExpr.getStart();
+                } else if (frame.stage == 1) {
+                    // Gives the loop variable its own nodes while cond, step and body are optimized
+                    auto scope = loopScopes.find(var);
+                    frame.outerScope = scope != loopScopes.end() ? scope->second : 0;
+                    loopScopes[var] = ++numLoops;
+                    child = &forExpr.getCond();
+                } else if (frame.stage == 2) {
+                    child = forExpr.getStep();
+                    if (!child) {
+                        results.push_back(nullptr);
+                        frame.stage++;
+                        continue;
+                    }
+                } else if (frame.stage == 3) {
+                    child = &forExpr.getBody();
+                } else {
+                    loopScopes[var] = frame.outerScope;
+                    ExprAST* body = results.pop_back_val();
+                    ExprAST* step = results.pop_back_val();
+                    ExprAST* cond = results.pop_back_val();
+                    ExprAST* start = results.pop_back_val();
+                    result = optimizeFor(forExpr, start, cond, step, body);
+                }
+                break;
+            }
+        }
+
+        if (child) {
+            frame.stage++;
+            frames.push_back({child});
+        } else {
+            results.push_back(result);
+            frames.pop_back();
+        }
+    }
+    return results.back();
+}
+
+ExprAST* ASTOptimizer::optimizeBinary(BinaryExprAST& binExpr, ExprAST* lhs, ExprAST* rhs) {
+    char op = binExpr.getOp();
+
+    auto* lNum = llvm::dyn_cast<NumberExprAST>(lhs);
+    auto* rNum = llvm::dyn_cast<NumberExprAST>(rhs);
+    double folded;
+    if (lNum && rNum && Fold(op, lNum->getValue(), rNum->getValue(), folded)) {
+        stats.foldedConstants++;
+        return intern({ExprAST::Number, 0, llvm::bit_cast<uint64_t>(folded), 0},
+                      [&] { return arena.create<NumberExprAST>(folded); });
+    }
+
+    // Canonical operand order lets 1+x and x+1 share a node
+    if ((op == '+' || op == '*') && lNum && !rNum) {
+        std::swap(lhs, rhs);
+        std::swap(lNum, rNum);
+    }
+    if (rNum && IsIdentity(op, rNum->getValue(), fpMode)) {
+        stats.simplifiedIdentities++;
+        return lhs;
+    }
+
+    auto create = [&]() -> ExprAST* {
+        if (lhs == &binExpr.getLHSRef() && rhs == &binExpr.getRHSRef()) {
+            return &binExpr;
+        }
+        return arena.create<BinaryExprAST>(op, lhs, rhs);
+    };
+    // Operands containing calls are not canonical, calls may have side effects
+    if (!canonical.count(lhs) || !canonical.count(rhs)) {
+        return create();
+    }
+    return intern({ExprAST::Binary, op, Address(lhs), Address(rhs)}, create);
+}
+
+ExprAST* ASTOptimizer::optimizeCall(CallExprAST& callExpr, llvm::ArrayRef<ExprAST*> args) {
+    if (args == callExpr.getArgs()) {
+        return &callExpr;
+    }
+    return arena.create<CallExprAST>(callExpr.getCallee(), arena.copyArray<ExprAST*>(args));
+}
+
+// Not canonical itself, only one branch runs
+ExprAST* ASTOptimizer::optimizeIf(IfExprAST& ifExpr, ExprAST* cond, ExprAST* thenExpr, ExprAST* elseExpr) {
+    if (cond == &ifExpr.getCond() && thenExpr == &ifExpr.getThen() && elseExpr == &ifExpr.getElse()) {
+        return &ifExpr;
+    }
+    return arena.create<IfExprAST>(cond, thenExpr, elseExpr);
+}
+
+ExprAST* ASTOptimizer::optimizeFor(ForExprAST& forExpr, ExprAST* start, ExprAST* cond, ExprAST* step,
+                                   ExprAST* body) {
+    if (start == &forExpr.getStart() && cond == &forExpr.getCond() && step == forExpr.getStep() &&
+        body == &forExpr.getBody()) {
+        return &forExpr;
+    }
+    return arena.create<ForExprAST>(forExpr.getVar(), start, cond, step, body);
+}
+
+template <typename CreateFn>
+ExprAST* ASTOptimizer::intern(const NodeKey& key, CreateFn create) {
+    auto existing = canonicalNodes.find(key);
+    if (existing != canonicalNodes.end()) {
+        stats.mergedSubexpressions++;
+        return existing->second;
+    }
+    ExprAST* expr = create();
+    canonicalNodes.emplace(key, expr);
+    canonical.insert(expr);
+    return expr;
+}
@@ -0,0 +1,72 @@
+#include "../include/CompilerSession.hpp"
+#include "../include/Parser.hpp"
+#include "../include/Timing.hpp"
+#include "../include/Utils.hpp"
+
+CompilerSession::CompilerSession(const CompilerOptions& options, size_t modulesPerContext,
+                                 std::unique_ptr<llvm::TargetMachine> targetMachine)
+    : options(options), modulesPerContext(std::max<size_t>(modulesPerContext, 1)),
+      targetMachine(std::move(targetMachine)) {
+    createContext();
+}
+
+llvm::Expected<std::unique_ptr<CompilerSession>> CompilerSession::Create(const CompilerOptions& options,
+                                                                         size_t modulesPerContext) {
+    if (options.lto != LTOMode::None) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "LTO bitcode is not emitted by a CompilerSession, use CompileModuleToObject");
+    }
+    InitializeTargets();
+    auto targetMachine = options.target.createTargetMachine();
+    if (!targetMachine) {
+        return targetMachine.takeError();
+    }
+
+    std::unique_ptr<CompilerSession> session(
+        new CompilerSession(options, modulesPerContext, std::move(*targetMachine)));
+    // The pass manager streams into codegenOutput from now on, so the session must not move
+    if (session->targetMachine->addPassesToEmitFile(session->codegen, session->codegenStream, nullptr,
+                                                    llvm::CodeGenFileType::ObjectFile)) {
+        return llvm::createStringError(llvm::inconvertibleErrorCode(),
+                                       "TheTargetMachine can't emit a file of this type");
+    }
+    return session;
+}
+
+bool CompilerSession::addSource(std::string_view source) {
+    Parser parser(ViewSource(source), irConst);
+    return parser.ParseDefinitions(
+        [&](PrototypeAST* protoAST) { return protoAST->codegen(*irConst) != nullptr; },
+        [&](FunctionAST* fnAST) { return fnAST->codegen(*irConst) != nullptr; });
+}
+
+void CompilerSession::compile(llvm::SmallVectorImpl<char>& object) {
+    llvm::Module& module = irConst->getModule();
+    ConfigureModule(module, *targetMachine);
+    optimizer->run(module);
+
+    TimeScope scope("Emit", module.getModuleIdentifier());
+    codegenOutput.clear();
+    codegen.run(module);
+    object.assign(codegenOutput.begin(), codegenOutput.end());
+}
+
+void CompilerSession::reset() {
+    if (++numModules < modulesPerContext) {
+        irConst->reset();
+        return;
+    }
+    createContext();
+}
+
+IRConstructor& CompilerSession::getIRConstructor() {
+    return *irConst;
+}
+
+// The symbols are indexed like the IRConstructor's tables, they are replaced together
+void CompilerSession::createContext() {
+    numModules = 0;
+    optimizer.reset();
+    irConst = std::make_shared<IRConstructor>(std::make_shared<StringInterner>(), options);
+    optimizer = std::make_unique<ModuleOptimizer>(irConst->getContext(), options, targetMachine.get());
+}
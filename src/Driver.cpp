@@ -0,0 +1,262 @@
+#include "../include/Driver.hpp"
+#include "../include/Parser.hpp"
+#include "../include/Timing.hpp"
+#include "../include/Utils.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <set>
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Linker/Linker.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/ThreadPool.h"
+
+namespace {
+// State of one input file, only touched by one job at a time
+struct SourceUnit {
+    std::string path;
+    std::unique_ptr<Parser> parser;
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    std::set<std::string> callees;
+    llvm::SmallVector<char, 0> output; // object code or bitcode
+    bool succeeded = false;
+    FileTiming timing;
+};
+
+struct Definition {
+    size_t arity;
+    size_t unit;
+};
+} // namespace
+
+static double SecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static void ParseUnit(SourceUnit& unit, const CompilerOptions& options) {
+    TimeScope scope("ParseFile", unit.path);
+    auto start = std::chrono::steady_clock::now();
+    auto source = MapSourceFile(unit.path);
+    if (!source) {
+        return;
+    }
+    auto symbols = std::make_shared<StringInterner>();
+    unit.parser = std::make_unique<Parser>(std::move(source), symbols, options);
+    if (!unit.parser->ParseDefinitions(unit.externs, unit.definitions)) {
+        LogErrorV("Failed to parse " + unit.path);
+        return;
+    }
+    llvm::SmallVector<SymbolID, 16> callees;
+    for (FunctionAST* funcAST : unit.definitions) {
+        collectCallees(funcAST->getBody(), callees);
+    }
+    for (SymbolID callee : callees) {
+        unit.callees.insert(std::string(symbols->getName(callee)));
+    }
+    unit.timing.parseSeconds = SecondsSince(start);
+    unit.timing.astBytes = unit.parser->GetArena().getBytesUsed();
+    unit.timing.astNodesRemoved = unit.parser->GetASTStats().getNodesRemoved();
+    unit.succeeded = true;
+}
+
+// Generates the unit's IR and emits it as object code, or as bitcode if the
+// program is linked into one object afterwards
+static void CompileUnit(SourceUnit& unit, const std::map<std::string, Definition>& program,
+                        const CompilerOptions& options, bool emitObject) {
+    TimeScope scope("CompileFile", unit.path);
+    auto start = std::chrono::steady_clock::now();
+    unit.succeeded = false;
+    auto irConst = unit.parser->GetIRConstructor();
+    StringInterner& symbols = irConst->getSymbols();
+
+    for (PrototypeAST* protoAST : unit.externs) {
+        if (!protoAST->codegen(*irConst)) {
+            return;
+        }
+    }
+    std::set<std::string> local;
+    for (FunctionAST* funcAST : unit.definitions) {
+        local.insert(std::string(symbols.getName(funcAST->getProto().getName())));
+    }
+    // Functions of other files are callable without an extern
+    for (const std::string& callee : unit.callees) {
+        auto definition = program.find(callee);
+        if (definition != program.end() && !local.count(callee)) {
+            if (!irConst->declareExtern(callee, definition->second.arity)) {
+                return;
+            }
+        }
+    }
+    for (FunctionAST* funcAST : unit.definitions) {
+        if (!funcAST->codegen(*irConst)) {
+            LogErrorV("Failed to compile " + unit.path);
+            return;
+        }
+    }
+
+    if (emitObject) {
+        if (CompileToObjectBuffer(irConst, unit.output) != 0) {
+            return;
+        }
+    } else {
+        llvm::raw_svector_ostream os(unit.output);
+        llvm::WriteBitcodeToFile(irConst->getModule(), os);
+    }
+    unit.timing.compileSeconds = SecondsSince(start);
+    unit.succeeded = true;
+}
+
+// Member names are the file names, made unique with the input index
+static std::vector<std::string> MemberNames(const std::vector<SourceUnit>& units) {
+    std::map<std::string, int> seen;
+    std::vector<std::string> names;
+    for (size_t i = 0; i < units.size(); i++) {
+        std::string stem = llvm::sys::path::stem(units[i].path).str();
+        names.push_back(seen[stem]++ ? stem + "." + std::to_string(i) + ".o" : stem + ".o");
+    }
+    return names;
+}
+
+static int LinkAndEmit(std::vector<SourceUnit>& units, const CompilerOptions& options,
+                       llvm::SmallVectorImpl<char>& object) {
+    TimeScope scope("Link");
+    llvm::LLVMContext context;
+    std::unique_ptr<llvm::Module> program;
+    std::unique_ptr<llvm::Linker> linker;
+    for (SourceUnit& unit : units) {
+        llvm::MemoryBufferRef buffer(llvm::StringRef(unit.output.data(), unit.output.size()), unit.path);
+        auto module = llvm::parseBitcodeFile(buffer, context);
+        if (!module) {
+            LogIfError(module.takeError());
+            return 1;
+        }
+        if (!program) {
+            program = std::move(*module);
+            program->setModuleIdentifier("program");
+            linker = std::make_unique<llvm::Linker>(*program);
+        } else if (linker->linkInModule(std::move(*module))) {
+            LogErrorV("Failed to link " + unit.path);
+            return 1;
+        }
+    }
+    return CompileModuleToObject(*program, options, object);
+}
+
+Driver::Driver(DriverOptions options) : options(std::move(options)) {}
+
+int Driver::run() {
+    InitializeTargets();
+    fileTimings.clear();
+    if (options.inputs.empty()) {
+        LogErrorV("No input files");
+        return 1;
+    }
+
+    std::vector<SourceUnit> units(options.inputs.size());
+    for (size_t i = 0; i < units.size(); i++) {
+        units[i].path = options.inputs[i];
+        units[i].timing.path = options.inputs[i];
+    }
+
+    llvm::ThreadPool pool(llvm::hardware_concurrency(options.jobs));
+    for (SourceUnit& unit : units) {
+        pool.async([&unit, this] { ParseUnit(unit, options.compilerOptions); });
+    }
+    pool.wait();
+
+    // Every function of the program, in input order
+    std::map<std::string, Definition> program;
+    bool valid = true;
+    for (size_t i = 0; i < units.size(); i++) {
+        if (!units[i].succeeded) {
+            return 1;
+        }
+        StringInterner& symbols = units[i].parser->GetIRConstructor()->getSymbols();
+        for (FunctionAST* funcAST : units[i].definitions) {
+            std::string name(symbols.getName(funcAST->getProto().getName()));
+            auto inserted = program.emplace(name, Definition{funcAST->getProto().getArgs().size(), i});
+            if (!inserted.second) {
+                LogErrorV(name + " is defined in " + units[inserted.first->second.unit].path + " and " +
+                          units[i].path);
+                valid = false;
+            }
+        }
+    }
+    for (SourceUnit& unit : units) {
+        StringInterner& symbols = unit.parser->GetIRConstructor()->getSymbols();
+        for (PrototypeAST* protoAST : unit.externs) {
+            std::string name(symbols.getName(protoAST->getName()));
+            auto definition = program.find(name);
+            // Externs without a definition are left to the linker (e.g. libm)
+            if (definition != program.end() && definition->second.arity != protoAST->getArgs().size()) {
+                LogErrorV("extern " + name + " in " + unit.path + " does not match its definition in " +
+                          units[definition->second.unit].path);
+                valid = false;
+            }
+        }
+    }
+    if (!valid) {
+        return 1;
+    }
+
+    bool archive = options.outputKind == OutputKind::Archive;
+    for (SourceUnit& unit : units) {
+        pool.async([&unit, &program, archive, this] { CompileUnit(unit, program, options.compilerOptions, archive); });
+    }
+    pool.wait();
+    for (SourceUnit& unit : units) {
+        if (!unit.succeeded) {
+            return 1;
+        }
+        fileTimings.push_back(unit.timing);
+    }
+
+    if (archive) {
+        std::vector<llvm::SmallVector<char, 0>> objects;
+        for (SourceUnit& unit : units) {
+            objects.push_back(std::move(unit.output));
+        }
+        if (WriteObjectArchive(options.output, MemberNames(units), objects,
+                               llvm::Triple(options.compilerOptions.target.getTriple())) != 0) {
+            return 1;
+        }
+    } else {
+        llvm::SmallVector<char, 0> object;
+        if (LinkAndEmit(units, options.compilerOptions, object) != 0) {
+            return 1;
+        }
+        std::error_code errorCode;
+        llvm::raw_fd_ostream dest(options.output, errorCode, llvm::sys::fs::OF_None);
+        if (errorCode) {
+            LogErrorV("Could not open file: " + errorCode.message());
+            return 1;
+        }
+        dest << llvm::StringRef(object.data(), object.size());
+    }
+
+    std::cout << "Wrote " << options.output << " (" << units.size() << " files)" << std::endl;
+    return 0;
+}
+
+const std::vector<FileTiming>& Driver::getFileTimings() const {
+    return fileTimings;
+}
+
+void Driver::printFileTimings(std::ostream& os) const {
+    char row[256];
+    std::snprintf(row, sizeof(row), "  %-40s %12s %12s %12s %14s", "File", "Parse (ms)", "Compile (ms)", "AST (KiB)",
+                  "Nodes removed");
+    os << row << '\n';
+    for (const FileTiming& timing : fileTimings) {
+        std::snprintf(row, sizeof(row), "  %-40s %12.3f %12.3f %12.1f %14zu", timing.path.c_str(),
+                      timing.parseSeconds * 1e3, timing.compileSeconds * 1e3, timing.astBytes / 1024.0,
+                      timing.astNodesRemoved);
+        os << row << '\n';
+    }
+}
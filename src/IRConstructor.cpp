@@ -1,152 +1,455 @@
 #include "../include/IRConstructor.hpp"
 #include "../include/Utils.hpp"
+#include "../include/Timing.hpp"
 
-llvm::Value* NumberExprAST::codegen(IRConstructor& visitor) {
+#include "llvm/Transforms/Utils/Cloning.h"
+
+llvm::Value* ExprAST::codegen(IRConstructor& visitor) {
     return visitor.visit(*this);
 }
 
-llvm::Value* VariableExprAST::codegen(IRConstructor& visitor) {
+llvm::Function* PrototypeAST::codegen(IRConstructor& visitor) {
     return visitor.visit(*this);
 }
 
-llvm::Value* BinaryExprAST::codegen(IRConstructor& visitor) {
+llvm::Function* FunctionAST::codegen(IRConstructor& visitor) {
     return visitor.visit(*this);
 }
 
-llvm::Value* CallExprAST::codegen(IRConstructor& visitor) {
-    return visitor.visit(*this);
+ModuleOptimizer::ModuleOptimizer(llvm::LLVMContext& context, const CompilerOptions& options,
+                                 llvm::TargetMachine* targetMachine)
+    // The target machine gives the vectorizers and the inliner their cost model
+    : pb(targetMachine, llvm::PipelineTuningOptions(), std::nullopt, &pic) {
+    if (options.debugPassManager) {
+        si = std::make_unique<llvm::StandardInstrumentations>(context, /* DebugLogging */ true);
+        si->registerCallbacks(pic, &mam);
+    }
+
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cgam);
+    pb.registerFunctionAnalyses(fam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cgam, mam);
+
+    llvm::OptimizationLevel level = ToLLVMOptLevel(options.optLevel);
+    if (level == llvm::OptimizationLevel::O0) {
+        mpm = pb.buildO0DefaultPipeline(level, /* LTOPreLink */ options.lto != LTOMode::None);
+    } else if (options.lto == LTOMode::Thin) {
+        // Leaves inlining across modules and the late loop passes to the link step
+        mpm = pb.buildThinLTOPreLinkDefaultPipeline(level);
+    } else if (options.lto == LTOMode::Full) {
+        mpm = pb.buildLTOPreLinkDefaultPipeline(level);
+    } else {
+        mpm = pb.buildPerModuleDefaultPipeline(level);
+    }
 }
 
-llvm::Function* PrototypeAST::codegen(IRConstructor& visitor) {
-    return visitor.visit(*this);
+void ModuleOptimizer::run(llvm::Module& module) {
+    TimeScope scope("Optimize", module.getModuleIdentifier());
+    mpm.run(module, mam);
+    // The next module may reuse the addresses of this one's functions
+    lam.clear();
+    fam.clear();
+    cgam.clear();
+    mam.clear();
 }
 
-llvm::Function* FunctionAST::codegen(IRConstructor& visitor) {
-    return visitor.visit(*this);
+void OptimizeModule(llvm::Module& module, const CompilerOptions& options, llvm::TargetMachine* targetMachine) {
+    ModuleOptimizer(module.getContext(), options, targetMachine).run(module);
 }
 
-IRConstructor::IRConstructor() {
-    namedValues = std::map<std::string, llvm::Value*>(); 
-    context = std::make_unique<llvm::LLVMContext>();
-    module = std::make_unique<llvm::Module>("jitcompile", *context);
+IRConstructor::IRConstructor(std::shared_ptr<StringInterner> symbols, const CompilerOptions& options)
+    : symbols(std::move(symbols)), options(options) {
+    InitializeTargets();
+    auto targetMachine = options.target.createTargetMachine();
+    if (targetMachine) {
+        targetTriple = (*targetMachine)->getTargetTriple().str();
+        dataLayout = (*targetMachine)->createDataLayout().getStringRepresentation();
+    } else {
+        LogIfError(targetMachine.takeError());
+    }
+
+    tsContext = llvm::orc::ThreadSafeContext(std::make_unique<llvm::LLVMContext>());
+    context = tsContext.getContext();
+    module = createModule();
     builder = std::make_unique<llvm::IRBuilder<>>(*context);
-    // module->setDataLayout()
-
-    /* Analysis Managers */ 
-    FPM = std::make_unique<llvm::FunctionPassManager>();
-    LAM = std::make_unique<llvm::LoopAnalysisManager>(); 
-    FAM = std::make_unique<llvm::FunctionAnalysisManager>();
-    CGAM = std::make_unique<llvm::CGSCCAnalysisManager>();
-    MAM = std::make_unique<llvm::ModuleAnalysisManager>();
-    PIC = std::make_unique<llvm::PassInstrumentationCallbacks>();
-
-    SI = std::make_unique<llvm::StandardInstrumentations>(*context, /* DebugLogging */ true);
-    SI->registerCallbacks(*PIC, MAM.get());
-
-    /* ----- Transformation Passes ------ */
-    /* Peephole optimizations */ 
-    FPM->addPass(llvm::InstCombinePass()); 
-    /* Reassociate scalars (2 + 4 + x == x + 2 + 3) */
-    FPM->addPass(llvm::ReassociatePass());
-    /* Global Value Numbering (GVN) performs Common Subexpression Elimination (CSE) */
-    FPM->addPass(llvm::GVNPass());
-    /* Simplify the control flow graph (deleting unreachable blocks, etc). */
-    FPM->addPass(llvm::SimplifyCFGPass());
-    
-    llvm::PassBuilder pb;
-    pb.registerModuleAnalyses(*MAM);
-    pb.registerFunctionAnalyses(*FAM);
-    pb.crossRegisterProxies(*LAM, *FAM, *CGAM, *MAM);
 }
 
-llvm::Value* IRConstructor::visit(NumberExprAST& numExpr) {
-    return llvm::ConstantFP::get(*this->context, llvm::APFloat(numExpr.getValue()));
+// Every module knows its target from the start, so optimization can rely on it
+std::unique_ptr<llvm::Module> IRConstructor::createModule() {
+    auto newModule = std::make_unique<llvm::Module>("jitcompile", *context);
+    newModule->setTargetTriple(targetTriple);
+    newModule->setDataLayout(dataLayout);
+    return newModule;
 }
 
-llvm::Value* IRConstructor::visit(VariableExprAST& varExpr) {
-    llvm::Value *V = namedValues[varExpr.getValue()];
-    if (!V) {
-        return LogErrorV("Unknown Variable Name"); 
+// Walks expr with an explicit stack of frames, so the depth of the tree does
+// not matter. A frame requests its children one at a time and finds their
+// values on values when it is resumed.
+llvm::Value* IRConstructor::visit(ExprAST& expr) {
+    llvm::SmallVector<ExprFrame, 32> frames{{&expr}};
+    llvm::SmallVector<llvm::Value*, 32> values;
+    while (!frames.empty()) {
+        ExprFrame& frame = frames.back();
+        ExprAST& node = *frame.expr;
+        if (frame.stage == 0) {
+            // A shared node is emitted once, later uses reuse its value
+            auto cached = exprValues.find(&node);
+            if (cached != exprValues.end()) {
+                values.push_back(cached->second);
+                frames.pop_back();
+                continue;
+            }
+        }
+
+        ExprAST* child = nullptr;
+        switch (node.getKind()) {
+            case ExprAST::Number:
+                child = visit(llvm::cast<NumberExprAST>(node), frame, values);
+                break;
+            case ExprAST::Variable:
+                child = visit(llvm::cast<VariableExprAST>(node), frame, values);
+                break;
+            case ExprAST::Binary:
+                child = visit(llvm::cast<BinaryExprAST>(node), frame, values);
+                break;
+            case ExprAST::Call:
+                child = visit(llvm::cast<CallExprAST>(node), frame, values);
+                break;
+            case ExprAST::If:
+                child = visit(llvm::cast<IfExprAST>(node), frame, values);
+                break;
+            case ExprAST::For:
+                child = visit(llvm::cast<ForExprAST>(node), frame, values);
+                break;
+            default:
+                return LogErrorV("Unknown expression kind");
+        }
+        if (child) {
+            frame.stage++;
+            frames.push_back({child});
+            continue;
+        }
+
+        llvm::Value* value = frame.value;
+        if (!value) {
+            return nullptr; // logged where it happened
+        }
+        exprValues[&node] = value;
+        exprValueLog.push_back(&node);
+        values.push_back(value);
+        frames.pop_back();
     }
-    return V;
+    return values.back();
 }
 
-llvm::Value* IRConstructor::visit(BinaryExprAST& binExpr) {
-    llvm::Value * l = binExpr.getLHSRef().codegen(*this);
-    llvm::Value * r = binExpr.getRHSRef().codegen(*this);
+ExprAST* IRConstructor::visit(NumberExprAST& numExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>&) {
+    frame.value = llvm::ConstantFP::get(*this->context, llvm::APFloat(numExpr.getValue()));
+    return nullptr;
+}
 
-    if (!l || !r) {
-        return nullptr;
+ExprAST* IRConstructor::visit(VariableExprAST& varExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>&) {
+    SymbolID name = varExpr.getSymbol();
+    llvm::Value *V = name < namedValues.size() ? namedValues[name] : nullptr;
+    if (!V) {
+        LogErrorV("Unknown Variable Name");
+    }
+    frame.value = V;
+    return nullptr;
+}
+
+ExprAST* IRConstructor::visit(BinaryExprAST& binExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values) {
+    if (frame.stage == 0) {
+        return &binExpr.getLHSRef();
     }
+    if (frame.stage == 1) {
+        return &binExpr.getRHSRef();
+    }
+    llvm::Value * r = values.pop_back_val();
+    llvm::Value * l = values.pop_back_val();
 
     switch(binExpr.getOp()) {
         case '+':
-            return builder->CreateFAdd(l, r, "addtmp");
+            frame.value = builder->CreateFAdd(l, r, "addtmp");
+            break;
         case '*':
-            return builder->CreateFMul(l, r, "multmp");
+            frame.value = builder->CreateFMul(l, r, "multmp");
+            break;
         case '-':
-            return builder->CreateFSub(l, r, "subtmp");
+            frame.value = builder->CreateFSub(l, r, "subtmp");
+            break;
         case '<':
             l = builder->CreateFCmpULT(l, r, "cmptmp");
             // our language currently does not have a bool type so we need to convert to double
-            return builder->CreateUIToFP(l, llvm::Type::getDoubleTy(*context), "booltmp");
+            frame.value = builder->CreateUIToFP(l, llvm::Type::getDoubleTy(*context), "booltmp");
+            break;
         default:
-            return LogErrorV("Invalid Binary Operator");
+            frame.value = LogErrorV("Invalid Binary Operator");
+            break;
+    }
+    return nullptr;
+}
+
+// saved[0] is the callee
+ExprAST* IRConstructor::visit(CallExprAST& callExp, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values) {
+    size_t numArgs = callExp.getArgs().size();
+    if (frame.stage == 0) {
+        llvm::Function * calleeF = lookupFunction(callExp.getCallee());
+
+        if (!calleeF) {
+            frame.value = LogErrorV("Unknown Function referenced");
+            return nullptr;
+        }
+
+        if (calleeF->arg_size() != numArgs) {
+            frame.value = LogErrorV("Function and referenced function have an unequal number of arguments");
+            return nullptr;
+        }
+        frame.saved[0] = calleeF;
     }
+    if (frame.stage < numArgs) {
+        return callExp.getArgs()[frame.stage];
+    }
+
+    llvm::ArrayRef<llvm::Value*> argsV = llvm::ArrayRef<llvm::Value*>(values).take_back(numArgs);
+    frame.value = builder->CreateCall(llvm::cast<llvm::Function>(frame.saved[0]), argsV, "calltmp");
+    values.resize(values.size() - numArgs);
+    return nullptr;
 }
 
-llvm::Value* IRConstructor::visit(CallExprAST& callExp) {
-    llvm::Function * calleeF = module->getFunction(callExp.getCallee());
+// True unless condV is 0 or NaN
+llvm::Value* IRConstructor::emitCondition(llvm::Value* condV) {
+    return builder->CreateFCmpONE(condV, llvm::ConstantFP::get(*context, llvm::APFloat(0.0)), "ifcond");
+}
 
-    if (!calleeF) {
-        return LogErrorV("Unknown Function referenced");
+// blocks are then, else and merge, saved[0] is the value of then
+ExprAST* IRConstructor::visit(IfExprAST& ifExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values) {
+    if (frame.stage == 0) {
+        return &ifExpr.getCond();
     }
 
-    size_t numArgs = callExp.getArgs().size();
-    if (calleeF->arg_size() != numArgs) {
-        return LogErrorV("Function and referenced function have an unequal number of arguments");
+    if (frame.stage == 1) {
+        llvm::Value* condV = emitCondition(values.pop_back_val());
+        llvm::Function* func = builder->GetInsertBlock()->getParent();
+        frame.blocks[0] = llvm::BasicBlock::Create(*context, "then", func);
+        frame.blocks[1] = llvm::BasicBlock::Create(*context, "else", func);
+        frame.blocks[2] = llvm::BasicBlock::Create(*context, "ifcont", func);
+        builder->CreateCondBr(condV, frame.blocks[0], frame.blocks[1]);
+        frame.checkpoint = exprValueLog.size();
+
+        builder->SetInsertPoint(frame.blocks[0]);
+        return &ifExpr.getThen();
     }
 
-    std::vector<llvm::Value *> argsV;
-    argsV.reserve(numArgs);
-    for (auto& arg : callExp.getArgs()) {
-        argsV.push_back(arg->codegen(*this));
+    if (frame.stage == 2) {
+        frame.saved[0] = values.pop_back_val();
+        builder->CreateBr(frame.blocks[2]);
+        // The branch may have added blocks, the phi needs the one it ended in
+        frame.blocks[0] = builder->GetInsertBlock();
+        forgetValuesSince(frame.checkpoint);
+
+        builder->SetInsertPoint(frame.blocks[1]);
+        return &ifExpr.getElse();
+    }
+
+    llvm::Value* elseV = values.pop_back_val();
+    builder->CreateBr(frame.blocks[2]);
+    frame.blocks[1] = builder->GetInsertBlock();
+    forgetValuesSince(frame.checkpoint);
+
+    builder->SetInsertPoint(frame.blocks[2]);
+    llvm::PHINode* phi = builder->CreatePHI(llvm::Type::getDoubleTy(*context), 2, "iftmp");
+    phi->addIncoming(frame.saved[0], frame.blocks[0]);
+    phi->addIncoming(elseV, frame.blocks[1]);
+    frame.value = phi;
+    return nullptr;
+}
+
+// The loop variable is a phi in the loop header, so the body is a plain
+// counted loop for the LLVM loop passes. blocks are the header, body and
+// exit, saved[0] is the loop variable and saved[1] the binding it shadows.
+ExprAST* IRConstructor::visit(ForExprAST& forExpr, ExprFrame& frame, llvm::SmallVectorImpl<llvm::Value*>& values) {
+    if (frame.stage == 0) {
+        return &forExpr.getStart();
+    }
+
+    SymbolID var = forExpr.getVar();
+    if (frame.stage == 1) {
+        llvm::Value* startV = values.pop_back_val();
+        llvm::Function* func = builder->GetInsertBlock()->getParent();
+        llvm::BasicBlock* preheaderBB = builder->GetInsertBlock();
+        frame.blocks[0] = llvm::BasicBlock::Create(*context, "loop", func);
+        frame.blocks[1] = llvm::BasicBlock::Create(*context, "loopbody", func);
+        frame.blocks[2] = llvm::BasicBlock::Create(*context, "afterloop", func);
+        builder->CreateBr(frame.blocks[0]);
+
+        builder->SetInsertPoint(frame.blocks[0]);
+        llvm::PHINode* varV = builder->CreatePHI(llvm::Type::getDoubleTy(*context), 2, symbols->getName(var));
+        varV->addIncoming(startV, preheaderBB);
+        // The loop variable shadows an argument of the same name
+        frame.saved[0] = varV;
+        frame.saved[1] = var < namedValues.size() ? namedValues[var] : nullptr;
+        bindValue(var, varV);
+        frame.checkpoint = exprValueLog.size();
+        return &forExpr.getCond();
+    }
 
-        if (!argsV.back()) {
-            // make sure codegen succeeded
-            return LogErrorV("Failed to codegen arguments");
+    if (frame.stage == 2) {
+        llvm::Value* condV = emitCondition(values.pop_back_val());
+        builder->CreateCondBr(condV, frame.blocks[1], frame.blocks[2]);
+
+        builder->SetInsertPoint(frame.blocks[1]);
+        return &forExpr.getBody();
+    }
+
+    if (frame.stage == 3) {
+        values.pop_back(); // the body's value is unused
+        if (forExpr.getStep()) {
+            return forExpr.getStep();
         }
     }
+    llvm::Value* stepV = frame.stage == 4 ? values.pop_back_val()
+                                          : llvm::ConstantFP::get(*context, llvm::APFloat(1.0));
+    auto* varV = llvm::cast<llvm::PHINode>(frame.saved[0]);
+    llvm::Value* nextV = builder->CreateFAdd(varV, stepV, "nextvar");
+    varV->addIncoming(nextV, builder->GetInsertBlock());
+    builder->CreateBr(frame.blocks[0]);
+
+    builder->SetInsertPoint(frame.blocks[2]);
+    namedValues[var] = frame.saved[1];
+    forgetValuesSince(frame.checkpoint);
+    frame.value = llvm::ConstantFP::get(*context, llvm::APFloat(0.0));
+    return nullptr;
+}
 
-    return builder->CreateCall(calleeF, argsV, "calltmp");
+// Whether expr, in tail position of func, calls func itself
+bool IRConstructor::hasSelfTailCall(ExprAST& expr, llvm::Function* func) {
+    llvm::SmallVector<ExprAST*, 8> tails{&expr};
+    while (!tails.empty()) {
+        ExprAST* tail = tails.pop_back_val();
+        if (auto* ifExpr = llvm::dyn_cast<IfExprAST>(tail)) {
+            tails.push_back(&ifExpr->getElse());
+            tails.push_back(&ifExpr->getThen());
+            continue;
+        }
+        auto* callExpr = llvm::dyn_cast<CallExprAST>(tail);
+        if (callExpr && lookupFunction(callExpr->getCallee()) == func &&
+            callExpr->getArgs().size() == func->arg_size()) {
+            return true;
+        }
+    }
+    return false;
 }
 
+// Branches in tail position return on their own instead of merging, so a
+// self-recursive call there becomes a jump back to the function's start.
+// Other calls in tail position are marked tail for the backend. Branches
+// wait on a stack, then before else, so nesting depth does not matter.
+bool IRConstructor::emitTail(ExprAST& expr) {
+    struct Tail {
+        ExprAST* expr;
+        llvm::BasicBlock* block;
+        size_t checkpoint; // values emitted before the branch
+    };
+    llvm::SmallVector<Tail, 8> tails{{&expr, builder->GetInsertBlock(), exprValueLog.size()}};
+    while (!tails.empty()) {
+        Tail tail = tails.pop_back_val();
+        forgetValuesSince(tail.checkpoint);
+        builder->SetInsertPoint(tail.block);
+
+        if (auto* ifExpr = llvm::dyn_cast<IfExprAST>(tail.expr)) {
+            llvm::Value* condV = visit(ifExpr->getCond());
+            if (!condV) {
+                return false;
+            }
+            condV = emitCondition(condV);
+            llvm::Function* func = builder->GetInsertBlock()->getParent();
+            llvm::BasicBlock* thenBB = llvm::BasicBlock::Create(*context, "then", func);
+            llvm::BasicBlock* elseBB = llvm::BasicBlock::Create(*context, "else", func);
+            builder->CreateCondBr(condV, thenBB, elseBB);
+            size_t checkpoint = exprValueLog.size();
+            tails.push_back({&ifExpr->getElse(), elseBB, checkpoint});
+            tails.push_back({&ifExpr->getThen(), thenBB, checkpoint});
+            continue;
+        }
+
+        llvm::Function* func = builder->GetInsertBlock()->getParent();
+        if (tailRecursionHeader && hasSelfTailCall(*tail.expr, func)) {
+            auto& callExpr = llvm::cast<CallExprAST>(*tail.expr);
+            llvm::SmallVector<llvm::Value*, 8> argsV;
+            for (ExprAST* arg : callExpr.getArgs()) {
+                argsV.push_back(visit(*arg));
+                if (!argsV.back()) {
+                    return false;
+                }
+            }
+            for (size_t i = 0; i < argsV.size(); i++) {
+                tailRecursionArgs[i]->addIncoming(argsV[i], builder->GetInsertBlock());
+            }
+            builder->CreateBr(tailRecursionHeader);
+            continue;
+        }
+
+        llvm::Value* value = visit(*tail.expr);
+        if (!value) {
+            return false;
+        }
+        if (auto* call = llvm::dyn_cast<llvm::CallInst>(value)) {
+            call->setTailCall();
+        }
+        builder->CreateRet(value);
+    }
+    return true;
+}
 
 llvm::Function* IRConstructor::visit(PrototypeAST& protoAST) {
+    SymbolID name = protoAST.getName();
+    llvm::Function *func = name < functions.size() ? functions[name] : nullptr;
+    if (func && func->arg_size() != protoAST.getArgs().size()) {
+        return (llvm::Function*) LogErrorV("Function redeclared with a different number of arguments");
+    }
+    if (!func) {
+        func = declareFunction(name, protoAST.getArgs().size());
+    }
+    
+    // set the variable names
+    size_t idx = 0;
+    for (auto& arg : func->args()) {
+        arg.setName(symbols->getName(protoAST.getArgs()[idx++]));
+    }
+
+    return func;
+}
+
+llvm::Function* IRConstructor::declareFunction(SymbolID name, size_t numArgs) {
     // all arguments are double currently
-    std::vector<llvm::Type *> doubles(protoAST.getArgs().size(), llvm::Type::getDoubleTy(*context));
+    std::vector<llvm::Type *> doubles(numArgs, llvm::Type::getDoubleTy(*context));
 
     // get the function type, e.g., double(double, double)
     llvm::FunctionType *funcT = llvm::FunctionType::get(llvm::Type::getDoubleTy(*context),
                                                          doubles, false);
 
     llvm::Function *func = llvm::Function::Create(funcT, llvm::Function::ExternalLinkage,
-                                                  protoAST.getName(), module.get());
-    
-    // set the variable names
-    size_t idx = 0;
-    for (auto& arg : func->args()) {
-        arg.setName(protoAST.getArgs()[idx++]);
-    }
+                                                  symbols->getName(name), module.get());
 
+    if (functions.size() <= name) {
+        functions.resize(symbols->size(), nullptr);
+        functionArity.resize(symbols->size(), -1);
+    }
+    if (!functions[name]) {
+        functions[name] = func;
+    }
+    functionArity[name] = numArgs;
     return func;
 }
 
 llvm::Function* IRConstructor::visit(FunctionAST& funcAST) {
-    llvm::Function * func = module->getFunction(funcAST.getProto().getName());
+    TimeScope scope("Codegen", symbols->getName(funcAST.getProto().getName()));
+    llvm::Function * func = lookupFunction(funcAST.getProto().getName());
+    bool declaredHere = !func; // not by an extern or an earlier module
 
     if (!func) {
-        func = funcAST.getProto().codegen(*this);
+        func = visit(funcAST.getProto());
         if (!func) {
             return (llvm::Function*) LogErrorV("Failed to codegen function");
         }
@@ -156,36 +459,205 @@ llvm::Function* IRConstructor::visit(FunctionAST& funcAST) {
         return (llvm::Function*) LogErrorV("Cannot redefine function");
     }
 
+    if (func->arg_size() != funcAST.getProto().getArgs().size()) {
+        return (llvm::Function*) LogErrorV("Function and its declaration have an unequal number of arguments");
+    }
+
     // Create a new basic block to start insertion into.
     llvm::BasicBlock *bb = llvm::BasicBlock::Create(*context, "entry", func);
     builder->SetInsertPoint(bb);
-
-    // Record the function arguments in the NamedValues map.
-    namedValues.clear();
+    // Every floating-point operation of the body carries the function's flags
+    builder->setFastMathFlags(ToFastMathFlags(options.getFPMode(func->getName())));
+
+    // Record the function arguments in the NamedValues table.
+    clearValues();
+    tailRecursionHeader = nullptr;
+    tailRecursionArgs.clear();
+    if (hasSelfTailCall(funcAST.getBody(), func)) {
+        tailRecursionHeader = llvm::BasicBlock::Create(*context, "tailrecurse", func);
+        builder->CreateBr(tailRecursionHeader);
+        builder->SetInsertPoint(tailRecursionHeader);
+    }
+    size_t idx = 0;
     for (auto& arg : func->args()) {
-       namedValues[std::string(arg.getName())] = &arg;
+        SymbolID argName = funcAST.getProto().getArgs()[idx++];
+        arg.setName(symbols->getName(argName));
+        llvm::Value* argV = &arg;
+        if (tailRecursionHeader) {
+            llvm::PHINode* phi = builder->CreatePHI(arg.getType(), 2, arg.getName());
+            phi->addIncoming(&arg, bb);
+            tailRecursionArgs.push_back(phi);
+            argV = phi;
+        }
+        bindValue(argName, argV);
     }
 
-    if (llvm::Value *retV = funcAST.getBody().codegen(*this)) {
-        builder->CreateRet(retV);
+    if (emitTail(funcAST.getBody())) {
         // Verify Function Correctness
         llvm::verifyFunction(*func);
 
-        // std::cout << "here" << std::endl;
-        // Optimize Function
-        FPM->run(*func, *FAM);
-
         return func;
     } else {
+        SymbolID name = funcAST.getProto().getName();
+        if (functions[name] == func) {
+            functions[name] = nullptr;
+        }
+        // Calls to it fail as unknown instead of linking against nothing
+        if (declaredHere) {
+            functionArity[name] = -1;
+        }
         func->eraseFromParent();
         return nullptr;
     }
 }
 
+llvm::Function* IRConstructor::declareExtern(llvm::StringRef name, size_t numArgs) {
+    SymbolID id = symbols->intern(std::string_view(name.data(), name.size()));
+    if (llvm::Function* func = lookupFunction(id)) {
+        if (func->arg_size() != numArgs) {
+            return (llvm::Function*) LogErrorV("Function redeclared with a different number of arguments");
+        }
+        return func;
+    }
+    return declareFunction(id, numArgs);
+}
+
+llvm::Function* IRConstructor::createBatchKernel(const std::string& functionName) {
+    llvm::Function* scalar = module->getFunction(functionName);
+    if (!scalar || scalar->isDeclaration()) {
+        return (llvm::Function*) LogErrorV("Batch kernels need a function defined in the current module");
+    }
+    std::string kernelName = functionName + "_batch";
+    if (module->getFunction(kernelName)) {
+        return (llvm::Function*) LogErrorV("Batch kernel already exists");
+    }
+
+    llvm::Type* doubleT = llvm::Type::getDoubleTy(*context);
+    llvm::Type* ptrT = doubleT->getPointerTo();
+    llvm::Type* sizeT = module->getDataLayout().getIntPtrType(*context);
+    size_t numArgs = scalar->arg_size();
+
+    // one input array per argument, then the output array and the row count
+    std::vector<llvm::Type*> params(numArgs + 1, ptrT);
+    params.push_back(sizeT);
+    llvm::FunctionType* kernelT = llvm::FunctionType::get(llvm::Type::getVoidTy(*context), params, false);
+    llvm::Function* kernel = llvm::Function::Create(kernelT, llvm::Function::ExternalLinkage,
+                                                    kernelName, module.get());
+    // noalias lets the vectorizer skip runtime overlap checks
+    for (size_t i = 0; i <= numArgs; i++) {
+        kernel->addParamAttr(i, llvm::Attribute::NoAlias);
+        kernel->addParamAttr(i, llvm::Attribute::NoCapture);
+        if (i < numArgs) {
+            kernel->addParamAttr(i, llvm::Attribute::ReadOnly);
+        }
+        kernel->getArg(i)->setName(i < numArgs ? scalar->getArg(i)->getName() : "out");
+    }
+    llvm::Argument* n = kernel->getArg(numArgs + 1);
+    n->setName("n");
+
+    llvm::BasicBlock* entry = llvm::BasicBlock::Create(*context, "entry", kernel);
+    llvm::BasicBlock* loop = llvm::BasicBlock::Create(*context, "loop", kernel);
+    llvm::BasicBlock* exit = llvm::BasicBlock::Create(*context, "exit", kernel);
+
+    builder->SetInsertPoint(entry);
+    builder->clearFastMathFlags();
+    builder->CreateCondBr(builder->CreateICmpEQ(n, llvm::ConstantInt::get(sizeT, 0), "empty"), exit, loop);
+
+    builder->SetInsertPoint(loop);
+    llvm::PHINode* i = builder->CreatePHI(sizeT, 2, "i");
+    i->addIncoming(llvm::ConstantInt::get(sizeT, 0), entry);
+    std::vector<llvm::Value*> args;
+    args.reserve(numArgs);
+    for (size_t arg = 0; arg < numArgs; arg++) {
+        llvm::Value* element = builder->CreateInBoundsGEP(doubleT, kernel->getArg(arg), i);
+        args.push_back(builder->CreateLoad(doubleT, element));
+    }
+    llvm::CallInst* call = builder->CreateCall(scalar, args, "row");
+    builder->CreateStore(call, builder->CreateInBoundsGEP(doubleT, kernel->getArg(numArgs), i));
+    llvm::Value* next = builder->CreateNUWAdd(i, llvm::ConstantInt::get(sizeT, 1), "next");
+    i->addIncoming(next, loop);
+    builder->CreateCondBr(builder->CreateICmpEQ(next, n, "done"), exit, loop);
+
+    builder->SetInsertPoint(exit);
+    builder->CreateRetVoid();
+
+    // Inline right away instead of relying on the inliner's cost model, so
+    // the loop body is straight-line code at every optimization level
+    llvm::InlineFunctionInfo inlineInfo;
+    if (!llvm::InlineFunction(*call, inlineInfo).isSuccess()) {
+        kernel->eraseFromParent();
+        return (llvm::Function*) LogErrorV("Failed to inline function into its batch kernel");
+    }
+    llvm::verifyFunction(*kernel);
+    return kernel;
+}
+
+llvm::Function* IRConstructor::lookupFunction(SymbolID name) {
+    if (name >= functions.size()) {
+        return nullptr;
+    }
+    if (!functions[name] && functionArity[name] >= 0) {
+        // defined or declared in a module that was already taken
+        return declareFunction(name, functionArity[name]);
+    }
+    return functions[name];
+}
+
+void IRConstructor::bindValue(SymbolID name, llvm::Value* value) {
+    if (namedValues.size() <= name) {
+        namedValues.resize(symbols->size(), nullptr);
+    }
+    namedValues[name] = value;
+    boundValues.push_back(name);
+}
+
+// Only resets the slots bound by the previous function
+void IRConstructor::clearValues() {
+    for (SymbolID name : boundValues) {
+        namedValues[name] = nullptr;
+    }
+    boundValues.clear();
+    exprValues.clear();
+    exprValueLog.clear();
+}
+
+void IRConstructor::forgetValuesSince(size_t checkpoint) {
+    for (size_t i = checkpoint; i < exprValueLog.size(); i++) {
+        exprValues.erase(exprValueLog[i]);
+    }
+    exprValueLog.resize(checkpoint);
+}
+
 llvm::Module& IRConstructor::getModule() const {
     return *module;
 }
 
 llvm::LLVMContext& IRConstructor::getContext() const {
     return *context;
-}
\ No newline at end of file
+}
+
+StringInterner& IRConstructor::getSymbols() const {
+    return *symbols;
+}
+
+std::shared_ptr<StringInterner> IRConstructor::getSharedSymbols() const {
+    return symbols;
+}
+
+const CompilerOptions& IRConstructor::getOptions() const {
+    return options;
+}
+
+llvm::orc::ThreadSafeModule IRConstructor::takeModule() {
+    llvm::orc::ThreadSafeModule tsm(std::move(module), tsContext);
+    module = createModule();
+    std::fill(functions.begin(), functions.end(), nullptr);
+    return tsm;
+}
+
+void IRConstructor::reset() {
+    module = createModule();
+    functions.clear();
+    functionArity.clear();
+    clearValues();
+}
@@ -0,0 +1,258 @@
+#include "../include/IncrementalCompiler.hpp"
+#include "../include/Parser.hpp"
+#include "../include/Timing.hpp"
+#include "../include/Utils.hpp"
+
+#include <cstring>
+#include <set>
+#include <vector>
+
+IncrementalCompiler::IncrementalCompiler(std::shared_ptr<JITSession> jit, const CompilerOptions& options)
+    : options(options), jit(std::move(jit)), symbols(std::make_shared<StringInterner>()) {}
+
+IncrementalCompiler::IncrementalCompiler(const CompilerOptions& options, std::shared_ptr<ObjectFileCache> objectCache)
+    : options(options), objectCache(std::move(objectCache)), symbols(std::make_shared<StringInterner>()) {}
+
+// Appends an exact encoding of expr, names are spelled out
+static void Encode(ExprAST& expr, const StringInterner& symbols, std::string& out) {
+    forEachNode(expr, [&](ExprAST& node) {
+        switch (node.getKind()) {
+            case ExprAST::Number: {
+                double value = llvm::cast<NumberExprAST>(node).getValue();
+                char bits[sizeof(value)];
+                std::memcpy(bits, &value, sizeof(value));
+                out += 'n';
+                out.append(bits, sizeof(bits));
+                break;
+            }
+            case ExprAST::Variable:
+                out += 'v';
+                out += symbols.getName(llvm::cast<VariableExprAST>(node).getSymbol());
+                out += '\0';
+                break;
+            case ExprAST::Binary:
+                out += 'b';
+                out += llvm::cast<BinaryExprAST>(node).getOp();
+                break;
+            case ExprAST::Call: {
+                auto& callExpr = llvm::cast<CallExprAST>(node);
+                out += 'c';
+                out += symbols.getName(callExpr.getCallee());
+                out += '\0';
+                out += std::to_string(callExpr.getArgs().size());
+                out += '\0';
+                break;
+            }
+            case ExprAST::If:
+                out += 'i';
+                break;
+            case ExprAST::For: {
+                auto& forExpr = llvm::cast<ForExprAST>(node);
+                out += forExpr.getStep() ? 'F' : 'f';
+                out += symbols.getName(forExpr.getVar());
+                out += '\0';
+                break;
+            }
+        }
+    });
+}
+
+static std::string Fingerprint(PrototypeAST& protoAST, const StringInterner& symbols) {
+    std::string fingerprint = "p";
+    for (SymbolID arg : protoAST.getArgs()) {
+        fingerprint += symbols.getName(arg);
+        fingerprint += '\0';
+    }
+    return fingerprint;
+}
+
+static std::string Fingerprint(FunctionAST& funcAST, const StringInterner& symbols) {
+    std::string fingerprint = Fingerprint(funcAST.getProto(), symbols);
+    Encode(funcAST.getBody(), symbols, fingerprint);
+    return fingerprint;
+}
+
+bool IncrementalCompiler::update(const std::string& source) {
+    TimeScope scope("IncrementalUpdate");
+    Parser parser(llvm::MemoryBuffer::getMemBufferCopy(source, "<input>"), symbols, options);
+    std::vector<PrototypeAST*> externASTs;
+    std::vector<FunctionAST*> definitions;
+    if (!parser.ParseDefinitions(externASTs, definitions)) {
+        return false;
+    }
+
+    // Fingerprints and call graph of the new version
+    std::map<std::string, FunctionAST*> byName;
+    std::map<std::string, std::string> fingerprints;
+    std::map<std::string, std::set<std::string>> callees;
+    std::map<std::string, std::set<std::string>> callers;
+    for (FunctionAST* funcAST : definitions) {
+        std::string name(symbols->getName(funcAST->getProto().getName()));
+        if (!byName.emplace(name, funcAST).second) {
+            LogErrorV("Function " + name + " is defined twice");
+            return false;
+        }
+        fingerprints[name] = Fingerprint(*funcAST, *symbols);
+        llvm::SmallVector<SymbolID, 8> called;
+        collectCallees(funcAST->getBody(), called);
+        for (SymbolID callee : called) {
+            std::string calleeName(symbols->getName(callee));
+            callers[calleeName].insert(name);
+            callees[name].insert(std::move(calleeName));
+        }
+    }
+    std::map<std::string, std::string> newExterns;
+    for (PrototypeAST* protoAST : externASTs) {
+        newExterns[std::string(symbols->getName(protoAST->getName()))] = Fingerprint(*protoAST, *symbols);
+    }
+
+    IncrementalStats newStats;
+    newStats.functions = definitions.size();
+    std::vector<std::string> worklist;
+    for (const auto& entry : fingerprints) {
+        auto old = functions.find(entry.first);
+        if (old == functions.end() || old->second.fingerprint != entry.second) {
+            worklist.push_back(entry.first);
+            newStats.changed++;
+        }
+    }
+    std::vector<std::string> removed;
+    for (const auto& entry : functions) {
+        if (!byName.count(entry.first)) {
+            removed.push_back(entry.first);
+            worklist.push_back(entry.first);
+        }
+    }
+    newStats.removed = removed.size();
+    for (const auto& entry : newExterns) {
+        auto old = externs.find(entry.first);
+        if (old == externs.end() || old->second != entry.second) {
+            worklist.push_back(entry.first);
+        }
+    }
+    for (const auto& entry : externs) {
+        if (!newExterns.count(entry.first)) {
+            worklist.push_back(entry.first);
+        }
+    }
+
+    // Everything that (transitively) calls a changed name is stale as well
+    std::set<std::string> dirty;
+    while (!worklist.empty()) {
+        std::string name = std::move(worklist.back());
+        worklist.pop_back();
+        if (byName.count(name) && !dirty.insert(name).second) {
+            continue;
+        }
+        for (const std::string& caller : callers[name]) {
+            if (!dirty.count(caller)) {
+                worklist.push_back(caller);
+            }
+        }
+    }
+    newStats.recompiled = dirty.size();
+
+    // Generate all modules before touching the previous state
+    auto irConst = parser.GetIRConstructor();
+    for (PrototypeAST* protoAST : externASTs) {
+        if (!protoAST->codegen(*irConst)) {
+            return false;
+        }
+    }
+    for (FunctionAST* funcAST : definitions) {
+        if (!funcAST->getProto().codegen(*irConst)) {
+            return false;
+        }
+    }
+    irConst->takeModule(); // only declarations, every prototype is known now
+
+    // The compile-on-demand layer does not expect available_externally copies
+    bool copyCallees = options.optLevel != OptLevel::O0 && !(jit && jit->isLazy());
+    std::vector<std::pair<std::string, llvm::orc::ThreadSafeModule>> modules;
+    for (const std::string& name : dirty) {
+        if (copyCallees) {
+            for (const std::string& callee : callees[name]) {
+                auto definition = byName.find(callee);
+                if (callee == name || definition == byName.end()) {
+                    continue;
+                }
+                llvm::Function* copy = definition->second->codegen(*irConst);
+                if (!copy) {
+                    return false;
+                }
+                copy->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+            }
+        }
+        if (!byName[name]->codegen(*irConst)) {
+            return false;
+        }
+        modules.emplace_back(name, irConst->takeModule());
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> objects(modules.size());
+    if (!jit) {
+        for (size_t i = 0; i < modules.size(); i++) {
+            int result = modules[i].second.withModuleDo([&](llvm::Module& module) {
+                return CompileModuleToObject(module, options, objects[i], objectCache.get());
+            });
+            if (result != 0) {
+                return false;
+            }
+        }
+    }
+
+    // Commit: stale code goes first, so the new definitions do not clash with it
+    if (jit) {
+        for (const std::string& name : dirty) {
+            auto old = functions.find(name);
+            if (old != functions.end()) {
+                LogIfError(old->second.tracker->remove());
+            }
+        }
+        for (const std::string& name : removed) {
+            LogIfError(functions[name].tracker->remove());
+        }
+    }
+    for (const std::string& name : removed) {
+        functions.erase(name);
+    }
+    for (size_t i = 0; i < modules.size(); i++) {
+        const std::string& name = modules[i].first;
+        FunctionState& state = functions[name];
+        state.fingerprint = fingerprints[name];
+        if (jit) {
+            state.tracker = jit->createResourceTracker();
+            if (LogIfError(jit->addModule(std::move(modules[i].second), state.tracker))) {
+                // The old code of this and every later module is gone already,
+                // forgetting them makes the next update compile them again
+                for (size_t j = i; j < modules.size(); j++) {
+                    functions.erase(modules[j].first);
+                }
+                return false;
+            }
+        } else {
+            state.object = std::move(objects[i]);
+        }
+    }
+    externs = std::move(newExterns);
+    stats = newStats;
+    return true;
+}
+
+int IncrementalCompiler::writeArchive(const std::string& fileName) const {
+    if (jit) {
+        LogErrorV("Archives can only be written without a JIT session");
+        return 1;
+    }
+    std::vector<std::string> memberNames;
+    std::vector<llvm::SmallVector<char, 0>> objects;
+    for (const auto& entry : functions) {
+        memberNames.push_back(entry.first + ".o");
+        objects.push_back(entry.second.object);
+    }
+    return WriteObjectArchive(fileName, memberNames, objects, llvm::Triple(options.target.getTriple()));
+}
+
+const IncrementalStats& IncrementalCompiler::getStats() const {
+    return stats;
+}
@@ -0,0 +1,255 @@
+#include "../include/JIT.hpp"
+#include "../include/IRConstructor.hpp"
+#include "../include/Utils.hpp"
+#include "../include/Timing.hpp"
+
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
+#include "llvm/ExecutionEngine/Orc/CompileUtils.h"
+
+// Names JIT modules in timing reports, they all share one module name
+static llvm::StringRef FirstDefinition(const llvm::Module& module) {
+    for (const auto& func : module) {
+        if (!func.isDeclaration()) {
+            return func.getName();
+        }
+    }
+    return module.getModuleIdentifier();
+}
+
+namespace {
+// Owns the target machine and cache adapter the wrapped compiler refers to
+class JITCompiler : public llvm::orc::IRCompileLayer::IRCompiler {
+    std::unique_ptr<llvm::TargetMachine> targetMachine;
+    std::unique_ptr<llvm::ObjectCache> cache;
+    std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler> compiler;
+
+public:
+    JITCompiler(llvm::orc::JITTargetMachineBuilder targetMachineBuilder, std::unique_ptr<llvm::TargetMachine> tm,
+                ObjectFileCache* objectCache, bool concurrent)
+        : IRCompiler(llvm::orc::irManglingOptionsFromTargetOptions(tm->Options)), targetMachine(std::move(tm)) {
+        if (objectCache) {
+            cache = objectCache->createJITCache(*targetMachine);
+        }
+        // SimpleCompiler shares one TargetMachine, ConcurrentIRCompiler creates one per module
+        if (concurrent) {
+            compiler = std::make_unique<llvm::orc::ConcurrentIRCompiler>(std::move(targetMachineBuilder), cache.get());
+        } else {
+            compiler = std::make_unique<llvm::orc::SimpleCompiler>(*targetMachine, cache.get());
+        }
+    }
+
+    llvm::Expected<std::unique_ptr<llvm::MemoryBuffer>> operator()(llvm::Module& module) override {
+        TimeScope scope("JITCodegen");
+        if (IsTimingEnabled()) {
+            scope.setDetail(FirstDefinition(module));
+        }
+        return (*compiler)(module);
+    }
+};
+} // namespace
+
+template <typename BuilderT>
+static void ConfigureBuilder(BuilderT& builder, const JITOptions& options) {
+    builder.setJITTargetMachineBuilder(options.compilerOptions.target.createJITTargetMachineBuilder());
+    // Without a cache or concurrency this matches LLJIT's default compiler, but is timed
+    builder.setCompileFunctionCreator(
+        [objectCache = options.objectCache, concurrent = options.concurrentCompilation](
+            llvm::orc::JITTargetMachineBuilder targetMachineBuilder)
+            -> llvm::Expected<std::unique_ptr<llvm::orc::IRCompileLayer::IRCompiler>> {
+            auto targetMachine = targetMachineBuilder.createTargetMachine();
+            if (!targetMachine) {
+                return targetMachine.takeError();
+            }
+            return std::make_unique<JITCompiler>(std::move(targetMachineBuilder), std::move(*targetMachine),
+                                                 objectCache.get(), concurrent);
+        });
+}
+
+JITSession::JITSession(std::unique_ptr<llvm::orc::LLJIT> eagerJIT, std::unique_ptr<llvm::orc::LLLazyJIT> lazyJIT,
+                       std::shared_ptr<ObjectFileCache> objectCache)
+    : eagerJIT(std::move(eagerJIT)), lazyJIT(std::move(lazyJIT)),
+      numCompiled(std::make_shared<std::atomic<size_t>>(0)), objectCache(std::move(objectCache)) {
+    jit = this->lazyJIT ? this->lazyJIT.get() : this->eagerJIT.get();
+    jit->getExecutionSession().registerResourceManager(arities);
+}
+
+// Before the LLJIT ends its session, which would still notify the arity table
+JITSession::~JITSession() {
+    jit->getExecutionSession().deregisterResourceManager(arities);
+}
+
+llvm::Expected<std::unique_ptr<JITSession>> JITSession::Create(const JITOptions& options) {
+    InitializeTargets();
+
+    std::unique_ptr<JITSession> session;
+    if (!options.lazy) {
+        llvm::orc::LLJITBuilder builder;
+        ConfigureBuilder(builder, options);
+        auto jit = builder.create();
+        if (!jit) {
+            return jit.takeError();
+        }
+        session.reset(new JITSession(std::move(*jit), nullptr, options.objectCache));
+    } else {
+        llvm::orc::LLLazyJITBuilder builder;
+        ConfigureBuilder(builder, options);
+        auto jit = builder.create();
+        if (!jit) {
+            return jit.takeError();
+        }
+        // Partition per function so only the requested function is materialized
+        (*jit)->setPartitionFunction(llvm::orc::CompileOnDemandLayer::compileRequested);
+        session.reset(new JITSession(nullptr, std::move(*jit), options.objectCache));
+    }
+
+    // JIT'd code is never linked again, so it never takes the LTO pre-link pipeline
+    CompilerOptions compilerOptions = options.compilerOptions;
+    compilerOptions.lto = LTOMode::None;
+
+    // Every module is optimized as a whole right before codegen. In lazy mode
+    // that only happens once one of its partitions is first called.
+    session->jit->getIRTransformLayer().setTransform(
+        [numCompiled = session->numCompiled, compilerOptions,
+         targetMachineBuilder = options.compilerOptions.target.createJITTargetMachineBuilder()](
+            llvm::orc::ThreadSafeModule module, const llvm::orc::MaterializationResponsibility&)
+            -> llvm::Expected<llvm::orc::ThreadSafeModule> {
+            // Transforms may run on several threads, each gets its own TargetMachine
+            std::unique_ptr<llvm::TargetMachine> targetMachine;
+            if (compilerOptions.optLevel != OptLevel::O0) {
+                auto builder = targetMachineBuilder;
+                auto created = builder.createTargetMachine();
+                if (!created) {
+                    return created.takeError();
+                }
+                targetMachine = std::move(*created);
+            }
+            module.withModuleDo([&](llvm::Module& m) {
+                OptimizeModule(m, compilerOptions, targetMachine.get());
+                for (auto& func : m) {
+                    if (!func.isDeclaration()) {
+                        (*numCompiled)++;
+                    }
+                }
+            });
+            return std::move(module);
+        });
+    return std::move(session);
+}
+
+llvm::Error JITSession::addModule(llvm::orc::ThreadSafeModule module, llvm::orc::ResourceTrackerSP tracker) {
+    if (!tracker) {
+        tracker = jit->getMainJITDylib().getDefaultResourceTracker();
+    }
+    module.withModuleDo([&](llvm::Module& m) { arities.record(m, tracker->getKeyUnsafe()); });
+    if (!lazyJIT) {
+        return jit->addIRModule(tracker, std::move(module));
+    }
+
+    module.withModuleDo([&](llvm::Module& m) {
+        if (m.getDataLayout().isDefault()) {
+            m.setDataLayout(jit->getDataLayout());
+        }
+    });
+    // The compile-on-demand layer emits lazy reexport stubs for every function
+    return lazyJIT->getCompileOnDemandLayer().add(tracker, std::move(module));
+}
+
+llvm::Error JITSession::addObject(std::unique_ptr<llvm::MemoryBuffer> object, llvm::orc::ResourceTrackerSP tracker) {
+    if (!tracker) {
+        tracker = jit->getMainJITDylib().getDefaultResourceTracker();
+    }
+    return jit->addObjectFile(tracker, std::move(object));
+}
+
+llvm::orc::ResourceTrackerSP JITSession::createResourceTracker() {
+    return jit->getMainJITDylib().createResourceTracker();
+}
+
+llvm::Expected<llvm::orc::ExecutorAddr> JITSession::lookup(llvm::StringRef name) {
+    TimeScope scope("JITLookup", name);
+    return jit->lookup(name);
+}
+
+const llvm::DataLayout& JITSession::getDataLayout() const {
+    return jit->getDataLayout();
+}
+
+bool JITSession::isLazy() const {
+    return lazyJIT != nullptr;
+}
+
+size_t JITSession::getNumCompiledFunctions() const {
+    return *numCompiled;
+}
+
+void JITSession::ArityTable::record(const llvm::Module& module, llvm::orc::ResourceKey key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<std::string>& names = namesByKey[key];
+    for (const auto& func : module) {
+        if (func.isDeclaration()) {
+            continue;
+        }
+        bool doublesOnly = func.getReturnType()->isDoubleTy() &&
+                           llvm::all_of(func.args(), [](const llvm::Argument& arg) {
+                               return arg.getType()->isDoubleTy();
+                           });
+        entries[func.getName()] = Entry{doublesOnly ? static_cast<int>(func.arg_size()) : -1, key};
+        names.push_back(func.getName().str());
+    }
+}
+
+llvm::Error JITSession::ArityTable::check(llvm::StringRef name, size_t numArgs) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto entry = entries.find(name);
+    if (entry == entries.end()) {
+        return llvm::make_error<llvm::StringError>("No function " + name + " with a known signature",
+                                                   llvm::inconvertibleErrorCode());
+    }
+    int arity = entry->second.arity;
+    if (arity < 0) {
+        return llvm::make_error<llvm::StringError>(name + " does not take and return doubles only",
+                                                   llvm::inconvertibleErrorCode());
+    }
+    if (static_cast<size_t>(arity) != numArgs) {
+        return llvm::make_error<llvm::StringError>(name + " takes " + llvm::Twine(arity) +
+                                                       " arguments, not " + llvm::Twine(numArgs),
+                                                   llvm::inconvertibleErrorCode());
+    }
+    return llvm::Error::success();
+}
+
+llvm::Error JITSession::ArityTable::handleRemoveResources(llvm::orc::JITDylib&, llvm::orc::ResourceKey key) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto names = namesByKey.find(key);
+    if (names == namesByKey.end()) {
+        return llvm::Error::success();
+    }
+    for (const std::string& name : names->second) {
+        auto entry = entries.find(name);
+        // Unless redefined under another tracker since
+        if (entry != entries.end() && entry->second.key == key) {
+            entries.erase(entry);
+        }
+    }
+    namesByKey.erase(names);
+    return llvm::Error::success();
+}
+
+void JITSession::ArityTable::handleTransferResources(llvm::orc::JITDylib&, llvm::orc::ResourceKey dstKey,
+                                                     llvm::orc::ResourceKey srcKey) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto names = namesByKey.find(srcKey);
+    if (names == namesByKey.end()) {
+        return;
+    }
+    std::vector<std::string> moved = std::move(names->second);
+    namesByKey.erase(names);
+    for (const std::string& name : moved) {
+        auto entry = entries.find(name);
+        if (entry != entries.end() && entry->second.key == srcKey) {
+            entry->second.key = dstKey;
+        }
+    }
+    std::vector<std::string>& dstNames = namesByKey[dstKey];
+    dstNames.insert(dstNames.end(), moved.begin(), moved.end());
+}
@@ -1,67 +1,132 @@
 #include "../include/Lexer.hpp"
 
 #include <cctype>
+#include <cstdlib>
+#include <algorithm>
 #include <iostream>
 
-Lexer::Lexer(const std::string& input) {
-    for (int i = input.size() - 1; i >= 0; i--) {
-        st.push(input[i]);
+std::unique_ptr<llvm::MemoryBuffer> ViewSource(std::string_view source) {
+    if (source.size() > MaxSourceSize) {
+        std::cout << "Error: Source is larger than " << MaxSourceSize << " bytes" << std::endl;
+        return nullptr;
     }
+    return llvm::MemoryBuffer::getMemBuffer(llvm::StringRef(source.data(), source.size()),
+                                            "<input>", /* RequiresNullTerminator */ false);
 }
 
-// Function to get the next character from the input string
-char Lexer::getStrChar() {
-    if (!st.empty()) {
-        char c = st.top();
-        st.pop();
-        return c;
+std::unique_ptr<llvm::MemoryBuffer> MapSourceFile(const std::string& path) {
+    auto buffer = llvm::MemoryBuffer::getFile(path, /* IsText */ false,
+                                              /* RequiresNullTerminator */ false);
+    if (!buffer) {
+        std::cout << "Error: Could not open " << path << ": " << buffer.getError().message() << std::endl;
+        return nullptr;
     }
-    return EOF;
+    if ((*buffer)->getBufferSize() > MaxSourceSize) {
+        std::cout << "Error: " << path << " is larger than " << MaxSourceSize << " bytes" << std::endl;
+        return nullptr;
+    }
+    return std::move(*buffer);
 }
 
-// Function to get the next token from the input string
-Token Lexer::gettok() {
-    std::string res;
-    double val = 0.0;
-    char last_char = getStrChar();
+// Checked before copying, nullptr if too large
+static std::unique_ptr<llvm::MemoryBuffer> CopySource(const std::string& input) {
+    if (input.size() > MaxSourceSize) {
+        std::cout << "Error: Source is larger than " << MaxSourceSize << " bytes" << std::endl;
+        return nullptr;
+    }
+    return llvm::MemoryBuffer::getMemBufferCopy(input, "<input>");
+}
 
-    while (isspace(last_char)) { // Skip whitespace
-        last_char = getStrChar();
+Lexer::Lexer(const std::string& input) : Lexer(CopySource(input)) {}
+
+Lexer::Lexer(std::unique_ptr<llvm::MemoryBuffer> buffer, std::shared_ptr<StringInterner> symbols)
+    : buffer(std::move(buffer)), symbols(std::move(symbols)) {
+    // A missing buffer was already reported by whoever failed to make it
+    if (this->buffer && this->buffer->getBufferSize() > MaxSourceSize) {
+        std::cout << "Error: Source is larger than " << MaxSourceSize << " bytes" << std::endl;
+        this->buffer.reset();
+    }
+    // Lexes as an empty source, so that a parser stops at the first token
+    if (!this->buffer) {
+        valid = false;
+        this->buffer = llvm::MemoryBuffer::getMemBuffer("", "<invalid>");
     }
+    begin = this->buffer->getBufferStart();
+    cur = begin;
+    end = this->buffer->getBufferEnd();
+}
 
-    if (isalpha(last_char)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
-        res.push_back(last_char);
-        while (isalnum(st.top())) {
-            res.push_back(getStrChar());
-        }
+Token Lexer::makeToken(int type, const char* start) const {
+    return Token{type, static_cast<uint32_t>(start - begin), static_cast<uint32_t>(cur - start), 0, 0.0};
+}
 
-        if (res == "def") {
-            return Token(tok_def);
-        } 
-        if (res == "extern") {
-            return Token(tok_extern);
-        }
-        if (res[0] == EOF) {
-            return Token(tok_eof);
-        }
-        return Token(tok_identifier, res);
+// Token of every keyword, indexed by KeywordSymbols
+static const int KeywordTokens[sym_num_keywords] = {tok_def, tok_extern, tok_if, tok_then, tok_else, tok_for, tok_in};
+
+// Parses [start, stop) without requiring the source to be null terminated
+static double parseNumber(const char* start, const char* stop) {
+    char buf[64];
+    size_t len = stop - start;
+    if (len < sizeof(buf)) {
+        std::copy(start, stop, buf);
+        buf[len] = '\0';
+        return strtod(buf, nullptr);
+    }
+    return strtod(std::string(start, len).c_str(), nullptr);
+}
+
+// Function to get the next token from the input buffer
+Token Lexer::gettok() {
+    while (cur != end && isspace(static_cast<unsigned char>(*cur))) { // Skip whitespace
+        cur++;
+    }
+
+    const char* start = cur;
+    if (cur == end) {
+        return makeToken(tok_eof, start);
     }
 
-    if (isdigit(last_char) || last_char == '.') { // number: [0-9.]+
-        std::string num_str;
-        num_str.push_back(last_char);
-        while (!st.empty() && (isdigit(st.top()) || st.top() == '.')) {
-            last_char = getStrChar();
-            num_str.push_back(last_char);
+    if (isalpha(static_cast<unsigned char>(*cur))) { // identifier: [a-zA-Z][a-zA-Z0-9]*
+        do {
+            cur++;
+        } while (cur != end && isalnum(static_cast<unsigned char>(*cur)));
+
+        SymbolID id = symbols->intern(std::string_view(start, cur - start));
+        if (id < sym_num_keywords) {
+            return makeToken(KeywordTokens[id], start);
         }
-        val = strtod(num_str.c_str(), nullptr);
-        return Token(tok_number, "", val);
+        Token tok = makeToken(tok_identifier, start);
+        tok.symbol = id;
+        return tok;
     }
 
-    if (last_char == EOF) {
-        return Token(tok_eof);
+    if (isdigit(static_cast<unsigned char>(*cur)) || *cur == '.') { // number: [0-9.]+
+        do {
+            cur++;
+        } while (cur != end && (isdigit(static_cast<unsigned char>(*cur)) || *cur == '.'));
+
+        Token tok = makeToken(tok_number, start);
+        tok.number_value = parseNumber(start, cur);
+        return tok;
     }
 
     // If none of the above, return an unknown token (default case)
-    return Token(0, std::string(1, last_char));
+    cur++;
+    return makeToken(tok_unknown, start);
+}
+
+std::string_view Lexer::GetText(const Token& tok) const {
+    return std::string_view(begin + tok.offset, tok.length);
+}
+
+bool Lexer::IsValid() const {
+    return valid;
+}
+
+std::string_view Lexer::GetSource() const {
+    return std::string_view(begin, end - begin);
+}
+
+StringInterner& Lexer::GetSymbols() const {
+    return *symbols;
 }
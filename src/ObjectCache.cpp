@@ -0,0 +1,185 @@
+#include "../include/ObjectCache.hpp"
+
+#include <algorithm>
+#include <mutex>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CachePruning.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA256.h"
+#include "llvm/Support/raw_ostream.h"
+
+// pruneCache only considers files with this prefix, so temporary files that
+// are still being written are never evicted
+static const char* const EntryPrefix = "llvmcache-";
+
+// Total size of the entries in the directory
+static uint64_t EntryBytes(const std::string& directory) {
+    uint64_t bytes = 0;
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator entry(directory, ec), end; entry != end && !ec; entry.increment(ec)) {
+        if (!llvm::sys::path::filename(entry->path()).starts_with(EntryPrefix)) {
+            continue;
+        }
+        auto status = entry->status();
+        if (status) {
+            bytes += status->getSize();
+        }
+    }
+    return bytes;
+}
+
+ObjectFileCache::ObjectFileCache(std::string directory, uint64_t maxSizeBytes)
+    : directory(std::move(directory)), maxSizeBytes(maxSizeBytes) {
+    llvm::sys::fs::create_directories(this->directory);
+    storedBytes = EntryBytes(this->directory);
+}
+
+std::string ObjectFileCache::ComputeKey(const llvm::Module& module, const llvm::TargetMachine& targetMachine) {
+    std::string buffer;
+    llvm::raw_string_ostream os(buffer);
+    module.print(os, nullptr);
+    os << '\0' << targetMachine.getTargetTriple().str()
+       << '\0' << targetMachine.getTargetCPU()
+       << '\0' << targetMachine.getTargetFeatureString()
+       << '\0' << static_cast<int>(targetMachine.getOptLevel())
+       << '\0' << static_cast<int>(targetMachine.getRelocationModel())
+       << '\0' << static_cast<int>(targetMachine.getCodeModel());
+    os.flush();
+
+    auto digest = llvm::SHA256::hash(llvm::arrayRefFromStringRef(buffer));
+    return llvm::toHex(digest, /* LowerCase */ true);
+}
+
+std::string ObjectFileCache::getEntryPath(const std::string& key) const {
+    llvm::SmallString<128> path(directory);
+    llvm::sys::path::append(path, EntryPrefix + key + ".o");
+    return std::string(path);
+}
+
+std::unique_ptr<llvm::MemoryBuffer> ObjectFileCache::lookup(const std::string& key) {
+    std::string path = getEntryPath(key);
+    int fd;
+    if (llvm::sys::fs::openFileForRead(path, fd)) {
+        misses++;
+        return nullptr;
+    }
+
+    // An open entry stays readable even if another process evicts it meanwhile
+    auto buffer = llvm::MemoryBuffer::getOpenFile(fd, path, /* FileSize */ -1,
+                                                  /* RequiresNullTerminator */ false);
+    // Mark the entry as recently used for LRU eviction, atime is not reliable
+    llvm::sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+    llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+
+    if (!buffer) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    return std::move(*buffer);
+}
+
+void ObjectFileCache::store(const std::string& key, llvm::StringRef object) {
+    // Write to a unique temporary file and publish it with an atomic rename,
+    // so concurrent readers never see a partially written entry
+    llvm::SmallString<128> tmpModel(directory);
+    llvm::sys::path::append(tmpModel, "tmp-%%%%%%%%%%%%.o");
+    int fd;
+    llvm::SmallString<128> tmpPath;
+    if (llvm::sys::fs::createUniqueFile(tmpModel, fd, tmpPath)) {
+        return;
+    }
+    {
+        llvm::raw_fd_ostream os(fd, /* shouldClose */ true);
+        os << object;
+        os.close();
+        if (os.has_error()) {
+            os.clear_error();
+            llvm::sys::fs::remove(tmpPath);
+            return;
+        }
+    }
+    if (llvm::sys::fs::rename(tmpPath, getEntryPath(key))) {
+        llvm::sys::fs::remove(tmpPath);
+        return;
+    }
+
+    if (storedBytes.fetch_add(object.size()) + object.size() > maxSizeBytes) {
+        evict();
+    }
+}
+
+// Scans the whole directory twice, only called once storedBytes passes the cap
+void ObjectFileCache::evict() {
+    uint64_t targetBytes = std::max<uint64_t>(maxSizeBytes - maxSizeBytes / 8, 1); // 0 disables the cap
+    llvm::CachePruningPolicy policy;
+    policy.Interval = std::chrono::seconds(0); // throttled by storedBytes instead
+    policy.Expiration = std::chrono::seconds(0);
+    policy.MaxSizePercentageOfAvailableSpace = 0;
+    policy.MaxSizeFiles = 0;
+    policy.MaxSizeBytes = targetBytes;
+    llvm::pruneCache(directory, policy);
+    // pruneCache may have removed more than needed, or nothing if other
+    // processes already did, so count what is left. Stores that finish
+    // meanwhile are counted twice, which keeps storedBytes an upper bound.
+    storedBytes = EntryBytes(directory);
+}
+
+uint64_t ObjectFileCache::getHits() const {
+    return hits;
+}
+
+uint64_t ObjectFileCache::getMisses() const {
+    return misses;
+}
+
+namespace {
+// Bridges the JIT compilers to the file cache. A compiler asks for an object
+// first and hands over the compiled one right after a miss. Concurrent
+// compilers share the adapter, so pending keys are tracked per module.
+class JITObjectCache : public llvm::ObjectCache {
+    ObjectFileCache& cache;
+    const llvm::TargetMachine& targetMachine;
+    std::mutex pendingMutex;
+    llvm::DenseMap<const llvm::Module*, std::string> pendingKeys;
+
+public:
+    JITObjectCache(ObjectFileCache& cache, const llvm::TargetMachine& targetMachine)
+        : cache(cache), targetMachine(targetMachine) {}
+
+    std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* module) override {
+        std::string key = ObjectFileCache::ComputeKey(*module, targetMachine);
+        auto object = cache.lookup(key);
+        if (!object) {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            pendingKeys[module] = std::move(key);
+        }
+        return object;
+    }
+
+    void notifyObjectCompiled(const llvm::Module* module, llvm::MemoryBufferRef object) override {
+        std::string key;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex);
+            auto pending = pendingKeys.find(module);
+            if (pending != pendingKeys.end()) {
+                key = std::move(pending->second);
+                pendingKeys.erase(pending);
+            }
+        }
+        if (key.empty()) {
+            key = ObjectFileCache::ComputeKey(*module, targetMachine);
+        }
+        cache.store(key, object.getBuffer());
+    }
+};
+} // namespace
+
+std::unique_ptr<llvm::ObjectCache> ObjectFileCache::createJITCache(const llvm::TargetMachine& targetMachine) {
+    return std::make_unique<JITObjectCache>(*this, targetMachine);
+}
@@ -1,4 +1,6 @@
 #include "../include/Parser.hpp"
+#include "../include/Utils.hpp"
+#include "../include/Timing.hpp"
 
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Target/TargetMachine.h"
@@ -10,178 +12,301 @@
 #include "llvm/IR/LegacyPassManager.h"
 
 
+#include <array>
 #include <iostream>
 
-std::unique_ptr<PrototypeAST> LogErrorP(const std::string s) {
+PrototypeAST* LogErrorP(const std::string s) {
     std::cout << "Error: " << s << std::endl;
     return nullptr;
 } 
 
-std::unique_ptr<ExprAST> LogError(const std::string s) {
+ExprAST* LogError(const std::string s) {
     std::cout << "Error: " << s << std::endl;
     return nullptr;
 } 
 
-int Parser::GetOperatorPrecedence() {
-    char c = curToken.identifier[0];
-    if (isascii(c) && binopPrecedence.find(c) != binopPrecedence.end()) {
-        return binopPrecedence[c];
+// Binary operator precedence by character, -1 for every other character.
+// A higher precedence binds more tightly.
+static constexpr std::array<int8_t, 256> BinopPrecedence = [] {
+    std::array<int8_t, 256> table{};
+    for (int8_t& precedence : table) {
+        precedence = -1;
     }
-    return -1;
+    table['<'] = 5;
+    table['+'] = 10;
+    table['-'] = 20;
+    table['*'] = 30;
+    return table;
+}();
+
+int Parser::GetOperatorPrecedence() const {
+    return BinopPrecedence[static_cast<unsigned char>(CurChar())];
 }
 
-std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int exprPrecedence, std::unique_ptr<ExprAST> lhs) {
-    while(true) {
-        int tokPrecedence = GetOperatorPrecedence();
-
-        if (tokPrecedence < exprPrecedence) {
-            return lhs;
-        }
-
-        char binOp = curToken.identifier[0];
-        NextToken(); // drop binOp
-
-        auto rhs = ParsePrimary();
-        if (!rhs) {
-            return nullptr;
-        }
-
-        // If BinOp binds less tightly with RHS than the operator after RHS, let
-        // the pending operator take RHS as its LHS.
-        int nextPrecedence = GetOperatorPrecedence();
-        if (tokPrecedence < nextPrecedence) {
-            rhs = ParseBinOpRHS(exprPrecedence + 1, std::move(rhs));
-            if (!rhs)
-                return nullptr;
-        }
-
-        // Merge LHS/RHS.
-        lhs = std::make_unique<BinaryExprAST>(binOp, std::move(lhs), std::move(rhs));
-    }
-}
-
-std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
-    NextToken(); // drop '(' and read next token
-    auto exp = ParseExpression();
-
-    if (!exp) {
-        return nullptr;
-    }
-
-    if (curToken.identifier != ")") {
-        LogError("Expected closing ')'");
-    }
-    NextToken(); // drop ')' and read next token;
-    return exp;
+ExprAST* Parser::ParseNumberExpr() {
+    double num = curToken.number_value;
+    NextToken();
+    return arena.create<NumberExprAST>(num);
 }
 
-std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
-    const std::string id_name = curToken.identifier;
-    NextToken(); // drop identifier token and read next
-
-    if (curToken.identifier != "(") {
-        // not a function call but rather a variable
-        return std::make_unique<VariableExprAST>(id_name);
-    }
-
-    // parse Function Call
-    NextToken(); // drop '(' and read next token
-    std::vector<std::unique_ptr<ExprAST>> args;
-    while (curToken.identifier != ")") {
-        auto arg = ParseExpression();
-        if (!arg) {
-            return nullptr;
+// expression ::= operand (binop operand)*
+// operand    ::= number | identifier | identifier '(' (expression (',' expression)*)? ')'
+//              | '(' expression ')' | ifexpr | forexpr
+// ifexpr     ::= 'if' expression 'then' expression 'else' expression
+// forexpr    ::= 'for' identifier '=' expression ',' expression (',' expression)? 'in' expression
+//
+// Parsed without recursion, so the nesting depth is only bounded by memory.
+// Operands and binary operators wait on explicit stacks as in the
+// shunting-yard algorithm. An operator first combines the pending ones that
+// bind at least as tightly, so operators of equal precedence group to the
+// left. Parentheses, calls, if and for push a PendingExpr and parse each of
+// their parts as an expression on top of the same stacks.
+ExprAST* Parser::ParseExpression() {
+    llvm::SmallVector<ExprAST*, 16> operands;
+    llvm::SmallVector<char, 16> operators;
+    llvm::SmallVector<PendingExpr, 8> pending;
+
+    // Combines the operators above base that bind at least as tightly as precedence
+    auto reduce = [&](size_t base, int precedence) {
+        while (operators.size() > base && BinopPrecedence[static_cast<unsigned char>(operators.back())] >= precedence) {
+            ExprAST* rhs = operands.pop_back_val();
+            ExprAST* lhs = operands.pop_back_val();
+            operands.push_back(arena.create<BinaryExprAST>(operators.pop_back_val(), lhs, rhs));
         }
-        args.push_back(std::move(arg));
+    };
 
-        if (curToken.identifier != ")" && curToken.identifier != ",") {
-            return LogError("Expected ')' or ',' in argument list");
+    while (true) {
+        size_t operatorBase = operators.size();
+        size_t operandBase = operands.size();
+        switch (curToken.type) {
+            case tok_number:
+                operands.push_back(ParseNumberExpr());
+                break;
+            case tok_identifier: {
+                SymbolID name = curToken.symbol;
+                NextToken(); // drop identifier
+                if (CurChar() != '(') {
+                    operands.push_back(arena.create<VariableExprAST>(name));
+                    break;
+                }
+                NextToken(); // drop '('
+                if (CurChar() == ')') {
+                    NextToken(); // drop ')'
+                    operands.push_back(arena.create<CallExprAST>(name, llvm::ArrayRef<ExprAST*>()));
+                    break;
+                }
+                pending.push_back({PendingExpr::CallArgs, name, operatorBase, operandBase});
+                continue;
+            }
+            case tok_if:
+                NextToken(); // drop 'if'
+                pending.push_back({PendingExpr::IfCond, 0, operatorBase, operandBase});
+                continue;
+            case tok_for: {
+                NextToken(); // drop 'for'
+                if (curToken.type != tok_identifier) {
+                    return LogError("Expected identifier after 'for'");
+                }
+                SymbolID var = curToken.symbol;
+                NextToken(); // drop identifier
+                if (CurChar() != '=') {
+                    return LogError("Expected '=' after 'for'");
+                }
+                NextToken(); // drop '='
+                pending.push_back({PendingExpr::ForStart, var, operatorBase, operandBase});
+                continue;
+            }
+            default:
+                if (CurChar() != '(') {
+                    return LogError("Unrecognized token when parsing primary expression");
+                }
+                NextToken(); // drop '('
+                pending.push_back({PendingExpr::Paren, 0, operatorBase, operandBase});
+                continue;
         }
-        NextToken();
-    }
-    return std::make_unique<CallExprAST>(id_name, std::move(args)); 
-}
 
-std::unique_ptr<ExprAST> Parser::ParseNumberExpr() {
-    double num = curToken.number_value;
-    NextToken();
-    return std::make_unique<NumberExprAST>(num);
-}
+        // Operators after the operand, or the end of the innermost expression
+        while (true) {
+            size_t base = pending.empty() ? 0 : pending.back().operatorBase;
+            int precedence = GetOperatorPrecedence();
+            if (precedence >= 0) {
+                reduce(base, precedence);
+                operators.push_back(CurChar());
+                NextToken(); // drop binop
+                break;
+            }
 
-std::unique_ptr<ExprAST> Parser::ParsePrimary() {
-    switch(curToken.type) {
-        case tok_number:
-            return ParseNumberExpr();
-        case tok_identifier:
-            return ParseIdentifierExpr();
-        default:
-            // ToDo: add tokens for open and close
-            if (curToken.identifier == "(") {
-                return ParseParenExpr();
-            } else {
-                return LogError("Unrecognized token when parsing primary expression");
+            reduce(base, 0);
+            if (pending.empty()) {
+                return operands.pop_back_val();
+            }
+            size_t depth = pending.size();
+            if (!ContinuePending(pending, operands)) {
+                return nullptr;
             }
+            if (pending.size() == depth) {
+                break; // parse its next part
+            }
+        }
     }
 }
 
-std::unique_ptr<ExprAST> Parser::ParseExpression() {
-    auto lhs = ParsePrimary();
-    if (lhs == nullptr) {
-        return nullptr;
+// Takes the expression that just ended as the next part of the innermost
+// pending construct. A complete construct is popped and its node left on the
+// operand stack, otherwise it waits for its next part.
+bool Parser::ContinuePending(llvm::SmallVectorImpl<PendingExpr>& pending,
+                             llvm::SmallVectorImpl<ExprAST*>& operands) {
+    PendingExpr& expr = pending.back();
+    llvm::ArrayRef<ExprAST*> parts = llvm::ArrayRef<ExprAST*>(operands).drop_front(expr.operandBase);
+    ExprAST* node = nullptr;
+    switch (expr.kind) {
+        case PendingExpr::Paren:
+            if (CurChar() != ')') {
+                LogError("Expected closing ')'");
+                return false;
+            }
+            NextToken(); // drop ')'
+            pending.pop_back();
+            return true;
+        case PendingExpr::CallArgs:
+            if (CurChar() == ',') {
+                NextToken(); // drop ','
+                return true;
+            }
+            if (CurChar() != ')') {
+                LogError("Expected ')' or ',' in argument list");
+                return false;
+            }
+            NextToken(); // drop ')'
+            node = arena.create<CallExprAST>(expr.symbol, arena.copyArray<ExprAST*>(parts));
+            break;
+        case PendingExpr::IfCond:
+            if (curToken.type != tok_then) {
+                LogError("Expected 'then'");
+                return false;
+            }
+            NextToken(); // drop 'then'
+            expr.kind = PendingExpr::IfThen;
+            return true;
+        case PendingExpr::IfThen:
+            if (curToken.type != tok_else) {
+                LogError("Expected 'else'");
+                return false;
+            }
+            NextToken(); // drop 'else'
+            expr.kind = PendingExpr::IfElse;
+            return true;
+        case PendingExpr::IfElse:
+            node = arena.create<IfExprAST>(parts[0], parts[1], parts[2]);
+            break;
+        case PendingExpr::ForStart:
+            if (CurChar() != ',') {
+                LogError("Expected ',' after for start value");
+                return false;
+            }
+            NextToken(); // drop ','
+            expr.kind = PendingExpr::ForCond;
+            return true;
+        case PendingExpr::ForCond:
+            if (CurChar() == ',') {
+                NextToken(); // drop ','
+                expr.kind = PendingExpr::ForStep;
+                return true;
+            }
+            operands.push_back(nullptr); // no step
+            [[fallthrough]];
+        case PendingExpr::ForStep:
+            if (curToken.type != tok_in) {
+                LogError("Expected 'in' after for");
+                return false;
+            }
+            NextToken(); // drop 'in'
+            expr.kind = PendingExpr::ForBody;
+            return true;
+        case PendingExpr::ForBody:
+            node = arena.create<ForExprAST>(expr.symbol, parts[0], parts[1], parts[2], parts[3]);
+            break;
     }
-    return ParseBinOpRHS(0, std::move(lhs));
+    operands.resize(expr.operandBase);
+    operands.push_back(node);
+    pending.pop_back();
+    return true;
 }
 
-
-std::unique_ptr<PrototypeAST> Parser::ParseProto() {
+PrototypeAST* Parser::ParseProto() {
     if (curToken.type != tok_identifier) {
         return LogErrorP("Expected function name in prototype");
     }
-    std::string functionName = curToken.identifier;
+    SymbolID functionName = curToken.symbol;
     NextToken();
 
-    if (curToken.type != tok_unknown || curToken.identifier != "(" ) {
+    if (CurChar() != '(') {
         return LogErrorP("Expected '(' to start prototype");
     }
     NextToken();
 
-    std::vector<std::string> argNames;
+    llvm::SmallVector<SymbolID, 8> argNames;
     while(curToken.type == tok_identifier) {
-        argNames.push_back(curToken.identifier);
+        argNames.push_back(curToken.symbol);
         NextToken();
     }
 
-    if (curToken.type != tok_unknown && curToken.identifier != ")") {
+    if (CurChar() != ')') {
         return LogErrorP("Expected ')' to end prototype");
     }
     NextToken(); // drop closing ')' and get next token
-    return std::make_unique<PrototypeAST>(functionName, std::move(argNames));
+    return arena.create<PrototypeAST>(functionName, arena.copyArray<SymbolID>(argNames));
 }
 
-std::unique_ptr<FunctionAST> Parser::ParseDefinition() {
+FunctionAST* Parser::ParseDefinition() {
+    TimeScope scope("Parse");
     NextToken(); // drop 'def' and get next token
     auto proto = ParseProto();
     if (!proto) {
         return nullptr;
     }
+    scope.setDetail(symbols->getName(proto->getName()));
 
     if (auto exp = ParseExpression()) {
-        return std::make_unique<FunctionAST>(std::move(proto), std::move(exp));
+        return arena.create<FunctionAST>(proto, exp);
     }
     return nullptr;
 }
 
-std::unique_ptr<PrototypeAST> Parser::ParseExtern() {
+// Hands fnAST to the AST optimizer unless it is switched off
+FunctionAST* Parser::OptimizeDefinition(FunctionAST* fnAST) {
+    const CompilerOptions& options = irConst->getOptions();
+    if (!options.optimizeAST) {
+        return fnAST;
+    }
+    llvm::StringRef name = symbols->getName(fnAST->getProto().getName());
+    TimeScope scope("ASTOptimize", name);
+    return astOptimizer.optimize(*fnAST, options.getFPMode(name));
+}
+
+PrototypeAST* Parser::ParseExtern() {
     NextToken(); // drop extern
     return ParseProto();
 }
 
+// llvm::errs() is not safe to share between threads, std::cerr is
+static void PrintIR(const llvm::Value& value) {
+    std::string ir;
+    llvm::raw_string_ostream os(ir);
+    value.print(os);
+    std::cerr << os.str();
+}
+
 void Parser::HandleDefinition() {
     if (auto fnAST = ParseDefinition()) {
+        fnAST = OptimizeDefinition(fnAST);
         if (auto *fnIR = fnAST->codegen(*irConst)) {
             std::cout << "Read function definition" << std::endl;
-            fnIR->print(llvm::errs());
+            PrintIR(*fnIR);
             std::cout << std::endl;
+            if (jit) {
+                LogIfError(jit->addModule(irConst->takeModule()));
+            }
         }
         std::cout << "Parsed Definiton" << std::endl;
     } else {
@@ -194,7 +319,7 @@ void Parser::HandleExtern() {
     if (auto protoAST = ParseExtern()) {
         if (auto *extIR = protoAST->codegen(*irConst)){
             std::cout << "Parsed Extern" << std::endl;
-            extIR->print(llvm::errs()); 
+            PrintIR(*extIR);
             std::cout << std::endl;
         }
     } else {
@@ -204,11 +329,27 @@ void Parser::HandleExtern() {
 }
 
 void Parser::HandleTopLevelExpression() {
-    if (auto fnAST = ParseExpression()) {
+    ExprAST* expr;
+    {
+        TimeScope scope("Parse", "__anon_expr");
+        expr = ParseExpression();
+    }
+    if (expr) {
+        // wrap the expression into an anonymous nullary function. The JIT
+        // frees each one after running it, otherwise they pile up in the module.
+        std::string name = "__anon_expr";
+        if (!jit && numAnonExprs++ > 0) {
+            name += std::to_string(numAnonExprs - 1);
+        }
+        auto proto = arena.create<PrototypeAST>(symbols->intern(name), llvm::ArrayRef<SymbolID>());
+        auto fnAST = OptimizeDefinition(arena.create<FunctionAST>(proto, expr));
         if (auto *fnIR = fnAST->codegen(*irConst)) {
             std::cout << "Parsed top level expression" << std::endl;
-            fnIR->print(llvm::errs());
+            PrintIR(*fnIR);
             std::cout << std::endl;
+            if (jit) {
+                EvaluateTopLevelExpression();
+            }
         }
     } else {
         std::cout << "Failed to parse top level expression" << std::endl;
@@ -216,8 +357,43 @@ void Parser::HandleTopLevelExpression() {
     }
 }
 
+void Parser::EvaluateTopLevelExpression() {
+    // the expression gets its own tracker so its code is freed right after running it
+    auto tracker = jit->createResourceTracker();
+    if (LogIfError(jit->addModule(irConst->takeModule(), tracker))) {
+        return;
+    }
+
+    auto address = jit->lookup("__anon_expr");
+    if (!address) {
+        LogIfError(address.takeError());
+        return;
+    }
+    double (*fn)() = address->toPtr<double (*)()>();
+    std::cout << "Evaluated to " << fn() << std::endl;
+
+    LogIfError(tracker->remove());
+}
+
 void Parser::NextToken() {
-    curToken = lexer.gettok();
+    if (!tokenQueue) {
+        curToken = lexer.gettok();
+        return;
+    }
+    if (nextQueuedToken == queuedTokens.size()) {
+        nextQueuedToken = 0;
+        queuedTokens.clear();
+        if (!tokenQueue->pop(queuedTokens) || queuedTokens.empty()) {
+            curToken = Token{tok_eof, 0, 0, 0, 0.0};
+            return;
+        }
+    }
+    curToken = queuedTokens[nextQueuedToken++];
+}
+
+// Single character tokens such as '(' or '+', '\0' for every other token
+char Parser::CurChar() const {
+    return curToken.type == tok_unknown ? lexer.GetText(curToken)[0] : '\0';
 }
 
 /* 
@@ -227,6 +403,9 @@ We need to split AST and IR construction
 - make everything modular
 */
 int Parser::parse() {
+    if (!lexer.IsValid()) {
+        return 1;
+    }
     bool run = true; 
 
     /// top ::= definition | external | expression | ';'
@@ -242,8 +421,11 @@ int Parser::parse() {
             HandleExtern();
             break;
         default:
-            HandleTopLevelExpression();
-            run = false; 
+            if (CurChar() == ';') {
+                NextToken();
+            } else {
+                HandleTopLevelExpression();
+            }
             break;
         }
     }
@@ -252,6 +434,68 @@ int Parser::parse() {
     return 0;
 }
 
+bool Parser::ParseDefinitions(std::vector<PrototypeAST*>& externs, std::vector<FunctionAST*>& definitions) {
+    return ParseDefinitions(
+        [&](PrototypeAST* protoAST) {
+            externs.push_back(protoAST);
+            return true;
+        },
+        [&](FunctionAST* fnAST) {
+            definitions.push_back(fnAST);
+            return true;
+        });
+}
+
+bool Parser::ParseDefinitions(llvm::function_ref<bool(PrototypeAST*)> onExtern,
+                              llvm::function_ref<bool(FunctionAST*)> onDefinition) {
+    if (!lexer.IsValid()) {
+        return false;
+    }
+    while (true) {
+        switch (curToken.type) {
+            case tok_eof:
+                return true;
+            case tok_def: {
+                FunctionAST* fnAST = ParseDefinition();
+                if (!fnAST || !onDefinition(OptimizeDefinition(fnAST))) {
+                    return false;
+                }
+                break;
+            }
+            case tok_extern: {
+                PrototypeAST* protoAST = ParseExtern();
+                if (!protoAST || !onExtern(protoAST)) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                LogError("Expected 'def' or 'extern' at the top level");
+                return false;
+        }
+    }
+}
+
 std::shared_ptr<IRConstructor> Parser::GetIRConstructor() {
     return irConst;
-}
\ No newline at end of file
+}
+
+const ASTArena& Parser::GetArena() const {
+    return arena;
+}
+
+const ASTOptimizerStats& Parser::GetASTStats() const {
+    return astOptimizer.getStats();
+}
+
+void Parser::SetJIT(std::shared_ptr<JITSession> jit) {
+    this->jit = std::move(jit);
+}
+
+void Parser::SetTokenQueue(TokenQueue* queue) {
+    tokenQueue = queue;
+}
+
+Lexer& Parser::GetLexer() {
+    return lexer;
+}
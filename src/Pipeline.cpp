@@ -0,0 +1,245 @@
+#include "../include/Pipeline.hpp"
+#include "../include/Parser.hpp"
+#include "../include/Timing.hpp"
+#include "../include/Utils.hpp"
+
+#include <deque>
+#include <thread>
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/TargetParser/Triple.h"
+
+namespace {
+struct WorkResult {
+    llvm::SmallVector<char, 0> object;
+    bool succeeded = false;
+};
+
+// Everything a worker needs to compile a group of definitions on its own
+struct WorkItem {
+    std::vector<PrototypeAST*> declarations; // every function called by the item
+    std::vector<FunctionAST*> callees; // definitions of earlier items copied in
+    std::vector<FunctionAST*> definitions;
+    WorkResult* result = nullptr;
+};
+
+// State of the parsing stage, which builds the work items
+class ItemBuilder {
+    const StringInterner& symbols;
+    size_t definitionsPerModule;
+    bool copyCallees;
+    llvm::DenseMap<SymbolID, PrototypeAST*> prototypes; // of externs and definitions
+    llvm::DenseMap<SymbolID, FunctionAST*> definitions;
+    llvm::DenseMap<SymbolID, llvm::SmallVector<SymbolID, 4>> calleesOf;
+    // Of the item being built
+    WorkItem item;
+    llvm::DenseSet<SymbolID> declared;
+    llvm::DenseSet<SymbolID> copied;
+    llvm::DenseSet<SymbolID> defined;
+
+public:
+    ItemBuilder(const StringInterner& symbols, const PipelineOptions& options)
+        : symbols(symbols), definitionsPerModule(std::max<size_t>(options.definitionsPerModule, 1)),
+          copyCallees(options.compilerOptions.optLevel != OptLevel::O0) {}
+
+    bool addExtern(PrototypeAST* protoAST) {
+        auto known = prototypes.try_emplace(protoAST->getName(), protoAST);
+        if (!known.second && known.first->second->getArgs().size() != protoAST->getArgs().size()) {
+            LogErrorV("Function redeclared with a different number of arguments: " + nameOf(*protoAST));
+            return false;
+        }
+        return true;
+    }
+
+    bool addDefinition(FunctionAST* funcAST) {
+        PrototypeAST& protoAST = funcAST->getProto();
+        SymbolID name = protoAST.getName();
+        if (!definitions.try_emplace(name, funcAST).second) {
+            LogErrorV("Cannot redefine function " + nameOf(protoAST));
+            return false;
+        }
+        if (!addExtern(&protoAST)) {
+            return false;
+        }
+        prototypes[name] = &protoAST;
+
+        llvm::SmallVector<SymbolID, 4> callees;
+        collectCallees(funcAST->getBody(), callees);
+        calleesOf[name] = callees;
+        defined.insert(name);
+        for (SymbolID callee : callees) {
+            declare(callee);
+            // Calls within the item need no copy, unknown callees fail in codegen
+            auto definition = definitions.find(callee);
+            if (copyCallees && !defined.count(callee) && definition != definitions.end() &&
+                copied.insert(callee).second) {
+                item.callees.push_back(definition->second);
+                for (SymbolID indirect : calleesOf[callee]) {
+                    declare(indirect);
+                }
+            }
+        }
+        item.definitions.push_back(funcAST);
+        return true;
+    }
+
+    bool empty() const {
+        return item.definitions.empty();
+    }
+
+    bool full() const {
+        return item.definitions.size() == definitionsPerModule;
+    }
+
+    WorkItem take() {
+        WorkItem next = std::move(item);
+        item = WorkItem();
+        declared.clear();
+        copied.clear();
+        defined.clear();
+        return next;
+    }
+
+private:
+    void declare(SymbolID name) {
+        auto prototype = prototypes.find(name);
+        if (prototype != prototypes.end() && declared.insert(name).second) {
+            item.declarations.push_back(prototype->second);
+        }
+    }
+
+    std::string nameOf(const PrototypeAST& protoAST) const {
+        return std::string(symbols.getName(protoAST.getName()));
+    }
+};
+} // namespace
+
+static bool GenerateItem(IRConstructor& irConst, const WorkItem& item) {
+    for (PrototypeAST* protoAST : item.declarations) {
+        if (!protoAST->codegen(irConst)) {
+            return false;
+        }
+    }
+    for (FunctionAST* funcAST : item.callees) {
+        llvm::Function* copy = funcAST->codegen(irConst);
+        if (!copy) {
+            return false;
+        }
+        copy->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+    }
+    for (FunctionAST* funcAST : item.definitions) {
+        if (!funcAST->codegen(irConst)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One worker thread, its IRConstructor is reused for every item it takes
+static void RunWorker(BoundedQueue<WorkItem>& work, std::shared_ptr<StringInterner> symbols,
+                      const CompilerOptions& options) {
+    IRConstructor irConst(std::move(symbols), options);
+    WorkItem item;
+    while (work.pop(item)) {
+        bool generated = GenerateItem(irConst, item);
+        // Taken either way, so a failed item leaves nothing behind for the next
+        llvm::orc::ThreadSafeModule module = irConst.takeModule();
+        if (!generated) {
+            continue;
+        }
+        item.result->succeeded = module.withModuleDo([&](llvm::Module& m) {
+            return CompileModuleToObject(m, options, item.result->object);
+        }) == 0;
+    }
+}
+
+Pipeline::Pipeline(PipelineOptions options) : options(std::move(options)) {}
+
+bool Pipeline::compile(std::unique_ptr<llvm::MemoryBuffer> source) {
+    InitializeTargets();
+    objects.clear();
+    auto symbols = std::make_shared<StringInterner>();
+    // Lexes the first token here, the lexer thread continues from the second
+    Parser parser(std::move(source), symbols, options.compilerOptions);
+    TokenQueue tokens(options.queueCapacity);
+    parser.SetTokenQueue(&tokens);
+
+    size_t chunkSize = std::max<size_t>(options.tokensPerChunk, 1);
+    std::thread lexerThread([&tokens, &lexer = parser.GetLexer(), chunkSize] {
+        TimeScope scope("Lex");
+        std::vector<Token> chunk;
+        chunk.reserve(chunkSize);
+        while (true) {
+            chunk.push_back(lexer.gettok());
+            bool eof = chunk.back().type == tok_eof;
+            if (eof || chunk.size() == chunkSize) {
+                // Fails once the parser gave up and closed the queue
+                if (!tokens.push(std::move(chunk)) || eof) {
+                    break;
+                }
+                chunk = std::vector<Token>();
+                chunk.reserve(chunkSize);
+            }
+        }
+        tokens.close();
+    });
+
+    BoundedQueue<WorkItem> work(options.queueCapacity);
+    std::vector<std::thread> workers;
+    unsigned numWorkers = llvm::hardware_concurrency(options.jobs).compute_thread_count();
+    for (unsigned i = 0; i < std::max(numWorkers, 1u); i++) {
+        workers.emplace_back(RunWorker, std::ref(work), symbols, std::cref(options.compilerOptions));
+    }
+
+    // References to deque elements stay valid while more are added
+    std::deque<WorkResult> results;
+    ItemBuilder builder(*symbols, options);
+    auto submit = [&] {
+        results.emplace_back();
+        WorkItem item = builder.take();
+        item.result = &results.back();
+        return work.push(std::move(item));
+    };
+    bool parsed = parser.ParseDefinitions(
+        [&](PrototypeAST* protoAST) { return builder.addExtern(protoAST); },
+        [&](FunctionAST* funcAST) { return builder.addDefinition(funcAST) && (!builder.full() || submit()); });
+    if (parsed && !builder.empty()) {
+        parsed = submit();
+    }
+
+    // Unblocks the lexer if parsing stopped early, workers finish what is queued
+    tokens.close();
+    work.close();
+    lexerThread.join();
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    if (!parsed) {
+        return false;
+    }
+
+    for (WorkResult& result : results) {
+        if (!result.succeeded) {
+            LogErrorV("Failed to compile part " + std::to_string(objects.size()));
+            objects.clear();
+            return false;
+        }
+        objects.push_back(std::move(result.object));
+    }
+    return true;
+}
+
+const std::vector<llvm::SmallVector<char, 0>>& Pipeline::getObjects() const {
+    return objects;
+}
+
+int Pipeline::writeArchive(const std::string& fileName) const {
+    std::vector<std::string> memberNames;
+    for (size_t i = 0; i < objects.size(); i++) {
+        memberNames.push_back("part" + std::to_string(i) + ".o");
+    }
+    llvm::Triple triple(options.compilerOptions.target.getTriple());
+    return WriteObjectArchive(fileName, memberNames, objects, triple);
+}
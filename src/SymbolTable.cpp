@@ -0,0 +1,41 @@
+#include "../include/SymbolTable.hpp"
+
+#include "llvm/Support/MathExtras.h"
+
+StringInterner::StringInterner() {
+    // must match the order of KeywordSymbols
+    for (const char* keyword : {"def", "extern", "if", "then", "else", "for", "in"}) {
+        intern(keyword);
+    }
+}
+
+// Segment of id and its index within the segment
+static std::pair<size_t, size_t> Locate(size_t id, size_t firstSegmentSize) {
+    size_t segment = llvm::Log2_64(id / firstSegmentSize + 1);
+    return {segment, id - firstSegmentSize * ((size_t(1) << segment) - 1)};
+}
+
+SymbolID StringInterner::intern(std::string_view name) {
+    size_t id = numNames.load(std::memory_order_relaxed);
+    auto [it, inserted] = ids.try_emplace(llvm::StringRef(name.data(), name.size()), static_cast<SymbolID>(id));
+    if (inserted) {
+        auto [segment, index] = Locate(id, FirstSegmentSize);
+        if (!segments[segment]) {
+            segments[segment] = std::make_unique<llvm::StringRef[]>(FirstSegmentSize << segment);
+        }
+        // StringMap entries never move, so the key can be referenced directly
+        segments[segment][index] = it->getKey();
+        numNames.store(id + 1, std::memory_order_release);
+    }
+    return it->getValue();
+}
+
+std::string_view StringInterner::getName(SymbolID id) const {
+    auto [segment, index] = Locate(id, FirstSegmentSize);
+    llvm::StringRef name = segments[segment][index];
+    return std::string_view(name.data(), name.size());
+}
+
+size_t StringInterner::size() const {
+    return numNames.load(std::memory_order_acquire);
+}
@@ -0,0 +1,88 @@
+#include "../include/TargetConfig.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/TargetParser/Host.h"
+#include "llvm/TargetParser/SubtargetFeature.h"
+#include "llvm/TargetParser/Triple.h"
+
+namespace {
+struct HostCPU {
+    std::string name;
+    std::string features;
+};
+} // namespace
+
+// Detected once, the answer does not change while the process runs
+static const HostCPU& GetHostCPU() {
+    static const HostCPU host = [] {
+        HostCPU detected;
+        detected.name = llvm::sys::getHostCPUName().str();
+
+        llvm::StringMap<bool> hostFeatures;
+        if (llvm::sys::getHostCPUFeatures(hostFeatures)) {
+            // sorted so the feature string (and cache keys) are stable
+            std::vector<std::string> names;
+            for (auto& feature : hostFeatures) {
+                names.push_back(feature.first().str());
+            }
+            std::sort(names.begin(), names.end());
+
+            llvm::SubtargetFeatures features;
+            for (auto& name : names) {
+                features.AddFeature(name, hostFeatures[name]);
+            }
+            detected.features = features.getString();
+        }
+        return detected;
+    }();
+    return host;
+}
+
+TargetConfig TargetConfig::Generic() {
+    TargetConfig config;
+    config.cpu = "generic";
+    return config;
+}
+
+std::string TargetConfig::getTriple() const {
+    return triple.empty() ? llvm::sys::getDefaultTargetTriple() : triple;
+}
+
+std::string TargetConfig::getCPU() const {
+    return cpu == "host" ? GetHostCPU().name : cpu;
+}
+
+std::string TargetConfig::getFeatures() const {
+    std::string resolved = cpu == "host" ? GetHostCPU().features : "";
+    if (!features.empty()) {
+        // later entries override earlier ones
+        resolved += resolved.empty() ? features : "," + features;
+    }
+    return resolved;
+}
+
+llvm::orc::JITTargetMachineBuilder TargetConfig::createJITTargetMachineBuilder() const {
+    llvm::orc::JITTargetMachineBuilder builder{llvm::Triple(getTriple())};
+    builder.setCPU(getCPU());
+    builder.setFeatures(getFeatures());
+    if (relocModel) {
+        builder.setRelocationModel(*relocModel);
+    }
+    if (codeModel) {
+        builder.setCodeModel(*codeModel);
+    }
+    builder.setCodeGenOptLevel(codeGenOptLevel);
+    return builder;
+}
+
+llvm::Expected<std::unique_ptr<llvm::TargetMachine>> TargetConfig::createTargetMachine() const {
+    return createJITTargetMachineBuilder().createTargetMachine();
+}
+
+void ConfigureModule(llvm::Module& module, const llvm::TargetMachine& targetMachine) {
+    module.setTargetTriple(targetMachine.getTargetTriple().str());
+    module.setDataLayout(targetMachine.createDataLayout());
+}
@@ -0,0 +1,389 @@
+#include "../include/TieredJIT.hpp"
+#include "../include/IRConstructor.hpp"
+#include "../include/Parser.hpp"
+#include "../include/Timing.hpp"
+#include "../include/Utils.hpp"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/ProfileData/InstrProf.h"
+#include "llvm/ProfileData/ProfileCommon.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+struct TieredJIT::FunctionState {
+    TieredJIT* owner = nullptr;
+    FunctionAST* funcAST = nullptr;
+    std::string name;
+    // [0] calls plus loop iterations, [1] calls, then the taken and not taken
+    // count of every conditional branch. Written by the tier 0 code.
+    std::unique_ptr<std::atomic<uint64_t>[]> counters;
+    size_t numBranches = 0;
+    // Address of the newest tier, the entry stub calls through it
+    std::atomic<uint64_t> entry{0};
+    std::atomic<int> tier{0};
+
+    FunctionProfile readProfile() const {
+        FunctionProfile profile;
+        profile.calls = counters[1].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < numBranches; i++) {
+            profile.branches.emplace_back(counters[2 + 2 * i].load(std::memory_order_relaxed),
+                                          counters[3 + 2 * i].load(std::memory_order_relaxed));
+        }
+        return profile;
+    }
+};
+
+// Host memory the JIT'd code reads and writes directly
+static llvm::Constant* HostPointer(uint64_t address, llvm::Type* pointeeT) {
+    llvm::Constant* value = llvm::ConstantInt::get(llvm::Type::getInt64Ty(pointeeT->getContext()), address);
+    return llvm::ConstantExpr::getIntToPtr(value, llvm::PointerType::getUnqual(pointeeT));
+}
+
+// In block order, which is the same every time a function is emitted from its AST
+static llvm::SmallVector<llvm::BranchInst*, 8> ConditionalBranches(llvm::Function& func) {
+    llvm::SmallVector<llvm::BranchInst*, 8> branches;
+    for (llvm::BasicBlock& block : func) {
+        auto* branch = llvm::dyn_cast<llvm::BranchInst>(block.getTerminator());
+        if (branch && branch->isConditional()) {
+            branches.push_back(branch);
+        }
+    }
+    return branches;
+}
+
+// Adds the tier 0 counters (see FunctionState) to func. The call counter
+// and branch counters may lose increments under contention, which is
+// cheaper than a locked add. Calls plus iterations are counted exactly, so
+// exactly one of them calls requestTierUp(state).
+static void Instrument(llvm::Function& func, std::atomic<uint64_t>* counters, uint64_t threshold,
+                       uint64_t requestTierUp, void* state) {
+    llvm::LLVMContext& context = func.getContext();
+    llvm::Type* counterT = llvm::Type::getInt64Ty(context);
+    llvm::Constant* base = HostPointer(reinterpret_cast<uintptr_t>(counters), counterT);
+    llvm::IRBuilder<> builder(context);
+    auto counter = [&](uint64_t index) {
+        return builder.CreateConstInBoundsGEP1_64(counterT, base, index);
+    };
+    auto bump = [&](llvm::Value* address) {
+        llvm::LoadInst* count = builder.CreateLoad(counterT, address);
+        count->setAtomic(llvm::AtomicOrdering::Monotonic);
+        llvm::StoreInst* store = builder.CreateStore(builder.CreateAdd(count, builder.getInt64(1)), address);
+        store->setAtomic(llvm::AtomicOrdering::Monotonic);
+    };
+
+    // Loop headers run once per iteration, including loops from tail recursion
+    llvm::DominatorTree domTree(func);
+    llvm::LoopInfo loops(domTree);
+    llvm::SmallVector<llvm::BasicBlock*, 8> hotnessBlocks = {&func.getEntryBlock()};
+    for (llvm::Loop* loop : loops.getLoopsInPreorder()) {
+        hotnessBlocks.push_back(loop->getHeader());
+    }
+
+    llvm::SmallVector<llvm::BranchInst*, 8> branches = ConditionalBranches(func);
+    for (size_t i = 0; i < branches.size(); i++) {
+        builder.SetInsertPoint(branches[i]);
+        llvm::Value* index = builder.CreateSelect(branches[i]->getCondition(), builder.getInt64(2 + 2 * i),
+                                                  builder.getInt64(3 + 2 * i));
+        bump(builder.CreateInBoundsGEP(counterT, base, index));
+    }
+
+    builder.SetInsertPoint(&*func.getEntryBlock().getFirstInsertionPt());
+    bump(counter(1));
+
+    llvm::Type* stateT = llvm::Type::getInt8Ty(context);
+    llvm::FunctionType* requestT = llvm::FunctionType::get(llvm::Type::getVoidTy(context),
+                                                           {llvm::PointerType::getUnqual(stateT)}, false);
+    llvm::MDNode* unlikely = llvm::MDBuilder(context).createBranchWeights(1, (1u << 20) - 1);
+    for (llvm::BasicBlock* block : hotnessBlocks) {
+        builder.SetInsertPoint(&*block->getFirstInsertionPt());
+        llvm::Value* count = builder.CreateAtomicRMW(llvm::AtomicRMWInst::Add, counter(0), builder.getInt64(1),
+                                                     llvm::MaybeAlign(8), llvm::AtomicOrdering::Monotonic);
+        auto* hot = llvm::cast<llvm::Instruction>(builder.CreateICmpEQ(count, builder.getInt64(threshold - 1)));
+        llvm::Instruction* request = llvm::SplitBlockAndInsertIfThen(hot, hot->getNextNode(), false, unlikely);
+        builder.SetInsertPoint(request);
+        builder.CreateCall(requestT, HostPointer(requestTierUp, requestT),
+                           {HostPointer(reinterpret_cast<uintptr_t>(state), stateT)});
+    }
+}
+
+// stub(args...) = (*entry)(args...), as a musttail call so it adds no frame
+static void EmitEntryStub(llvm::Function& stub, const std::atomic<uint64_t>* entry) {
+    llvm::LLVMContext& context = stub.getContext();
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(context, "entry", &stub));
+    llvm::Type* addressT = llvm::Type::getInt64Ty(context);
+    llvm::LoadInst* address = builder.CreateLoad(addressT, HostPointer(reinterpret_cast<uintptr_t>(entry), addressT),
+                                                 "tier");
+    address->setAtomic(llvm::AtomicOrdering::Acquire);
+    llvm::Value* callee = builder.CreateIntToPtr(address, llvm::PointerType::getUnqual(stub.getFunctionType()));
+
+    llvm::SmallVector<llvm::Value*, 8> args;
+    for (llvm::Argument& arg : stub.args()) {
+        args.push_back(&arg);
+    }
+    llvm::CallInst* call = builder.CreateCall(stub.getFunctionType(), callee, args);
+    call->setTailCallKind(llvm::CallInst::TCK_MustTail);
+    builder.CreateRet(call);
+}
+
+// Branch weights are 32 bits, larger counts are scaled down together
+static void SetBranchWeights(llvm::BranchInst& branch, uint64_t taken, uint64_t notTaken) {
+    uint64_t scale = std::max(taken, notTaken) / UINT32_MAX + 1;
+    llvm::MDBuilder md(branch.getContext());
+    branch.setMetadata(llvm::LLVMContext::MD_prof, md.createBranchWeights(taken / scale, notTaken / scale));
+}
+
+// Attaches the counts of a function's tier 0 code to func, which was
+// emitted again from the same AST
+static void ApplyProfile(llvm::Function& func, const FunctionProfile& profile,
+                         llvm::InstrProfSummaryBuilder& summary) {
+    func.setEntryCount(llvm::Function::ProfileCount(profile.calls, llvm::Function::PCT_Real));
+    // The summary takes the entry count first, then every other count
+    std::vector<uint64_t> counts = {profile.calls};
+    llvm::SmallVector<llvm::BranchInst*, 8> branches = ConditionalBranches(func);
+    for (size_t i = 0; i < branches.size() && branches.size() == profile.branches.size(); i++) {
+        auto [taken, notTaken] = profile.branches[i];
+        if (taken + notTaken == 0) {
+            continue;
+        }
+        SetBranchWeights(*branches[i], taken, notTaken);
+        counts.push_back(taken);
+        counts.push_back(notTaken);
+    }
+    summary.addRecord(llvm::InstrProfRecord(std::move(counts)));
+}
+
+TieredJIT::TieredJIT(const TieredJITOptions& options)
+    : options(options), symbols(std::make_shared<StringInterner>()) {
+    // Tier 1 is emitted as object code for the JIT
+    this->options.compilerOptions.lto = LTOMode::None;
+    this->options.hotThreshold = std::max<uint64_t>(options.hotThreshold, 1);
+}
+
+llvm::Expected<std::unique_ptr<TieredJIT>> TieredJIT::Create(const TieredJITOptions& options) {
+    // The session only compiles tier 0, tier 1 arrives as object code
+    JITOptions jitOptions;
+    jitOptions.compilerOptions = options.compilerOptions;
+    jitOptions.compilerOptions.optLevel = OptLevel::O0;
+    jitOptions.compilerOptions.lto = LTOMode::None;
+    jitOptions.compilerOptions.target.codeGenOptLevel = llvm::CodeGenOptLevel::None;
+    // The background compiler adds and looks up code next to the caller
+    jitOptions.concurrentCompilation = true;
+    auto session = JITSession::Create(jitOptions);
+    if (!session) {
+        return session.takeError();
+    }
+
+    std::unique_ptr<TieredJIT> jit(new TieredJIT(options));
+    jit->session = std::move(*session);
+    jit->tier0 = std::make_unique<IRConstructor>(jit->symbols, jitOptions.compilerOptions);
+    jit->compiler = std::thread(&TieredJIT::runCompiler, jit.get());
+    return std::move(jit);
+}
+
+TieredJIT::~TieredJIT() {
+    stopping = true;
+    requests.close();
+    if (compiler.joinable()) {
+        compiler.join();
+    }
+}
+
+bool TieredJIT::addSource(const std::string& source) {
+    parsers.push_back(std::make_unique<Parser>(llvm::MemoryBuffer::getMemBufferCopy(source, "<input>"), symbols,
+                                               options.compilerOptions));
+    return parsers.back()->ParseDefinitions(
+        [&](PrototypeAST* protoAST) {
+            if (!protoAST->codegen(*tier0)) {
+                return false;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            prototypes.try_emplace(protoAST->getName(), protoAST);
+            return true;
+        },
+        [&](FunctionAST* funcAST) { return addDefinition(funcAST); });
+}
+
+bool TieredJIT::addDefinition(FunctionAST* funcAST) {
+    SymbolID id = funcAST->getProto().getName();
+    auto state = std::make_unique<FunctionState>();
+    state->owner = this;
+    state->funcAST = funcAST;
+    state->name = std::string(symbols->getName(id));
+    TimeScope scope("Tier0", state->name);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (functions.count(id)) {
+            LogErrorV("Cannot redefine function " + state->name);
+            return false;
+        }
+    }
+
+    llvm::Function* body = funcAST->codegen(*tier0);
+    if (!body) {
+        tier0->takeModule(); // drops the declarations made on the way
+        return false;
+    }
+    state->numBranches = ConditionalBranches(*body).size();
+    state->counters.reset(new std::atomic<uint64_t>[2 + 2 * state->numBranches]());
+    Instrument(*body, state->counters.get(), options.hotThreshold, reinterpret_cast<uintptr_t>(&RequestTierUp),
+               state.get());
+
+    // Every caller, recursive calls included, goes through the stub
+    body->setName(state->name + ".tier0");
+    llvm::Function* stub = llvm::Function::Create(body->getFunctionType(), llvm::Function::ExternalLinkage,
+                                                  state->name, &tier0->getModule());
+    body->replaceAllUsesWith(stub);
+    EmitEntryStub(*stub, &state->entry);
+    llvm::verifyFunction(*body);
+    llvm::verifyFunction(*stub);
+
+    if (LogIfError(session->addModule(tier0->takeModule()))) {
+        return false;
+    }
+    auto address = session->lookup(state->name + ".tier0");
+    if (!address) {
+        LogIfError(address.takeError());
+        return false;
+    }
+    state->entry = address->getValue();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    prototypes[id] = &funcAST->getProto();
+    functionsByName[state->name] = state.get();
+    functions[id] = std::move(state);
+    return true;
+}
+
+// Called by tier 0 code on any thread, exactly once per function
+void TieredJIT::RequestTierUp(FunctionState* state) {
+    TieredJIT& jit = *state->owner;
+    {
+        std::lock_guard<std::mutex> lock(jit.mutex);
+        jit.pendingTierUps++;
+    }
+    if (!jit.requests.push(state)) {
+        std::lock_guard<std::mutex> lock(jit.mutex);
+        jit.pendingTierUps--;
+        jit.idle.notify_all();
+    }
+}
+
+void TieredJIT::runCompiler() {
+    // Owns its LLVMContext, so it never shares one with tier 0
+    IRConstructor irConst(symbols, options.compilerOptions);
+    FunctionState* state = nullptr;
+    while (requests.pop(state)) {
+        if (!stopping && !compileTier1(*state, irConst)) {
+            LogErrorV("Failed to recompile " + state->name + ", it stays in tier 0");
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pendingTierUps--;
+        idle.notify_all();
+    }
+}
+
+// The function and, for the inliner, its callees as available_externally
+// copies, like Pipeline does for callees in earlier work items
+bool TieredJIT::compileTier1(FunctionState& state, IRConstructor& irConst) {
+    TimeScope scope("TierUp", state.name);
+    llvm::SmallVector<SymbolID, 16> called;
+    std::vector<PrototypeAST*> declarations;
+    std::vector<FunctionState*> copies;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        collectCallees(state.funcAST->getBody(), called);
+        for (size_t i = 0, numDirect = called.size(); i < numDirect; i++) {
+            auto function = functions.find(called[i]);
+            if (function != functions.end() && function->second.get() != &state) {
+                copies.push_back(function->second.get());
+                collectCallees(function->second->funcAST->getBody(), called);
+            }
+        }
+        for (SymbolID name : called) {
+            if (PrototypeAST* protoAST = prototypes.lookup(name)) {
+                declarations.push_back(protoAST);
+            }
+        }
+    }
+
+    llvm::InstrProfSummaryBuilder summary(llvm::ProfileSummaryBuilder::DefaultCutoffs.vec());
+    bool generated = true;
+    for (PrototypeAST* protoAST : declarations) {
+        generated = generated && protoAST->codegen(irConst);
+    }
+    for (FunctionState* copy : copies) {
+        llvm::Function* func = generated ? copy->funcAST->codegen(irConst) : nullptr;
+        if (!func) {
+            generated = false;
+            break;
+        }
+        func->setLinkage(llvm::GlobalValue::AvailableExternallyLinkage);
+        if (options.profileGuided) {
+            ApplyProfile(*func, copy->readProfile(), summary);
+        }
+    }
+    llvm::Function* func = generated ? state.funcAST->codegen(irConst) : nullptr;
+    // Taken either way, so a failure leaves nothing behind for the next function
+    llvm::orc::ThreadSafeModule module = irConst.takeModule();
+    if (!func) {
+        return false;
+    }
+    // Recursive calls stay in tier 1 without going through the stub
+    func->setName(state.name + ".tier1");
+
+    llvm::SmallVector<char, 0> object;
+    int failed = module.withModuleDo([&](llvm::Module& m) {
+        if (options.profileGuided) {
+            ApplyProfile(*func, state.readProfile(), summary);
+            m.setProfileSummary(summary.getSummary()->getMD(m.getContext()), llvm::ProfileSummary::PSK_Instr);
+        }
+        return CompileModuleToObject(m, options.compilerOptions, object);
+    });
+    if (failed) {
+        return false;
+    }
+    auto buffer = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()),
+                                                       state.name + ".tier1");
+    if (LogIfError(session->addObject(std::move(buffer)))) {
+        return false;
+    }
+    auto address = session->lookup(state.name + ".tier1");
+    if (!address) {
+        LogIfError(address.takeError());
+        return false;
+    }
+    // Callers switch with their next call through the stub
+    state.entry.store(address->getValue(), std::memory_order_release);
+    state.tier = 1;
+    numTierUps++;
+    return true;
+}
+
+TieredJIT::FunctionState* TieredJIT::find(llvm::StringRef name) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return functionsByName.lookup(name);
+}
+
+llvm::Expected<llvm::orc::ExecutorAddr> TieredJIT::lookup(llvm::StringRef name) {
+    return session->lookup(name);
+}
+
+void TieredJIT::waitForTierUps() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idle.wait(lock, [&] { return pendingTierUps == 0; });
+}
+
+int TieredJIT::getTier(llvm::StringRef name) {
+    FunctionState* state = find(name);
+    return state ? state->tier.load() : -1;
+}
+
+FunctionProfile TieredJIT::getProfile(llvm::StringRef name) {
+    FunctionState* state = find(name);
+    return state ? state->readProfile() : FunctionProfile();
+}
+
+size_t TieredJIT::getNumTierUps() const {
+    return numTierUps;
+}
@@ -0,0 +1,170 @@
+#include "../include/Timing.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+namespace timing_detail {
+std::atomic<bool> enabled{false};
+}
+
+static std::mutex eventsMutex;
+static std::vector<TimingEvent> events;
+static std::atomic<uint64_t> originNanos{0};
+static std::atomic<uint32_t> nextThread{0};
+
+static uint64_t WallNanos() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+// CPU time of the calling thread, so concurrent compilations do not add up
+static uint64_t CPUNanos() {
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0;
+    }
+    return static_cast<uint64_t>(time.tv_sec) * 1000000000 + time.tv_nsec;
+}
+
+static uint32_t ThreadIndex() {
+    thread_local uint32_t index = nextThread++;
+    return index;
+}
+
+void EnableTiming() {
+    {
+        std::lock_guard<std::mutex> lock(eventsMutex);
+        events.clear();
+    }
+    originNanos = WallNanos();
+    timing_detail::enabled = true;
+}
+
+void DisableTiming() {
+    timing_detail::enabled = false;
+}
+
+std::vector<TimingEvent> GetTimingEvents() {
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    return events;
+}
+
+void TimeScope::start(llvm::StringRef detail) {
+    this->detail = detail.str();
+    startWall = WallNanos();
+    startCPU = CPUNanos();
+}
+
+void TimeScope::finish() {
+    uint64_t endCPU = CPUNanos();
+    uint64_t endWall = WallNanos();
+    uint64_t origin = originNanos;
+
+    TimingEvent event;
+    event.phase = phase;
+    event.detail = std::move(detail);
+    event.startNanos = startWall > origin ? startWall - origin : 0; // started before a reset
+    event.wallNanos = endWall - startWall;
+    event.cpuNanos = endCPU > startCPU ? endCPU - startCPU : 0;
+    event.thread = ThreadIndex();
+
+    std::lock_guard<std::mutex> lock(eventsMutex);
+    events.push_back(std::move(event));
+}
+
+static std::string FormatRow(const std::string& name, uint64_t count, uint64_t wallNanos, uint64_t cpuNanos) {
+    char row[160];
+    std::snprintf(row, sizeof(row), "  %-32s %8llu %12.3f %12.3f", name.c_str(), static_cast<unsigned long long>(count),
+                  wallNanos / 1e6, cpuNanos / 1e6);
+    return row;
+}
+
+void PrintTimingSummary(std::ostream& os) {
+    std::vector<TimingEvent> snapshot = GetTimingEvents();
+
+    struct Total {
+        uint64_t count = 0;
+        uint64_t wallNanos = 0;
+        uint64_t cpuNanos = 0;
+    };
+    llvm::StringMap<Total> totals;
+    for (const TimingEvent& event : snapshot) {
+        Total& total = totals[event.phase];
+        total.count++;
+        total.wallNanos += event.wallNanos;
+        total.cpuNanos += event.cpuNanos;
+    }
+    std::vector<std::pair<std::string, Total>> phases;
+    for (const auto& entry : totals) {
+        phases.emplace_back(entry.getKey().str(), entry.getValue());
+    }
+    std::sort(phases.begin(), phases.end(),
+              [](const auto& l, const auto& r) { return l.second.wallNanos > r.second.wallNanos; });
+
+    os << "===== Compile time report (nested phases are included in their parents) =====\n";
+    char header[160];
+    std::snprintf(header, sizeof(header), "  %-32s %8s %12s %12s", "Phase", "Count", "Wall (ms)", "CPU (ms)");
+    os << header << '\n';
+    for (const auto& phase : phases) {
+        os << FormatRow(phase.first, phase.second.count, phase.second.wallNanos, phase.second.cpuNanos) << '\n';
+    }
+
+    // The slowest single scopes, typically individual functions
+    std::sort(snapshot.begin(), snapshot.end(),
+              [](const TimingEvent& l, const TimingEvent& r) { return l.wallNanos > r.wallNanos; });
+    snapshot.resize(std::min<size_t>(snapshot.size(), 10));
+    std::snprintf(header, sizeof(header), "  %-32s %8s %12s %12s", "Slowest scopes", "Thread", "Wall (ms)",
+                  "CPU (ms)");
+    os << header << '\n';
+    for (const TimingEvent& event : snapshot) {
+        std::string name = std::string(event.phase) + (event.detail.empty() ? "" : " " + event.detail);
+        os << FormatRow(name, event.thread, event.wallNanos, event.cpuNanos) << '\n';
+    }
+}
+
+bool WriteChromeTrace(const std::string& fileName) {
+    std::error_code error;
+    llvm::raw_fd_ostream file(fileName, error, llvm::sys::fs::OF_Text);
+    if (error) {
+        return false;
+    }
+
+    std::vector<TimingEvent> snapshot = GetTimingEvents();
+    llvm::json::OStream json(file);
+    json.object([&] {
+        json.attributeArray("traceEvents", [&] {
+            for (const TimingEvent& event : snapshot) {
+                // complete events, timestamps in microseconds
+                json.object([&] {
+                    json.attribute("name", event.detail.empty() ? event.phase : event.detail);
+                    json.attribute("cat", event.phase);
+                    json.attribute("ph", "X");
+                    json.attribute("ts", event.startNanos / 1e3);
+                    json.attribute("dur", event.wallNanos / 1e3);
+                    json.attribute("pid", 1);
+                    json.attribute("tid", static_cast<int64_t>(event.thread));
+                    json.attributeObject("args", [&] {
+                        json.attribute("phase", event.phase);
+                        json.attribute("cpu_us", event.cpuNanos / 1e3);
+                    });
+                });
+            }
+        });
+        json.attribute("displayTimeUnit", "ms");
+    });
+    file << '\n';
+    file.close();
+    if (file.has_error()) {
+        file.clear_error();
+        return false;
+    }
+    return true;
+}
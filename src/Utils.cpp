@@ -1,5 +1,7 @@
 #include "../include/Utils.hpp"
+#include "../include/Timing.hpp"
 #include <iostream>
+#include <mutex>
 
 // Object File Compilation
 #include "llvm/Support/TargetSelect.h"
@@ -9,86 +11,311 @@
 #include "llvm/Support/FileSystem.h"
 #include "llvm/IR/LegacyPassManager.h"
 
-// JIT
-#include "llvm/ExecutionEngine/ExecutionEngine.h"
-#include "llvm/ExecutionEngine/MCJIT.h"
+// Parallel code generation
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Object/ArchiveWriter.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Transforms/Utils/SplitModule.h"
+
+// LTO bitcode
+#include "llvm/Analysis/ModuleSummaryAnalysis.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+
 
 llvm::Value * LogErrorV(const std::string error) {
     std::cout << "Error: " << error << std::endl;
     return nullptr;
 }
 
-int CompileToObjectFile(std::shared_ptr<IRConstructor> irConst, std::string fileName) {
-    // Initialize the target registry etc.
-    llvm::InitializeAllTargetInfos();
-    llvm::InitializeAllTargets();
-    llvm::InitializeAllTargetMCs();
-    llvm::InitializeAllAsmParsers();
-    llvm::InitializeAllAsmPrinters();
+bool LogIfError(llvm::Error error) {
+    if (!error) {
+        return false;
+    }
+    LogErrorV(llvm::toString(std::move(error)));
+    return true;
+}
+
+// Creates a target machine for the configuration, nullptr if there is none
+static std::unique_ptr<llvm::TargetMachine> CreateTargetMachine(const TargetConfig& config) {
+    auto targetMachine = config.createTargetMachine();
+    if (!targetMachine) {
+        LogIfError(targetMachine.takeError());
+        return nullptr;
+    }
+    return std::move(*targetMachine);
+}
+
+// Runs the codegen pipeline for the module
+static bool RunCodegen(llvm::TargetMachine& targetMachine, llvm::Module& module,
+                       llvm::SmallVectorImpl<char>& output, llvm::CodeGenFileType fileType) {
+    TimeScope scope("Emit", module.getModuleIdentifier());
+    llvm::raw_svector_ostream outputStream(output);
+    llvm::legacy::PassManager pass;
+
+    if (targetMachine.addPassesToEmitFile(pass, outputStream, nullptr, fileType)) {
+        LogErrorV("TheTargetMachine can't emit a file of this type");
+        return false;
+    }
 
-    auto targetTriple = llvm::sys::getDefaultTargetTriple();
+    pass.run(module);
+    return true;
+}
 
-    std::string error;
-    auto target = llvm::TargetRegistry::lookupTarget(targetTriple, error);
+// Runs codegen for the module into object, or takes it from the cache
+static bool EmitObject(llvm::TargetMachine& targetMachine, llvm::Module& module,
+                       llvm::SmallVectorImpl<char>& object, ObjectFileCache* cache) {
+    std::string cacheKey;
+    if (cache) {
+        cacheKey = ObjectFileCache::ComputeKey(module, targetMachine);
+        if (auto cached = cache->lookup(cacheKey)) {
+            object.assign(cached->getBufferStart(), cached->getBufferEnd());
+            return true;
+        }
+    }
 
-    // Print an error and exit if we couldn't find the requested target.
-    // This generally occurs if we've forgotten to initialise the
-    // TargetRegistry or we have a bogus target triple.
-    if (!target) {
-        llvm::errs() << error;
+    if (!RunCodegen(targetMachine, module, object, llvm::CodeGenFileType::ObjectFile)) {
+        return false;
+    }
+    if (cache) {
+        cache->store(cacheKey, llvm::StringRef(object.data(), object.size()));
+    }
+    return true;
+}
+
+// Writes the optimized module as LTO bitcode. ThinLTO bitcode carries a
+// module summary, which the thin link uses to pick functions to import.
+static void EmitBitcode(llvm::Module& module, LTOMode mode, llvm::SmallVectorImpl<char>& bitcode) {
+    TimeScope scope("Emit", module.getModuleIdentifier());
+    llvm::raw_svector_ostream os(bitcode);
+    if (mode != LTOMode::Thin) {
+        llvm::WriteBitcodeToFile(module, os);
+        return;
+    }
+    llvm::ProfileSummaryInfo profileSummary(module);
+    llvm::ModuleSummaryIndex index = llvm::buildModuleSummaryIndex(module, nullptr, &profileSummary);
+    llvm::WriteBitcodeToFile(module, os, /* ShouldPreserveUseListOrder */ false, &index);
+}
+
+void InitializeTargets() {
+    static std::once_flag initialized;
+    // The target registry is global and not safe to populate concurrently
+    std::call_once(initialized, [] {
+        llvm::InitializeAllTargetInfos();
+        llvm::InitializeAllTargets();
+        llvm::InitializeAllTargetMCs();
+        llvm::InitializeAllAsmParsers();
+        llvm::InitializeAllAsmPrinters();
+    });
+}
+
+int CompileModuleToObject(llvm::Module& module, const CompilerOptions& options, llvm::SmallVectorImpl<char>& object,
+                          ObjectFileCache* cache) {
+    InitializeTargets();
+
+    auto targetMachine = CreateTargetMachine(options.target);
+    if (!targetMachine) {
         return 1;
     }
 
-    auto cpu = "generic";
-    auto features = "";
+    ConfigureModule(module, *targetMachine);
+    OptimizeModule(module, options, targetMachine.get());
+    // Bitcode is cheap to write and the cache only holds object code
+    if (options.lto != LTOMode::None) {
+        EmitBitcode(module, options.lto, object);
+        return 0;
+    }
+    return EmitObject(*targetMachine, module, object, cache) ? 0 : 1;
+}
 
-    llvm::TargetOptions opt;
-    auto targetMachine = target->createTargetMachine(
-        targetTriple, cpu, features, opt, llvm::Reloc::PIC_);
+int CompileToObjectBuffer(std::shared_ptr<IRConstructor> irConst, llvm::SmallVectorImpl<char>& object,
+                          ObjectFileCache* cache) {
+    return CompileModuleToObject(irConst->getModule(), irConst->getOptions(), object, cache);
+}
 
-    irConst->getModule().setDataLayout(targetMachine->createDataLayout());
+int CompileToAssembly(std::shared_ptr<IRConstructor> irConst, llvm::SmallVectorImpl<char>& assembly) {
+    InitializeTargets();
 
+    auto targetMachine = CreateTargetMachine(irConst->getOptions().target);
+    if (!targetMachine) {
+        return 1;
+    }
+
+    // Assembly is final code, so it never takes the LTO pre-link pipeline
+    CompilerOptions options = irConst->getOptions();
+    options.lto = LTOMode::None;
+    ConfigureModule(irConst->getModule(), *targetMachine);
+    OptimizeModule(irConst->getModule(), options, targetMachine.get());
+    return RunCodegen(*targetMachine, irConst->getModule(), assembly, llvm::CodeGenFileType::AssemblyFile) ? 0 : 1;
+}
+
+int CompileToObjectFile(std::shared_ptr<IRConstructor> irConst, std::string fileName, ObjectFileCache* cache) {
     std::error_code erroCode;
     llvm::raw_fd_ostream dest(fileName, erroCode, llvm::sys::fs::OF_None);
     
     if (erroCode) {
-        llvm::errs() << "Could not open file: " << erroCode.message();
+        LogErrorV("Could not open file: " + erroCode.message());
         return 1;
     }
 
-    llvm::legacy::PassManager pass;
-    auto fileType = llvm::CodeGenFileType::ObjectFile;
+    llvm::SmallVector<char, 0> object;
+    if (CompileToObjectBuffer(irConst, object, cache) != 0) {
+        return 1;
+    }
+    dest << llvm::StringRef(object.data(), object.size());
+    dest.flush();
 
-    if (targetMachine->addPassesToEmitFile(pass, dest, nullptr, fileType)) {
-        llvm::errs() << "TheTargetMachine can't emit a file of this type";
+    std::cout << "Wrote " << fileName << std::endl;
+    return 0;
+}
+
+int CompileToArchive(std::shared_ptr<IRConstructor> irConst, std::string fileName, unsigned numPartitions,
+                     unsigned numThreads, ObjectFileCache* cache) {
+    if (irConst->getOptions().lto != LTOMode::None) {
+        LogErrorV("LTO bitcode is emitted as a whole, use CompileToObjectFile");
         return 1;
     }
+    InitializeTargets();
 
-    pass.run(irConst->getModule());
-    dest.flush();
+    auto targetMachine = CreateTargetMachine(irConst->getOptions().target);
+    if (!targetMachine) {
+        return 1;
+    }
+    llvm::Module& module = irConst->getModule();
+    ConfigureModule(module, *targetMachine);
+    // Optimized before splitting so the inliner still sees the whole module
+    OptimizeModule(module, irConst->getOptions(), targetMachine.get());
+
+    // The partitioning only depends on the module and numPartitions. Each part
+    // is serialized so it can be compiled in a context of its own.
+    std::vector<llvm::SmallVector<char, 0>> bitcode;
+    llvm::SplitModule(module, std::max(numPartitions, 1u), [&](std::unique_ptr<llvm::Module> part) {
+        bitcode.emplace_back();
+        llvm::raw_svector_ostream os(bitcode.back());
+        llvm::WriteBitcodeToFile(*part, os);
+    });
+
+    // TargetMachines are not thread-safe, every part gets its own
+    std::vector<std::unique_ptr<llvm::TargetMachine>> targetMachines;
+    for (size_t i = 0; i < bitcode.size(); i++) {
+        targetMachines.push_back(CreateTargetMachine(irConst->getOptions().target));
+        if (!targetMachines.back()) {
+            return 1;
+        }
+    }
 
-    llvm::outs() << "Wrote " << fileName << "\n";
+    std::vector<llvm::SmallVector<char, 0>> objects(bitcode.size());
+    std::vector<char> succeeded(bitcode.size(), false);
+    {
+        llvm::ThreadPool pool(llvm::hardware_concurrency(numThreads));
+        for (size_t i = 0; i < bitcode.size(); i++) {
+            pool.async([&, i] {
+                llvm::LLVMContext context;
+                std::string partName = "part" + std::to_string(i); // module name in timing reports
+                llvm::MemoryBufferRef buffer(llvm::StringRef(bitcode[i].data(), bitcode[i].size()), partName);
+                auto part = llvm::parseBitcodeFile(buffer, context);
+                if (!part) {
+                    llvm::consumeError(part.takeError());
+                    return;
+                }
+                succeeded[i] = EmitObject(*targetMachines[i], **part, objects[i], cache);
+            });
+        }
+        pool.wait();
+    }
+
+    std::vector<std::string> memberNames;
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (!succeeded[i]) {
+            LogErrorV("Code generation failed for part " + std::to_string(i));
+            return 1;
+        }
+        memberNames.push_back("part" + std::to_string(i) + ".o");
+    }
+    if (WriteObjectArchive(fileName, memberNames, objects, targetMachine->getTargetTriple()) != 0) {
+        return 1;
+    }
+
+    std::cout << "Wrote " << fileName << " (" << objects.size() << " parts)" << std::endl;
     return 0;
-} 
+}
 
-llvm::GenericValue RunParsedFunction(std::shared_ptr<IRConstructor> irConst, const std::string functionName) {
+int WriteObjectArchive(const std::string& fileName, llvm::ArrayRef<std::string> memberNames,
+                       llvm::ArrayRef<llvm::SmallVector<char, 0>> objects, const llvm::Triple& triple) {
+    std::vector<llvm::NewArchiveMember> members;
+    for (size_t i = 0; i < objects.size(); i++) {
+        llvm::StringRef object(objects[i].data(), objects[i].size());
+        members.emplace_back(llvm::MemoryBufferRef(object, memberNames[i]));
+    }
 
-    std::string errorStr;
-    llvm::ExecutionEngine *executionEngine = 
-        llvm::EngineBuilder(std::move(irConst->module))
-            .setErrorStr(&errorStr)
-            .setOptLevel(llvm::CodeGenOptLevel::None)
-            .create();
+    // Deterministic mode zeroes timestamps, owners and permissions
+    auto kind = triple.isOSDarwin() ? llvm::object::Archive::K_DARWIN : llvm::object::Archive::K_GNU;
+    if (LogIfError(llvm::writeArchive(fileName, members, llvm::SymtabWritingMode::NormalSymtab, kind,
+                                      /* Deterministic */ true, /* Thin */ false))) {
+        return 1;
+    }
+    return 0;
+}
 
-    if (!executionEngine) {
-        llvm::errs() << "Failed to construct ExecutionEngine: " << errorStr << "\n";
+// Most arguments RunParsedFunction can pass, one typed call per count below
+static const size_t MaxRunArguments = 4;
+
+static llvm::Error RunError(const llvm::Twine& message) {
+    return llvm::make_error<llvm::StringError>(message, llvm::inconvertibleErrorCode());
+}
+
+template <typename Signature, typename... Args>
+static llvm::Expected<double> CallTyped(JITSession& jit, const std::string& functionName, Args... args) {
+    auto function = jit.lookup<Signature>(functionName);
+    if (!function) {
+        return function.takeError();
     }
+    return (*function)(args...);
+}
 
-    llvm::Function *func = executionEngine->FindFunctionNamed("test");
-    if (!func) {
-        llvm::errs() << "Function not found in module!\n";
+// Calls a JIT'd function of type double(double, ...) with args.size() arguments
+static llvm::Expected<double> CallWithArgs(JITSession& jit, const std::string& functionName,
+                                           const std::vector<double>& args) {
+    switch (args.size()) {
+        case 0:
+            return CallTyped<double()>(jit, functionName);
+        case 1:
+            return CallTyped<double(double)>(jit, functionName, args[0]);
+        case 2:
+            return CallTyped<double(double, double)>(jit, functionName, args[0], args[1]);
+        case 3:
+            return CallTyped<double(double, double, double)>(jit, functionName, args[0], args[1], args[2]);
+        default:
+            return CallTyped<double(double, double, double, double)>(jit, functionName, args[0], args[1], args[2],
+                                                                     args[3]);
     }
+}
 
-    std::vector<llvm::GenericValue> noArgs;
-    return executionEngine->runFunction(func, noArgs);
-}
\ No newline at end of file
+llvm::Expected<double> RunParsedFunction(JITSession& jit, std::shared_ptr<IRConstructor> irConst,
+                                         const std::string functionName, const std::vector<double>& args) {
+    // Checked before the module leaves irConst, which is left as it was on failure
+    if (args.size() > MaxRunArguments) {
+        return RunError("Functions with more than " + llvm::Twine(MaxRunArguments) + " arguments cannot be run");
+    }
+    llvm::Function* func = irConst->getModule().getFunction(functionName);
+    if (!func || func->empty()) {
+        return RunError("Function " + functionName + " not found in module");
+    }
+    if (func->arg_size() != args.size()) {
+        return RunError("Function " + functionName + " called with an unequal number of arguments");
+    }
+
+    if (llvm::Error error = jit.addModule(irConst->takeModule())) {
+        return std::move(error);
+    }
+    return CallWithArgs(jit, functionName, args);
+}
+
+llvm::Expected<double> RunParsedFunction(std::shared_ptr<IRConstructor> irConst, const std::string functionName,
+                                         const std::vector<double>& args) {
+    auto jit = JITSession::Create();
+    if (!jit) {
+        return jit.takeError();
+    }
+    return RunParsedFunction(**jit, irConst, functionName, args);
+}
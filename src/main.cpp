@@ -1,13 +1,87 @@
+#include <cstdlib>
 #include <string>
 #include <iostream>
 
-#include "../include/Parser.hpp"
-#include "../include/Utils.hpp"
+#include "../include/Driver.hpp"
+#include "../include/Timing.hpp"
 
+static bool EndsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
 
+// compiler [options] file... [-o output.o|output.a] [-j jobs]
 int main(int argc, char **argv) {
-    const std::string input = "def test(x) (1+2+x)*(x+(1+2))";
-    Parser parser(input);
-    parser.parse();
-    CompileToObjectFile(parser.GetIRConstructor(), "build/output.o");
-}
\ No newline at end of file
+    DriverOptions driverOptions;
+    CompilerOptions& options = driverOptions.compilerOptions;
+    bool timeReport = false;
+    std::string traceFile;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-O0") {
+            options.optLevel = OptLevel::O0;
+        } else if (arg == "-O1") {
+            options.optLevel = OptLevel::O1;
+        } else if (arg == "-O2") {
+            options.optLevel = OptLevel::O2;
+        } else if (arg == "-O3") {
+            options.optLevel = OptLevel::O3;
+        } else if (arg.rfind("-mcpu=", 0) == 0) {
+            // e.g. -mcpu=generic for portable objects, the default is the host CPU
+            options.target.cpu = arg.substr(6);
+        } else if (arg.rfind("-mattr=", 0) == 0) {
+            options.target.features = arg.substr(7);
+        } else if (arg == "-ffast-math") {
+            options.fpMode = FPMode::Fast;
+        } else if (arg == "-ffp-contract=fast") {
+            options.fpMode = FPMode::Contract;
+        } else if (arg == "-flto" || arg == "-flto=full") {
+            options.lto = LTOMode::Full;
+        } else if (arg == "-flto=thin") {
+            options.lto = LTOMode::Thin;
+        } else if (arg == "-fno-ast-opt") {
+            options.optimizeAST = false;
+        } else if (arg == "-ftime-report") {
+            timeReport = true;
+        } else if (arg.rfind("-ftime-trace=", 0) == 0) {
+            traceFile = arg.substr(13);
+        } else if (arg == "-debug-pass-manager") {
+            options.debugPassManager = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            driverOptions.output = argv[++i];
+        } else if (arg == "-j" && i + 1 < argc) {
+            driverOptions.jobs = std::strtoul(argv[++i], nullptr, 10);
+        } else if (arg.rfind("-j", 0) == 0 && arg.size() > 2) {
+            driverOptions.jobs = std::strtoul(arg.c_str() + 2, nullptr, 10);
+        } else if (arg.empty() || arg[0] != '-') {
+            driverOptions.inputs.push_back(arg);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (driverOptions.inputs.empty()) {
+        std::cerr << "Usage: " << argv[0] << " [options] file... [-o output.o|output.a] [-j jobs]" << std::endl;
+        return 1;
+    }
+    // An archive keeps one object per file, an object file links them
+    if (EndsWith(driverOptions.output, ".a")) {
+        driverOptions.outputKind = OutputKind::Archive;
+    }
+
+    if (timeReport || !traceFile.empty()) {
+        EnableTiming();
+    }
+
+    Driver driver(driverOptions);
+    int result = driver.run();
+
+    if (timeReport) {
+        driver.printFileTimings(std::cerr);
+        PrintTimingSummary(std::cerr);
+    }
+    if (!traceFile.empty() && !WriteChromeTrace(traceFile)) {
+        std::cerr << "Could not write " << traceFile << std::endl;
+        return 1;
+    }
+    return result;
+}
@@ -0,0 +1,124 @@
+#ifndef TESTUTILS_H
+#define TESTUTILS_H
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/ObjectFile.h"
+
+#include "../include/Parser.hpp"
+#include "../include/Utils.hpp"
+
+// Discards everything written to std::cout and std::cerr while in scope,
+// e.g. what thousands of parsers report about their definitions
+class SilenceOutput {
+    struct NullBuffer : std::streambuf {
+        int overflow(int c) override { return c; }
+    } nullBuffer;
+    std::streambuf* previousOut;
+    std::streambuf* previousErr;
+
+public:
+    SilenceOutput() : previousOut(std::cout.rdbuf(&nullBuffer)), previousErr(std::cerr.rdbuf(&nullBuffer)) {}
+    ~SilenceOutput() {
+        std::cout.rdbuf(previousOut);
+        std::cerr.rdbuf(previousErr);
+    }
+};
+
+// The value, or an empty one after logging why it could not be created
+template <typename T>
+T TakeOrNull(llvm::Expected<T> value) {
+    if (!value) {
+        LogIfError(value.takeError());
+        return T();
+    }
+    return std::move(*value);
+}
+
+// The result of a run, or NaN after logging why it failed, which equals no expected value
+inline double ValueOrNaN(llvm::Expected<double> result) {
+    if (!result) {
+        LogIfError(result.takeError());
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    return *result;
+}
+
+// Runs function of source in a JIT session of its own, NaN if anything failed.
+// At O0 by default, since the LLVM pipeline is rarely what a test is about.
+inline double Evaluate(const std::string& source, const std::string& function, const std::vector<double>& args,
+                       OptLevel level = OptLevel::O0, bool optimizeAST = true) {
+    JITOptions options;
+    options.compilerOptions.optLevel = level;
+    options.compilerOptions.optimizeAST = optimizeAST;
+    auto jit = JITSession::Create(options);
+    if (!jit) {
+        LogIfError(jit.takeError());
+        return std::numeric_limits<double>::quiet_NaN();
+    }
+    Parser parser(source, options.compilerOptions);
+    parser.parse();
+    return ValueOrNaN(RunParsedFunction(**jit, parser.GetIRConstructor(), function, args));
+}
+
+// Names of the functions an object file defines, sorted
+inline std::vector<std::string> DefinedFunctions(llvm::StringRef object) {
+    std::vector<std::string> names;
+    auto file = llvm::object::ObjectFile::createObjectFile(llvm::MemoryBufferRef(object, "object"));
+    if (!file) {
+        LogIfError(file.takeError());
+        return names;
+    }
+    for (const auto& symbol : (*file)->symbols()) {
+        auto type = symbol.getType();
+        auto flags = symbol.getFlags();
+        auto name = symbol.getName();
+        if (type && flags && name && *type == llvm::object::SymbolRef::ST_Function &&
+            !(*flags & llvm::object::SymbolRef::SF_Undefined)) {
+            names.push_back(name->str());
+        }
+        LogIfError(type.takeError());
+        LogIfError(flags.takeError());
+        LogIfError(name.takeError());
+    }
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+struct ArchiveMember {
+    std::string name;
+    llvm::StringRef object; // points into the archive's data
+};
+
+// The members of an archive in order, none if it cannot be read
+inline std::vector<ArchiveMember> ArchiveMembers(llvm::StringRef data) {
+    std::vector<ArchiveMember> members;
+    auto archive = llvm::object::Archive::create(llvm::MemoryBufferRef(data, "archive"));
+    if (!archive) {
+        LogIfError(archive.takeError());
+        return members;
+    }
+    llvm::Error error = llvm::Error::success();
+    for (const auto& child : (*archive)->children(error)) {
+        auto name = child.getName();
+        auto object = child.getMemoryBufferRef();
+        if (!name || !object) {
+            LogIfError(name.takeError());
+            LogIfError(object.takeError());
+            continue;
+        }
+        members.push_back({name->str(), object->getBuffer()});
+    }
+    if (LogIfError(std::move(error))) {
+        members.clear();
+    }
+    return members;
+}
+
+#endif
@@ -0,0 +1,63 @@
+#include "SourceGenerator.hpp"
+
+namespace {
+// SplitMix64, unlike <random> distributions it is the same on every platform
+class Random {
+    uint64_t state;
+
+public:
+    explicit Random(uint64_t seed) : state(seed) {}
+
+    uint64_t next() {
+        uint64_t z = (state += 0x9e3779b97f4a7c15);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+        return z ^ (z >> 31);
+    }
+
+    unsigned below(unsigned bound) { return next() % bound; }
+};
+} // namespace
+
+static void AppendOperand(std::string& source, Random& random, size_t function, unsigned callPercent) {
+    if (function > 0 && random.below(100) < callPercent) {
+        source += "f" + std::to_string(random.below(function)) + "(a, b)";
+        return;
+    }
+    switch (random.below(3)) {
+        case 0:
+            source += 'a';
+            break;
+        case 1:
+            source += 'b';
+            break;
+        default:
+            source += std::to_string(random.below(100));
+            break;
+    }
+}
+
+std::string GenerateSource(const SourceShape& shape) {
+    Random random(shape.seed);
+    std::string source;
+    source.reserve(shape.numFunctions * (24 + shape.depth * 8));
+
+    std::string body;
+    for (size_t i = 0; i < shape.numFunctions; i++) {
+        body.clear();
+        AppendOperand(body, random, i, shape.callPercent);
+        for (unsigned level = 0; level < shape.depth; level++) {
+            char op = "+-*"[random.below(3)];
+            std::string operand;
+            AppendOperand(operand, random, i, shape.callPercent);
+            // alternate sides so both operands of the parser's loop get nested
+            if (random.below(2)) {
+                body = "(" + body + " " + op + " " + operand + ")";
+            } else {
+                body = "(" + operand + " " + op + " " + body + ")";
+            }
+        }
+        source += "def f" + std::to_string(i) + "(a b) " + body + "\n";
+    }
+    return source;
+}
@@ -0,0 +1,21 @@
+#ifndef SOURCEGENERATOR_H
+#define SOURCEGENERATOR_H
+
+#include <cstdint>
+#include <string>
+
+// Shape of a synthetic Kaleidoscope program. Every function takes (a b) and
+// its body is a chain of depth binary operators, so the body size grows
+// linearly with depth and so does the nesting of parentheses.
+struct SourceShape {
+    size_t numFunctions = 100;
+    unsigned depth = 8;
+    unsigned callPercent = 20; // chance that an operand calls an earlier function
+    uint64_t seed = 1;
+};
+
+// Functions are named f0, f1, ... The output only depends on the shape, so
+// results of different runs and machines can be compared.
+std::string GenerateSource(const SourceShape& shape);
+
+#endif // SOURCEGENERATOR_H
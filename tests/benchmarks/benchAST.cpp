@@ -0,0 +1,124 @@
+#include "benchmark/benchmark.h"
+
+#include <memory>
+
+#include "../../include/AST.hpp"
+
+// Mirror of the previous AST layout: heap allocated nodes linked through
+// unique_ptr and dispatched through virtual calls.
+namespace legacy {
+struct ExprAST {
+    virtual ~ExprAST() = default;
+    virtual double eval(double x) const = 0;
+};
+
+struct NumberExprAST : ExprAST {
+    double value;
+    NumberExprAST(double value) : value(value) {}
+    double eval(double) const override { return value; }
+};
+
+struct VariableExprAST : ExprAST {
+    double eval(double x) const override { return x; }
+};
+
+struct BinaryExprAST : ExprAST {
+    char op;
+    std::unique_ptr<ExprAST> LHS, RHS;
+    BinaryExprAST(char op, std::unique_ptr<ExprAST> LHS, std::unique_ptr<ExprAST> RHS)
+        : op(op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+    double eval(double x) const override {
+        double l = LHS->eval(x);
+        double r = RHS->eval(x);
+        return op == '+' ? l + r : op == '-' ? l - r : l * r;
+    }
+};
+
+// Balanced expression with `leaves` leaves, alternating x and literals
+std::unique_ptr<ExprAST> Build(int leaves, int& counter) {
+    if (leaves == 1) {
+        if (counter++ % 2) {
+            return std::make_unique<VariableExprAST>();
+        }
+        return std::make_unique<NumberExprAST>(counter);
+    }
+    auto lhs = Build(leaves / 2, counter);
+    auto rhs = Build(leaves - leaves / 2, counter);
+    return std::make_unique<BinaryExprAST>("+-*"[leaves % 3], std::move(lhs), std::move(rhs));
+}
+} // namespace legacy
+
+static ExprAST* Build(ASTArena& arena, SymbolID x, int leaves, int& counter) {
+    if (leaves == 1) {
+        if (counter++ % 2) {
+            return arena.create<VariableExprAST>(x);
+        }
+        return arena.create<NumberExprAST>(counter);
+    }
+    ExprAST* lhs = Build(arena, x, leaves / 2, counter);
+    ExprAST* rhs = Build(arena, x, leaves - leaves / 2, counter);
+    return arena.create<BinaryExprAST>("+-*"[leaves % 3], lhs, rhs);
+}
+
+static double Eval(const ExprAST& expr, double x) {
+    switch (expr.getKind()) {
+        case ExprAST::Number:
+            return llvm::cast<NumberExprAST>(expr).getValue();
+        case ExprAST::Variable:
+            return x;
+        case ExprAST::Binary: {
+            auto& binExpr = llvm::cast<BinaryExprAST>(expr);
+            double l = Eval(binExpr.getLHSRef(), x);
+            double r = Eval(binExpr.getRHSRef(), x);
+            char op = binExpr.getOp();
+            return op == '+' ? l + r : op == '-' ? l - r : l * r;
+        }
+        case ExprAST::Call:
+        case ExprAST::If:
+        case ExprAST::For:
+            return 0.0;
+    }
+    return 0.0;
+}
+
+static void BM_TraverseVirtualTree(benchmark::State& state) {
+    int counter = 0;
+    auto root = legacy::Build(state.range(0), counter);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(root->eval(1.0));
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * state.range(0) - 1));
+}
+BENCHMARK(BM_TraverseVirtualTree)->RangeMultiplier(8)->Range(1 << 10, 1 << 19);
+
+static void BM_TraverseArenaAST(benchmark::State& state) {
+    ASTArena arena;
+    int counter = 0;
+    ExprAST* root = Build(arena, 0, state.range(0), counter);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Eval(*root, 1.0));
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * state.range(0) - 1));
+    state.counters["arena_bytes"] = arena.getBytesUsed();
+}
+BENCHMARK(BM_TraverseArenaAST)->RangeMultiplier(8)->Range(1 << 10, 1 << 19);
+
+static void BM_BuildAndFreeVirtualTree(benchmark::State& state) {
+    for (auto _ : state) {
+        int counter = 0;
+        auto root = legacy::Build(state.range(0), counter);
+        benchmark::DoNotOptimize(root.get());
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * state.range(0) - 1));
+}
+BENCHMARK(BM_BuildAndFreeVirtualTree)->RangeMultiplier(8)->Range(1 << 10, 1 << 19);
+
+static void BM_BuildAndFreeArenaAST(benchmark::State& state) {
+    for (auto _ : state) {
+        ASTArena arena;
+        int counter = 0;
+        benchmark::DoNotOptimize(Build(arena, 0, state.range(0), counter));
+    }
+    state.SetItemsProcessed(state.iterations() * (2 * state.range(0) - 1));
+}
+BENCHMARK(BM_BuildAndFreeArenaAST)->RangeMultiplier(8)->Range(1 << 10, 1 << 19);
@@ -0,0 +1,89 @@
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+
+using Scalar = double (*)(double, double);
+using Kernel = void (*)(const double*, const double*, double*, size_t);
+
+// JIT compiles f and its batch kernel once per benchmark
+struct CompiledBatch {
+    std::unique_ptr<JITSession> jit;
+    Scalar scalar = nullptr;
+    Kernel kernel = nullptr;
+
+    CompiledBatch() {
+        auto session = JITSession::Create();
+        if (!session) {
+            LogIfError(session.takeError());
+            return;
+        }
+        jit = std::move(*session);
+
+        Parser parser("def f(x y) x * y + x - 1");
+        parser.parse();
+        auto irConst = parser.GetIRConstructor();
+        irConst->createBatchKernel("f");
+        if (LogIfError(jit->addModule(irConst->takeModule()))) {
+            return;
+        }
+        auto f = jit->lookup("f");
+        auto fBatch = jit->lookup("f_batch");
+        if (!f || !fBatch) {
+            LogIfError(f.takeError());
+            LogIfError(fBatch.takeError());
+            return;
+        }
+        scalar = f->toPtr<Scalar>();
+        kernel = fBatch->toPtr<Kernel>();
+    }
+};
+
+static void Fill(std::vector<double>& x, std::vector<double>& y) {
+    for (size_t i = 0; i < x.size(); i++) {
+        x[i] = i * 0.25;
+        y[i] = 1.0 - i * 0.5;
+    }
+}
+
+// One call through the function pointer per row
+static void BM_ScalarCallPerRow(benchmark::State& state) {
+    CompiledBatch compiled;
+    if (!compiled.scalar) {
+        state.SkipWithError("JIT compilation failed");
+        return;
+    }
+    size_t n = state.range(0);
+    std::vector<double> x(n), y(n), out(n);
+    Fill(x, y);
+    Scalar f = compiled.scalar;
+    benchmark::DoNotOptimize(f);
+    for (auto _ : state) {
+        for (size_t i = 0; i < n; i++) {
+            out[i] = f(x[i], y[i]);
+        }
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_ScalarCallPerRow)->RangeMultiplier(16)->Range(1 << 10, 1 << 22);
+
+// f inlined into a vectorized loop
+static void BM_BatchKernel(benchmark::State& state) {
+    CompiledBatch compiled;
+    if (!compiled.kernel) {
+        state.SkipWithError("JIT compilation failed");
+        return;
+    }
+    size_t n = state.range(0);
+    std::vector<double> x(n), y(n), out(n);
+    Fill(x, y);
+    for (auto _ : state) {
+        compiled.kernel(x.data(), y.data(), out.data(), n);
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+BENCHMARK(BM_BatchKernel)->RangeMultiplier(16)->Range(1 << 10, 1 << 22);
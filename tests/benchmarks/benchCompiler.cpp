@@ -0,0 +1,225 @@
+#include "benchmark/benchmark.h"
+
+#include <chrono>
+
+#include "../../include/CompilerSession.hpp"
+#include "../../include/Lexer.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Pipeline.hpp"
+#include "../../include/Timing.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+#include "SourceGenerator.hpp"
+
+// Total wall time of one phase since timing was last enabled
+static uint64_t PhaseNanos(const char* phase) {
+    uint64_t total = 0;
+    for (const TimingEvent& event : GetTimingEvents()) {
+        if (std::string(event.phase) == phase) {
+            total += event.wallNanos;
+        }
+    }
+    return total;
+}
+
+static SourceShape Shape(size_t numFunctions, unsigned depth = 8) {
+    SourceShape shape;
+    shape.numFunctions = numFunctions;
+    shape.depth = depth;
+    return shape;
+}
+
+static void BM_Lexer(benchmark::State& state) {
+    std::string source = GenerateSource(Shape(state.range(0)));
+    for (auto _ : state) {
+        Lexer lexer(ViewSource(source));
+        size_t tokens = 0;
+        while (lexer.gettok().type != tok_eof) {
+            tokens++;
+        }
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_Lexer)->RangeMultiplier(10)->Range(10, 100000);
+
+// Parser and codegen run interleaved, the timing scopes tell them apart.
+// Counts AST nodes per second of parsing, lexing included.
+static void BM_Parser(benchmark::State& state, unsigned depth) {
+    std::string source = GenerateSource(Shape(state.range(0), depth));
+    SilenceOutput silence;
+    size_t nodes = 0;
+    for (auto _ : state) {
+        EnableTiming();
+        Parser parser(ViewSource(source));
+        parser.parse();
+        DisableTiming();
+        state.SetIterationTime(PhaseNanos("Parse") / 1e9);
+        nodes += parser.GetASTStats().nodesBefore;
+    }
+    state.SetItemsProcessed(nodes);
+}
+BENCHMARK_CAPTURE(BM_Parser, functions, 8)->RangeMultiplier(10)->Range(10, 100000)->UseManualTime();
+
+// One function with a body nested depth levels deep
+static void BM_ParseDeepExpression(benchmark::State& state) {
+    std::string source = GenerateSource(Shape(1, state.range(0)));
+    SilenceOutput silence;
+    for (auto _ : state) {
+        EnableTiming();
+        Parser parser(ViewSource(source));
+        parser.parse();
+        DisableTiming();
+        state.SetIterationTime(PhaseNanos("Parse") / 1e9);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_ParseDeepExpression)->RangeMultiplier(4)->Range(16, 4096)->UseManualTime();
+
+// IR construction, items are functions
+static void BM_Codegen(benchmark::State& state) {
+    std::string source = GenerateSource(Shape(state.range(0)));
+    SilenceOutput silence;
+    for (auto _ : state) {
+        EnableTiming();
+        Parser parser(ViewSource(source));
+        parser.parse();
+        DisableTiming();
+        state.SetIterationTime(PhaseNanos("Codegen") / 1e9);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Codegen)->RangeMultiplier(10)->Range(10, 100000)->UseManualTime();
+
+// The module pipeline over the whole program, items are functions
+static void BM_Optimize(benchmark::State& state) {
+    std::string source = GenerateSource(Shape(state.range(0)));
+    CompilerOptions options;
+    options.optLevel = static_cast<OptLevel>(state.range(1));
+    auto targetMachine = options.target.createTargetMachine();
+    if (!targetMachine) {
+        LogIfError(targetMachine.takeError());
+        state.SkipWithError("no target machine");
+        return;
+    }
+    SilenceOutput silence;
+    for (auto _ : state) {
+        state.PauseTiming();
+        Parser parser(ViewSource(source), std::make_shared<StringInterner>(), options);
+        parser.parse();
+        state.ResumeTiming();
+        OptimizeModule(parser.GetIRConstructor()->getModule(), options, targetMachine->get());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Optimize)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {static_cast<int>(OptLevel::O1), static_cast<int>(OptLevel::O2)}})
+    ->Unit(benchmark::kMillisecond);
+
+// From handing the parsed module to a fresh JIT until the last function returned
+static void BM_JITTimeToFirstCall(benchmark::State& state) {
+    size_t numFunctions = state.range(0);
+    std::string source = GenerateSource(Shape(numFunctions));
+    std::string last = "f" + std::to_string(numFunctions - 1);
+    JITOptions options;
+    options.lazy = state.range(1);
+    SilenceOutput silence;
+    for (auto _ : state) {
+        Parser parser(ViewSource(source));
+        parser.parse();
+        auto jit = JITSession::Create(options);
+        if (!jit) {
+            LogIfError(jit.takeError());
+            state.SkipWithError("JIT creation failed");
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        auto result = RunParsedFunction(**jit, parser.GetIRConstructor(), last, {1.0, 2.0});
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (!result) {
+            LogIfError(result.takeError());
+            state.SkipWithError("Running the last function failed");
+            return;
+        }
+        benchmark::DoNotOptimize(*result);
+        state.SetIterationTime(elapsed.count());
+    }
+}
+BENCHMARK(BM_JITTimeToFirstCall)
+    ->ArgsProduct({{10, 100, 1000, 10000}, {0, 1}})
+    ->ArgNames({"functions", "lazy"})
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Source to object code of independent definitions on one thread, the
+// baseline for BM_Pipeline. Items are functions.
+static void BM_SequentialCompile(benchmark::State& state) {
+    SourceShape shape = Shape(state.range(0));
+    shape.callPercent = 0;
+    std::string source = GenerateSource(shape);
+    SilenceOutput silence;
+    for (auto _ : state) {
+        Parser parser(ViewSource(source));
+        parser.parse();
+        llvm::SmallVector<char, 0> object;
+        CompileToObjectBuffer(parser.GetIRConstructor(), object);
+        benchmark::DoNotOptimize(object.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SequentialCompile)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+// The same through the lexer, parser and codegen stages of Pipeline, should
+// scale with the number of workers
+static void BM_Pipeline(benchmark::State& state) {
+    SourceShape shape = Shape(state.range(0));
+    shape.callPercent = 0;
+    std::string source = GenerateSource(shape);
+    PipelineOptions options;
+    options.jobs = state.range(1);
+    for (auto _ : state) {
+        Pipeline pipeline(options);
+        if (!pipeline.compile(ViewSource(source))) {
+            state.SkipWithError("pipeline failed");
+            return;
+        }
+        benchmark::DoNotOptimize(pipeline.getObjects().data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Pipeline)
+    ->ArgsProduct({{1000, 10000}, {1, 2, 4, 8}})
+    ->ArgNames({"functions", "jobs"})
+    ->UseRealTime()
+    ->Unit(benchmark::kMillisecond);
+
+// Latency of one small program from source to object code. The cold path
+// sets up a target machine, pass pipelines and a context per call like
+// CompileToObjectBuffer, the warm path keeps them in a CompilerSession.
+static void BM_SnippetLatency(benchmark::State& state, bool warm) {
+    std::string source = GenerateSource(Shape(state.range(0)));
+    auto session = CompilerSession::Create();
+    if (!session) {
+        LogIfError(session.takeError());
+        state.SkipWithError("no compiler session");
+        return;
+    }
+    for (auto _ : state) {
+        llvm::SmallVector<char, 0> object;
+        if (warm) {
+            (*session)->addSource(source);
+            (*session)->compile(object);
+            (*session)->reset();
+        } else {
+            Parser parser(ViewSource(source));
+            IRConstructor& irConst = *parser.GetIRConstructor();
+            parser.ParseDefinitions([&](PrototypeAST* protoAST) { return protoAST->codegen(irConst) != nullptr; },
+                                    [&](FunctionAST* fnAST) { return fnAST->codegen(irConst) != nullptr; });
+            CompileToObjectBuffer(parser.GetIRConstructor(), object);
+        }
+        benchmark::DoNotOptimize(object.data());
+    }
+}
+BENCHMARK_CAPTURE(BM_SnippetLatency, cold, false)->Arg(1)->Arg(10)->Unit(benchmark::kMicrosecond);
+BENCHMARK_CAPTURE(BM_SnippetLatency, warm, true)->Arg(1)->Arg(10)->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,107 @@
+#include "benchmark/benchmark.h"
+
+#include <vector>
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+
+// The function tests/objects/testOutput.cpp links against
+static const std::string testSource = "def test(x) (1+2+x)*(x+(1+2))";
+
+// C++ equivalent, kept out of line so both sides pay for a call
+__attribute__((noinline)) static double BaselineTest(double x) {
+    return (1 + 2 + x) * (x + (1 + 2));
+}
+
+using Function = double (*)(double);
+
+// Compiles source into a new session and returns a native pointer to function
+template <typename Signature>
+static Signature* Compile(std::unique_ptr<JITSession>& jit, const std::string& source, const std::string& function,
+                          OptLevel level) {
+    JITOptions options;
+    options.compilerOptions.optLevel = level;
+    auto session = JITSession::Create(options);
+    if (!session) {
+        LogIfError(session.takeError());
+        return nullptr;
+    }
+    jit = std::move(*session);
+
+    Parser parser(source, options.compilerOptions);
+    parser.parse();
+    if (LogIfError(jit->addModule(parser.GetIRConstructor()->takeModule()))) {
+        return nullptr;
+    }
+    auto pointer = jit->lookup<Signature>(function);
+    if (!pointer) {
+        LogIfError(pointer.takeError());
+        return nullptr;
+    }
+    return *pointer;
+}
+
+static void RunOverInputs(benchmark::State& state, Function function) {
+    std::vector<double> inputs(4096);
+    for (size_t i = 0; i < inputs.size(); i++) {
+        inputs[i] = i * 0.5;
+    }
+    benchmark::DoNotOptimize(function);
+    for (auto _ : state) {
+        double sum = 0.0;
+        for (double x : inputs) {
+            sum += function(x);
+        }
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * inputs.size());
+}
+
+static void BM_GeneratedTest(benchmark::State& state) {
+    std::unique_ptr<JITSession> jit;
+    Function test = Compile<double(double)>(jit, testSource, "test", static_cast<OptLevel>(state.range(0)));
+    if (!test) {
+        state.SkipWithError("JIT compilation failed");
+        return;
+    }
+    RunOverInputs(state, test);
+}
+BENCHMARK(BM_GeneratedTest)->DenseRange(static_cast<int>(OptLevel::O0), static_cast<int>(OptLevel::O3));
+
+static void BM_CppBaselineTest(benchmark::State& state) {
+    RunOverInputs(state, &BaselineTest);
+}
+BENCHMARK(BM_CppBaselineTest);
+
+__attribute__((noinline)) static double BaselineAdd(double x, double y) {
+    return x + y;
+}
+
+// Each call depends on the previous result, so this is the latency of one
+// call through the pointer plus a single add
+static void RunCalls(benchmark::State& state, double (*add)(double, double)) {
+    benchmark::DoNotOptimize(add);
+    double x = 0.0;
+    for (auto _ : state) {
+        x = add(x, 1.0);
+        benchmark::DoNotOptimize(x);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Typed lookup hands out the function itself, calling it involves no marshalling
+static void BM_CallOverhead(benchmark::State& state) {
+    std::unique_ptr<JITSession> jit;
+    auto add = Compile<double(double, double)>(jit, "def add(x y) x + y", "add", OptLevel::O2);
+    if (!add) {
+        state.SkipWithError("JIT compilation failed");
+        return;
+    }
+    RunCalls(state, add);
+}
+BENCHMARK(BM_CallOverhead);
+
+static void BM_CppBaselineCall(benchmark::State& state) {
+    RunCalls(state, &BaselineAdd);
+}
+BENCHMARK(BM_CppBaselineCall);
@@ -0,0 +1,12 @@
+#include "benchmark/benchmark.h"
+#include "llvm/Support/TargetSelect.h"
+
+int main(int argc, char ** argv) {
+    llvm::InitializeNativeTarget();
+    llvm::InitializeNativeTargetAsmPrinter();
+    llvm::InitializeNativeTargetAsmParser();
+
+    benchmark::Initialize(&argc, argv);
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
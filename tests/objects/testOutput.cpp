@@ -8,4 +8,9 @@ int main() {
     std::cout << "(3 + 3) * (3 + 3) = " << test(3.0) << std::endl;
 }
 
-// clang++ testOutput.cpp output.o -o main
\ No newline at end of file
+// build/compiler tests/objects/test.ks -o build/output.o
+// clang++ testOutput.cpp build/output.o -o main
+
+// With ThinLTO the linker inlines test into main (see make lto-test)
+// build/compiler -flto=thin tests/objects/test.ks -o build/output.o
+// clang++ -O2 -flto=thin -fuse-ld=lld testOutput.cpp build/output.o -o main
@@ -0,0 +1,87 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <limits>
+
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static size_t CountInstructions(const std::string& source, const std::string& function, bool optimizeAST) {
+    CompilerOptions options;
+    options.optimizeAST = optimizeAST;
+    Parser parser(source, options);
+    parser.parse();
+    llvm::Function* func = parser.GetIRConstructor()->getModule().getFunction(function);
+    return func ? func->getInstructionCount() : 0;
+}
+
+TEST(ASTOptimizerTests, FoldsLiteralSubtrees) {
+    Parser parser("def f(x) (1+2+x)*(x+(1+2))");
+    parser.parse();
+    const ASTOptimizerStats& stats = parser.GetASTStats();
+    GTEST_ASSERT_EQ(stats.functions, 1u);
+    GTEST_ASSERT_EQ(stats.foldedConstants, 2u);
+    // 3+x and x+3 become one node: (x+3)*(x+3) is x, 3, + and *
+    GTEST_ASSERT_EQ(stats.nodesBefore, 11u);
+    GTEST_ASSERT_EQ(stats.nodesAfter, 4u);
+    GTEST_ASSERT_EQ(stats.getNodesRemoved(), 7u);
+
+    // one fadd and one fmul before any LLVM pass
+    GTEST_ASSERT_EQ(CountInstructions("def f(x) (1+2+x)*(x+(1+2))", "f", true), 3u);
+    GTEST_ASSERT_EQ(CountInstructions("def f(x) (1+2+x)*(x+(1+2))", "f", false), 4u);
+}
+
+TEST(ASTOptimizerTests, AppliesOnlyIEEESafeIdentities) {
+    Parser parser("def f(x) x*1 + (x-0) def g(x) x+0 def h(x) x*0");
+    parser.parse();
+    const ASTOptimizerStats& stats = parser.GetASTStats();
+    GTEST_ASSERT_EQ(stats.simplifiedIdentities, 2u);
+    // x+0 is not x for x = -0, x*0 is not 0 for infinities and NaN
+    GTEST_ASSERT_EQ(CountInstructions("def g(x) x+0", "g", true), 2u);
+    GTEST_ASSERT_EQ(CountInstructions("def h(x) x*0", "h", true), 2u);
+
+    CompilerOptions fast;
+    fast.fpMode = FPMode::Fast;
+    Parser fastParser("def g(x) x+0", fast);
+    fastParser.parse();
+    GTEST_ASSERT_EQ(fastParser.GetASTStats().simplifiedIdentities, 1u);
+}
+
+TEST(ASTOptimizerTests, KeepsCallsSeparate) {
+    Parser parser("extern g(x) def f(x) g(x) + g(x)");
+    parser.parse();
+    GTEST_ASSERT_EQ(parser.GetASTStats().mergedSubexpressions, 1u); // only the second x
+    size_t calls = 0;
+    for (auto& inst : llvm::instructions(*parser.GetIRConstructor()->getModule().getFunction("f"))) {
+        calls += llvm::isa<llvm::CallInst>(inst);
+    }
+    GTEST_ASSERT_EQ(calls, 2u);
+}
+
+TEST(ASTOptimizerTests, ResultsMatchUnoptimized) {
+    const std::string source =
+        "def f(x y) (2*3 - x*1) * (y + (x - 0)) + (y + (x - 0)) * (1 < 2) - (x < y)";
+    for (double x : {-2.5, -0.0, 0.0, 1.0, std::numeric_limits<double>::infinity()}) {
+        for (double y : {-1.0, 0.0, 3.5}) {
+            double optimized = Evaluate(source, "f", {x, y}, OptLevel::O0, true);
+            double reference = Evaluate(source, "f", {x, y}, OptLevel::O0, false);
+            GTEST_ASSERT_TRUE(optimized == reference || (std::isnan(optimized) && std::isnan(reference)));
+            GTEST_ASSERT_EQ(std::signbit(optimized), std::signbit(reference));
+        }
+    }
+}
+
+TEST(ASTOptimizerTests, CanBeDisabled) {
+    CompilerOptions options;
+    options.optimizeAST = false;
+    Parser parser("def f(x) 1+2+x", options);
+    parser.parse();
+    GTEST_ASSERT_EQ(parser.GetASTStats().functions, 0u);
+    // IRBuilder folds the literals itself, but the repeated x+1 is emitted twice
+    GTEST_ASSERT_EQ(CountInstructions("def f(x) (x+1)*(x+1)", "f", false), 4u);
+    GTEST_ASSERT_EQ(CountInstructions("def f(x) (x+1)*(x+1)", "f", true), 3u);
+}
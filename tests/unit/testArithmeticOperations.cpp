@@ -2,13 +2,13 @@
 
 #include "../../include/Parser.hpp"
 #include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
 
 
 bool ArithmeticEval(std::string function, double expected) {
     Parser parser(function);
     parser.parse();
-    llvm::GenericValue res = RunParsedFunction(parser.GetIRConstructor(), "test");
-    return res.DoubleVal == expected;
+    return ValueOrNaN(RunParsedFunction(parser.GetIRConstructor(), "test", {0.0})) == expected;
 }
 
 TEST(ArithmeticTests, Addition) {
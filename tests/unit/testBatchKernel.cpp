@@ -0,0 +1,99 @@
+#include "gtest/gtest.h"
+
+#include <vector>
+
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Object/ObjectFile.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+
+using Kernel2 = void (*)(const double*, const double*, double*, size_t);
+
+TEST(BatchKernelTests, MatchesScalarFunctionThroughJIT) {
+    auto session = JITSession::Create();
+    GTEST_ASSERT_TRUE(static_cast<bool>(session));
+    std::unique_ptr<JITSession> jit = std::move(*session);
+
+    Parser parser("def f(x y) x * y + x - 1");
+    parser.parse();
+    auto irConst = parser.GetIRConstructor();
+    GTEST_ASSERT_NE(irConst->createBatchKernel("f"), nullptr);
+    GTEST_ASSERT_FALSE(static_cast<bool>(jit->addModule(irConst->takeModule())));
+
+    auto scalar = jit->lookup("f");
+    auto batch = jit->lookup("f_batch");
+    GTEST_ASSERT_TRUE(scalar && batch);
+    auto f = scalar->toPtr<double (*)(double, double)>();
+    auto fBatch = batch->toPtr<Kernel2>();
+
+    // odd length, so the vectorized loop also needs its remainder
+    const size_t n = 1001;
+    std::vector<double> x(n), y(n), out(n, 0.0);
+    for (size_t i = 0; i < n; i++) {
+        x[i] = i * 0.5;
+        y[i] = 3.0 - i;
+    }
+    fBatch(x.data(), y.data(), out.data(), n);
+    for (size_t i = 0; i < n; i++) {
+        GTEST_ASSERT_EQ(out[i], f(x[i], y[i]));
+    }
+
+    // zero rows must not touch the arrays
+    fBatch(nullptr, nullptr, nullptr, 0);
+}
+
+TEST(BatchKernelTests, CalleeIsInlinedAndLoopVectorized) {
+    Parser parser("def f(x y) x * y + x - 1");
+    parser.parse();
+    auto irConst = parser.GetIRConstructor();
+    llvm::Function* kernel = irConst->createBatchKernel("f");
+    GTEST_ASSERT_NE(kernel, nullptr);
+
+    auto targetMachine = irConst->getOptions().target.createTargetMachine();
+    GTEST_ASSERT_TRUE(static_cast<bool>(targetMachine));
+    OptimizeModule(irConst->getModule(), irConst->getOptions(), targetMachine->get());
+
+    bool hasCall = false;
+    bool hasVectorMath = false;
+    for (auto& inst : llvm::instructions(*kernel)) {
+        hasCall |= llvm::isa<llvm::CallInst>(inst);
+        hasVectorMath |= inst.getOpcode() == llvm::Instruction::FMul && inst.getType()->isVectorTy();
+    }
+    GTEST_ASSERT_FALSE(hasCall);
+    GTEST_ASSERT_TRUE(hasVectorMath);
+}
+
+TEST(BatchKernelTests, KernelIsEmittedToObjectFiles) {
+    Parser parser("def f(x) x * x");
+    parser.parse();
+    auto irConst = parser.GetIRConstructor();
+    GTEST_ASSERT_NE(irConst->createBatchKernel("f"), nullptr);
+
+    llvm::SmallVector<char, 0> object;
+    GTEST_ASSERT_EQ(CompileToObjectBuffer(irConst, object), 0);
+    auto file = llvm::object::ObjectFile::createObjectFile(
+        llvm::MemoryBufferRef(llvm::StringRef(object.data(), object.size()), "kernel.o"));
+    GTEST_ASSERT_TRUE(static_cast<bool>(file));
+
+    bool found = false;
+    for (const auto& symbol : (*file)->symbols()) {
+        auto name = symbol.getName();
+        found |= name && *name == "f_batch";
+        if (!name) {
+            llvm::consumeError(name.takeError());
+        }
+    }
+    GTEST_ASSERT_TRUE(found);
+}
+
+TEST(BatchKernelTests, RequiresDefinitionInCurrentModule) {
+    Parser parser("extern g(x) def f(x) x");
+    parser.parse();
+    auto irConst = parser.GetIRConstructor();
+    GTEST_ASSERT_EQ(irConst->createBatchKernel("g"), nullptr);
+    GTEST_ASSERT_EQ(irConst->createBatchKernel("missing"), nullptr);
+    GTEST_ASSERT_NE(irConst->createBatchKernel("f"), nullptr);
+    GTEST_ASSERT_EQ(irConst->createBatchKernel("f"), nullptr);
+}
@@ -0,0 +1,104 @@
+#include "gtest/gtest.h"
+
+#include "../../include/CompilerSession.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+// What CompileToObjectBuffer makes of source, everything set up from scratch
+static llvm::SmallVector<char, 0> CompileCold(const std::string& source, const CompilerOptions& options) {
+    Parser parser(source, options);
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    EXPECT_TRUE(parser.ParseDefinitions(externs, definitions));
+    for (PrototypeAST* protoAST : externs) {
+        protoAST->codegen(*parser.GetIRConstructor());
+    }
+    for (FunctionAST* fnAST : definitions) {
+        fnAST->codegen(*parser.GetIRConstructor());
+    }
+    llvm::SmallVector<char, 0> object;
+    EXPECT_EQ(CompileToObjectBuffer(parser.GetIRConstructor(), object), 0);
+    return object;
+}
+
+static const std::vector<std::string> Snippets = {
+    "def f(x y) x * y + 1",
+    "extern sin(x) def g(x) sin(x) * 2 def h(x y) g(x) + g(y)",
+    "def sum(n acc) if n < 1 then acc else sum(n - 1, acc + n)",
+    "def f(x y) (for i = 0, i < x in y) + x * y",
+};
+
+TEST(CompilerSessionTests, SameObjectsAsTheColdPath) {
+    for (OptLevel level : {OptLevel::O0, OptLevel::O2}) {
+        CompilerOptions options;
+        options.optLevel = level;
+        auto session = TakeOrNull(CompilerSession::Create(options));
+        GTEST_ASSERT_TRUE(session != nullptr);
+        // Twice over, so every snippet also follows itself
+        for (int round = 0; round < 2; round++) {
+            for (const std::string& source : Snippets) {
+                GTEST_ASSERT_TRUE(session->addSource(source)) << source;
+                llvm::SmallVector<char, 0> object;
+                session->compile(object);
+                session->reset();
+                GTEST_ASSERT_FALSE(object.empty());
+                GTEST_ASSERT_TRUE(object == CompileCold(source, options)) << source;
+            }
+        }
+    }
+}
+
+TEST(CompilerSessionTests, ObjectsRun) {
+    auto session = TakeOrNull(CompilerSession::Create());
+    auto jit = JITSession::Create();
+    GTEST_ASSERT_TRUE(session && jit);
+    for (int i = 0; i < 3; i++) {
+        std::string name = "f" + std::to_string(i);
+        GTEST_ASSERT_TRUE(session->addSource("def " + name + "(x y) x * y + " + std::to_string(i)));
+        llvm::SmallVector<char, 0> object;
+        session->compile(object);
+        session->reset();
+        auto buffer = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()), name);
+        GTEST_ASSERT_FALSE(LogIfError((*jit)->addObject(std::move(buffer))));
+        auto address = (*jit)->lookup(name);
+        GTEST_ASSERT_TRUE(static_cast<bool>(address));
+        GTEST_ASSERT_EQ(address->toPtr<double (*)(double, double)>()(2, 3), 6.0 + i);
+    }
+}
+
+TEST(CompilerSessionTests, ResetForgetsDefinitions) {
+    auto session = TakeOrNull(CompilerSession::Create());
+    GTEST_ASSERT_TRUE(session->addSource("def f(x) x + 1"));
+    GTEST_ASSERT_TRUE(session->addSource("def g(x) f(x) * 2"));
+    GTEST_ASSERT_NE(session->getIRConstructor().getModule().getFunction("f"), nullptr);
+    session->reset();
+    GTEST_ASSERT_EQ(session->getIRConstructor().getModule().getFunction("f"), nullptr);
+    GTEST_ASSERT_FALSE(session->addSource("def g(x) f(x) * 2"));
+    GTEST_ASSERT_TRUE(session->addSource("def f(x y) x - y"));
+}
+
+TEST(CompilerSessionTests, ReplacesTheContextEveryFewModules) {
+    CompilerOptions options;
+    auto session = TakeOrNull(CompilerSession::Create(options, 2));
+    llvm::LLVMContext* first = &session->getIRConstructor().getContext();
+    session->reset();
+    GTEST_ASSERT_EQ(&session->getIRConstructor().getContext(), first);
+    session->reset();
+    GTEST_ASSERT_NE(&session->getIRConstructor().getContext(), first);
+
+    GTEST_ASSERT_TRUE(session->addSource(Snippets[1]));
+    llvm::SmallVector<char, 0> object;
+    session->compile(object);
+    GTEST_ASSERT_TRUE(object == CompileCold(Snippets[1], options));
+}
+
+TEST(CompilerSessionTests, Errors) {
+    CompilerOptions options;
+    options.lto = LTOMode::Thin;
+    GTEST_ASSERT_EQ(TakeOrNull(CompilerSession::Create(options)), nullptr);
+
+    auto session = TakeOrNull(CompilerSession::Create());
+    GTEST_ASSERT_FALSE(session->addSource("def f(x) x 1 + 2"));
+    GTEST_ASSERT_FALSE(session->addSource("def f(x) x"));
+}
@@ -0,0 +1,54 @@
+#include "gtest/gtest.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+TEST(ConcurrencyTests, CompilesSnippetsOnAllCores) {
+    const int numSnippets = 2000;
+    const unsigned numThreads = std::max(4u, std::thread::hardware_concurrency());
+
+    JITOptions options;
+    options.concurrentCompilation = true;
+    auto session = JITSession::Create(options);
+    GTEST_ASSERT_TRUE(static_cast<bool>(session));
+    std::shared_ptr<JITSession> jit = std::move(*session);
+
+    std::atomic<int> nextSnippet{0};
+    std::atomic<int> failures{0};
+    {
+        SilenceOutput silence;
+        std::vector<std::thread> workers;
+        for (unsigned t = 0; t < numThreads; t++) {
+            workers.emplace_back([&] {
+                for (int i = nextSnippet++; i < numSnippets; i = nextSnippet++) {
+                    // every thread builds its modules with its own Parser
+                    std::string name = "snippet" + std::to_string(i);
+                    Parser parser("def " + name + "(x) x * " + std::to_string(i) + " + 1");
+                    parser.parse();
+
+                    // alternate between object emission and the shared JIT
+                    if (i % 2 == 0) {
+                        llvm::SmallVector<char, 0> object;
+                        if (CompileToObjectBuffer(parser.GetIRConstructor(), object) != 0 || object.empty()) {
+                            failures++;
+                        }
+                    } else {
+                        double result = ValueOrNaN(RunParsedFunction(*jit, parser.GetIRConstructor(), name, {2.0}));
+                        if (result != 2.0 * i + 1) {
+                            failures++;
+                        }
+                    }
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    GTEST_ASSERT_EQ(failures.load(), 0);
+}
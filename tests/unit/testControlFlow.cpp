@@ -0,0 +1,114 @@
+#include "gtest/gtest.h"
+
+#include "llvm/Analysis/LoopInfo.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+// Parses without optimizing, the function is left in the module as emitted
+static llvm::Function* Emit(Parser& parser, const std::string& function) {
+    parser.parse();
+    llvm::Function* func = parser.GetIRConstructor()->getModule().getFunction(function);
+    EXPECT_TRUE(func && !llvm::verifyFunction(*func, &llvm::errs()));
+    return func;
+}
+
+static size_t CountCallsTo(const llvm::Function& func, const llvm::Function& callee) {
+    size_t calls = 0;
+    for (auto& inst : llvm::instructions(func)) {
+        auto* call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        calls += call && call->getCalledFunction() == &callee;
+    }
+    return calls;
+}
+
+TEST(ControlFlowTests, IfThenElse) {
+    const std::string source = "def abs(x) if x < 0 then 0 - x else x";
+    GTEST_ASSERT_EQ(Evaluate(source, "abs", {-2.5}), 2.5);
+    GTEST_ASSERT_EQ(Evaluate(source, "abs", {4.0}), 4.0);
+}
+
+TEST(ControlFlowTests, IfInsideAnExpression) {
+    const std::string source = "def f(x y) (if x < y then x else y) * 10 + (if x then 1 else 2)";
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {1.0, 2.0}), 11.0);
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {0.0, -3.0}), -28.0);
+}
+
+TEST(ControlFlowTests, LessThanBindsLooserThanArithmetic) {
+    GTEST_ASSERT_EQ(Evaluate("def f(x) x + 1 < 3", "f", {1.5}), 1.0);
+    GTEST_ASSERT_EQ(Evaluate("def f(x) x + 1 < 3", "f", {2.5}), 0.0);
+}
+
+TEST(ControlFlowTests, ForLoopRunsItsBodyPerIteration) {
+    // Every iteration recurses once, so the loop only ends if count does
+    const std::string source = "def count(n) if n < 1 then 0 else 1 + count(n - 1) "
+                               "def f(n) (for i = 0, i < n, 2 in count(i)) + 7";
+    for (OptLevel level : {OptLevel::O0, OptLevel::O2}) {
+        GTEST_ASSERT_EQ(Evaluate(source, "f", {10.0}, level), 7.0);
+    }
+
+    Parser parser(source);
+    llvm::Function* func = Emit(parser, "f");
+    llvm::DominatorTree domTree(*func);
+    llvm::LoopInfo loops(domTree);
+    GTEST_ASSERT_EQ(loops.getTopLevelLoops().size(), 1u);
+    GTEST_ASSERT_EQ(CountCallsTo(*func, *parser.GetIRConstructor()->getModule().getFunction("count")), 1u);
+}
+
+TEST(ControlFlowTests, SelfTailCallsBecomeLoops) {
+    const std::string source = "def sum(n acc) if n < 1 then acc else sum(n - 1, acc + n)";
+    Parser parser(source);
+    llvm::Function* func = Emit(parser, "sum");
+    GTEST_ASSERT_EQ(CountCallsTo(*func, *func), 0u);
+
+    // Would overflow the stack if every step took a frame
+    for (OptLevel level : {OptLevel::O0, OptLevel::O2}) {
+        GTEST_ASSERT_EQ(Evaluate(source, "sum", {1e7, 0.0}, level), 5e13 + 5e6);
+    }
+}
+
+TEST(ControlFlowTests, OtherTailCallsAreMarked) {
+    Parser parser("def g(x) x * 2 def f(x) if x < 0 then g(x) else g(x + 1) + 1");
+    llvm::Function* f = Emit(parser, "f");
+    llvm::Function* g = parser.GetIRConstructor()->getModule().getFunction("g");
+    size_t tailCalls = 0;
+    for (auto& inst : llvm::instructions(*f)) {
+        if (auto* call = llvm::dyn_cast<llvm::CallInst>(&inst)) {
+            GTEST_ASSERT_EQ(call->getCalledFunction(), g);
+            tailCalls += call->isTailCall();
+        }
+    }
+    GTEST_ASSERT_EQ(tailCalls, 1u);
+}
+
+TEST(ControlFlowTests, RecursionOutsideTailPositionStillWorks) {
+    const std::string source = "def fib(n) if n < 2 then n else fib(n - 1) + fib(n - 2)";
+    GTEST_ASSERT_EQ(Evaluate(source, "fib", {20.0}), 6765.0);
+    GTEST_ASSERT_EQ(Evaluate(source, "fib", {20.0}, OptLevel::O3), 6765.0);
+}
+
+TEST(ControlFlowTests, SharedSubexpressionsStayInTheirBranch) {
+    // x * y is one node after the AST optimizer, each branch computes it
+    const std::string source = "def f(x y) (if x < y then x * y + 1 else x * y + 2) + x * y";
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {2.0, 3.0}), 13.0);
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {3.0, 2.0}), 14.0);
+}
+
+TEST(ControlFlowTests, LoopVariableShadowsArgument) {
+    // x + 1 inside the loop is not the x + 1 outside of it
+    const std::string source = "def f(x) (x + 1) * 10 + (for x = 0, x + 1 < 5 in x + 1) + (x + 1)";
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {2.0}), 33.0);
+}
+
+TEST(ControlFlowTests, Errors) {
+    for (const char* source : {"def f(x) if x then 1", "def f(x) if x 1 else 2", "def f(x) for 1 = 0, x in x",
+                               "def f(x) for i = 0 in x", "def f(x) for i = 0, i < x, 1 x"}) {
+        Parser parser(source);
+        parser.parse();
+        GTEST_ASSERT_EQ(parser.GetIRConstructor()->getModule().getFunction("f"), nullptr) << source;
+    }
+}
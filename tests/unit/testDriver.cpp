@@ -0,0 +1,82 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Driver.hpp"
+#include "../TestUtils.hpp"
+
+static std::string WriteSource(const std::string& name, const std::string& source) {
+    std::string dir = std::string(TMP_OBJECT_FILES_DIR) + "/driver";
+    llvm::sys::fs::create_directories(dir);
+    std::string path = dir + "/" + name;
+    std::ofstream(path) << source;
+    return path;
+}
+
+// sq and quad are used across files, quad without an extern
+static std::vector<std::string> ProgramFiles() {
+    return {WriteSource("square.ks", "def sq(x) x * x"),
+            WriteSource("quad.ks", "def quad(x) sq(sq(x))"),
+            WriteSource("main.ks", "extern quad(x) def f(x) quad(x) + 1")};
+}
+
+static std::string Build(std::vector<std::string> inputs, OutputKind kind, unsigned jobs,
+                         const std::string& output) {
+    DriverOptions options;
+    options.inputs = std::move(inputs);
+    options.output = std::string(TMP_OBJECT_FILES_DIR) + "/driver/" + output;
+    options.outputKind = kind;
+    options.jobs = jobs;
+    Driver driver(options);
+    if (driver.run() != 0) {
+        return "";
+    }
+    if (driver.getFileTimings().size() != options.inputs.size()) {
+        return "";
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(options.output);
+    return buffer ? (*buffer)->getBuffer().str() : "";
+}
+
+TEST(DriverTests, LinksFilesIntoOneObject) {
+    std::string object = Build(ProgramFiles(), OutputKind::Object, 0, "program.o");
+    GTEST_ASSERT_FALSE(object.empty());
+    std::vector<std::string> functions = DefinedFunctions(object);
+    GTEST_ASSERT_EQ(functions, (std::vector<std::string>{"f", "quad", "sq"}));
+}
+
+TEST(DriverTests, ArchiveHasOneMemberPerFile) {
+    std::string archiveData = Build(ProgramFiles(), OutputKind::Archive, 0, "program.a");
+    GTEST_ASSERT_FALSE(archiveData.empty());
+
+    std::vector<std::string> names;
+    for (const ArchiveMember& member : ArchiveMembers(archiveData)) {
+        names.push_back(member.name);
+        GTEST_ASSERT_EQ(DefinedFunctions(member.object).size(), 1u) << member.name;
+    }
+    GTEST_ASSERT_EQ(names, (std::vector<std::string>{"square.o", "quad.o", "main.o"}));
+}
+
+TEST(DriverTests, OutputDoesNotDependOnJobs) {
+    std::string serial = Build(ProgramFiles(), OutputKind::Archive, 1, "serial.a");
+    std::string parallel = Build(ProgramFiles(), OutputKind::Archive, 4, "parallel.a");
+    GTEST_ASSERT_FALSE(serial.empty());
+    GTEST_ASSERT_EQ(serial, parallel);
+}
+
+TEST(DriverTests, RejectsConflictingDefinitions) {
+    std::vector<std::string> duplicate = ProgramFiles();
+    duplicate.push_back(WriteSource("other.ks", "def sq(x) x"));
+    GTEST_ASSERT_TRUE(Build(duplicate, OutputKind::Object, 0, "duplicate.o").empty());
+
+    std::vector<std::string> mismatch = ProgramFiles();
+    mismatch.push_back(WriteSource("wrong.ks", "extern sq(x y) def g(x) sq(x, x)"));
+    GTEST_ASSERT_TRUE(Build(mismatch, OutputKind::Object, 0, "mismatch.o").empty());
+
+    GTEST_ASSERT_TRUE(Build({WriteSource("missing.ks", "def h(x) undefined(x)")}, OutputKind::Object, 0,
+                            "missing.o").empty());
+}
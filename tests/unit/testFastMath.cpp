@@ -0,0 +1,74 @@
+#include "gtest/gtest.h"
+
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/TargetParser/Triple.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+
+static size_t CountFAdds(const llvm::Function& func) {
+    size_t count = 0;
+    for (auto& inst : llvm::instructions(func)) {
+        if (inst.getOpcode() == llvm::Instruction::FAdd) {
+            count++;
+        }
+    }
+    return count;
+}
+
+static size_t FAddsAfterOptimization(const std::string& source, const CompilerOptions& options,
+                                     const std::string& function) {
+    Parser parser(source, options);
+    parser.parse();
+    llvm::Module& module = parser.GetIRConstructor()->getModule();
+    OptimizeModule(module, options);
+    return CountFAdds(*module.getFunction(function));
+}
+
+TEST(FastMathTests, StrictKeepsSeparateRounding) {
+    CompilerOptions options;
+    // (x + 1) + 2 is not x + 3 in IEEE arithmetic
+    GTEST_ASSERT_EQ(FAddsAfterOptimization("def f(x) (x + 1) + 2", options, "f"), 2u);
+}
+
+TEST(FastMathTests, FastReassociatesConstants) {
+    CompilerOptions options;
+    options.fpMode = FPMode::Fast;
+    GTEST_ASSERT_EQ(FAddsAfterOptimization("def f(x) (x + 1) + 2", options, "f"), 1u);
+    // (1+2+x)*(x+(1+2)) becomes (x+3)*(x+3)
+    GTEST_ASSERT_EQ(FAddsAfterOptimization("def test(x) (1+2+x)*(x+(1+2))", options, "test"), 1u);
+}
+
+TEST(FastMathTests, ModeCanBeSetPerFunction) {
+    CompilerOptions options;
+    options.functionFPModes["fast"] = FPMode::Fast;
+    const std::string source = "def strict(x) (x + 1) + 2 def fast(x) (x + 1) + 2";
+    GTEST_ASSERT_EQ(FAddsAfterOptimization(source, options, "strict"), 2u);
+    GTEST_ASSERT_EQ(FAddsAfterOptimization(source, options, "fast"), 1u);
+}
+
+static std::string AssemblyFor(FPMode mode) {
+    CompilerOptions options;
+    options.fpMode = mode;
+    options.target.cpu = "haswell"; // has FMA3
+    Parser parser("def f(a b c) a * b + c", options);
+    parser.parse();
+
+    llvm::SmallVector<char, 0> assembly;
+    if (CompileToAssembly(parser.GetIRConstructor(), assembly) != 0) {
+        return "";
+    }
+    return std::string(assembly.data(), assembly.size());
+}
+
+TEST(FastMathTests, ContractFormsFMA) {
+    if (!llvm::Triple(TargetConfig().getTriple()).isX86()) {
+        GTEST_SKIP() << "checks x86 FMA instructions";
+    }
+    std::string strict = AssemblyFor(FPMode::Strict);
+    std::string contract = AssemblyFor(FPMode::Contract);
+    GTEST_ASSERT_FALSE(strict.empty());
+    GTEST_ASSERT_EQ(strict.find("vfmadd"), std::string::npos);
+    GTEST_ASSERT_NE(contract.find("vfmadd"), std::string::npos);
+}
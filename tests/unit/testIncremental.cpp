@@ -0,0 +1,128 @@
+#include "gtest/gtest.h"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/IncrementalCompiler.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static const std::string version1 = "def a(x) x + 1 def b(x) a(x) * 2 def c(x) x * 3";
+
+static double Call(JITSession& jit, const std::string& name, double arg) {
+    auto address = jit.lookup(name);
+    if (!address) {
+        llvm::consumeError(address.takeError());
+        return -1.0;
+    }
+    return address->toPtr<double (*)(double)>()(arg);
+}
+
+TEST(IncrementalTests, RecompilesChangedFunctionsAndCallers) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+    IncrementalCompiler compiler(jit);
+
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+    GTEST_ASSERT_EQ(compiler.getStats().recompiled, 3u);
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 4.0);
+
+    // b inlined a, so it has to be rebuilt too, c stays as it is
+    GTEST_ASSERT_TRUE(compiler.update("def a(x) x + 10 def b(x) a(x) * 2 def c(x) x * 3"));
+    GTEST_ASSERT_EQ(compiler.getStats().changed, 1u);
+    GTEST_ASSERT_EQ(compiler.getStats().recompiled, 2u);
+    GTEST_ASSERT_EQ(Call(*jit, "a", 1.0), 11.0);
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 22.0);
+    GTEST_ASSERT_EQ(Call(*jit, "c", 2.0), 6.0);
+}
+
+TEST(IncrementalTests, FormattingChangesRecompileNothing) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+    IncrementalCompiler compiler(jit);
+
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+    GTEST_ASSERT_TRUE(compiler.update("def c(x)  x*3\ndef a(x) x+1\ndef b(x) a(x)*2"));
+    GTEST_ASSERT_EQ(compiler.getStats().changed, 0u);
+    GTEST_ASSERT_EQ(compiler.getStats().recompiled, 0u);
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 4.0);
+}
+
+TEST(IncrementalTests, RemovedFunctionsAreFreed) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+    IncrementalCompiler compiler(jit);
+
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+    GTEST_ASSERT_TRUE(compiler.update("def a(x) x + 1 def b(x) a(x) * 2"));
+    GTEST_ASSERT_EQ(compiler.getStats().removed, 1u);
+    GTEST_ASSERT_EQ(compiler.getStats().recompiled, 0u);
+    auto address = jit->lookup("c");
+    GTEST_ASSERT_FALSE(static_cast<bool>(address));
+    llvm::consumeError(address.takeError());
+
+    // and can come back later
+    GTEST_ASSERT_TRUE(compiler.update("def a(x) x + 1 def b(x) a(x) * 2 def c(x) x * 4"));
+    GTEST_ASSERT_EQ(Call(*jit, "c", 2.0), 8.0);
+}
+
+TEST(IncrementalTests, FailedUpdateKeepsPreviousProgram) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+    IncrementalCompiler compiler(jit);
+
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+    GTEST_ASSERT_FALSE(compiler.update("def a(x) x + def b(x) a(x) * 2"));
+    // b still calls a, which is gone
+    GTEST_ASSERT_FALSE(compiler.update("def b(x) a(x) * 2 def c(x) x * 3"));
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 4.0);
+
+    GTEST_ASSERT_TRUE(compiler.update("def a(x) x + 2 def b(x) a(x) * 2 def c(x) x * 3"));
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 6.0);
+}
+
+TEST(IncrementalTests, FailedAddIsRecompiledByTheNextUpdate) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+    IncrementalCompiler compiler(jit);
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+
+    // Defined outside of the compiler, so adding ab fails after a and before b and c
+    Parser other("def ab(x) x");
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    GTEST_ASSERT_TRUE(other.ParseDefinitions(externs, definitions));
+    GTEST_ASSERT_NE(definitions[0]->codegen(*other.GetIRConstructor()), nullptr);
+    auto tracker = jit->createResourceTracker();
+    GTEST_ASSERT_FALSE(LogIfError(jit->addModule(other.GetIRConstructor()->takeModule(), tracker)));
+
+    const std::string version2 = "def a(x) x + 10 def ab(x) x * 5 def b(x) a(x) * 2 def c(x) x * 4";
+    GTEST_ASSERT_FALSE(compiler.update(version2));
+    GTEST_ASSERT_FALSE(LogIfError(tracker->remove()));
+    GTEST_ASSERT_TRUE(compiler.update(version2));
+    GTEST_ASSERT_EQ(Call(*jit, "a", 1.0), 11.0);
+    GTEST_ASSERT_EQ(Call(*jit, "ab", 2.0), 10.0);
+    GTEST_ASSERT_EQ(Call(*jit, "b", 1.0), 22.0);
+    GTEST_ASSERT_EQ(Call(*jit, "c", 2.0), 8.0);
+}
+
+TEST(IncrementalTests, ArchiveReusesUnchangedObjects) {
+    IncrementalCompiler compiler;
+    GTEST_ASSERT_TRUE(compiler.update(version1));
+    GTEST_ASSERT_TRUE(compiler.update("def a(x) x + 1 def b(x) a(x) * 2 def c(x) x * 5"));
+    GTEST_ASSERT_EQ(compiler.getStats().recompiled, 1u);
+
+    llvm::sys::fs::create_directories(TMP_OBJECT_FILES_DIR);
+    std::string fileName = std::string(TMP_OBJECT_FILES_DIR) + "/incremental.a";
+    GTEST_ASSERT_EQ(compiler.writeArchive(fileName), 0);
+
+    auto buffer = llvm::MemoryBuffer::getFile(fileName);
+    GTEST_ASSERT_TRUE(static_cast<bool>(buffer));
+    std::vector<std::string> names;
+    for (const ArchiveMember& member : ArchiveMembers((*buffer)->getBuffer())) {
+        names.push_back(member.name);
+    }
+    GTEST_ASSERT_EQ(names, (std::vector<std::string>{"a.o", "b.o", "c.o"}));
+}
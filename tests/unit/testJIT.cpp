@@ -0,0 +1,182 @@
+#include "gtest/gtest.h"
+
+#include <iostream>
+#include <sstream>
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+TEST(JITTests, DefinitionsAreAddedIncrementally) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    Parser parser("def inc(x) x + 1 def twice(x) inc(x) * 2");
+    parser.SetJIT(jit);
+    parser.parse();
+
+    // both definitions went to the JIT as separate modules
+    GTEST_ASSERT_TRUE(parser.GetIRConstructor()->getModule().empty());
+
+    auto address = jit->lookup("twice");
+    GTEST_ASSERT_TRUE(static_cast<bool>(address));
+    GTEST_ASSERT_EQ(address->toPtr<double (*)(double)>()(3.0), 8.0);
+}
+
+TEST(JITTests, EarlierFunctionsStayCallable) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    Parser first("def square(x) x * x");
+    first.parse();
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(*jit, first.GetIRConstructor(), "square", {4.0})), 16.0);
+
+    Parser second("extern square(x) def cube(x) square(x) * x");
+    second.parse();
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(*jit, second.GetIRConstructor(), "cube", {2.0})), 8.0);
+    // the first IRConstructor is still usable after handing its module to the JIT
+    GTEST_ASSERT_TRUE(first.GetIRConstructor()->getModule().empty());
+}
+
+TEST(JITTests, LazyModeCompilesOnFirstCall) {
+    JITOptions options;
+    options.lazy = true;
+    auto lazyJIT = JITSession::Create(options);
+    GTEST_ASSERT_TRUE(static_cast<bool>(lazyJIT));
+    std::shared_ptr<JITSession> jit = std::move(*lazyJIT);
+
+    Parser parser("def inc(x) x + 1 def twice(x) inc(x) * 2 def unused(x) x * 3");
+    parser.SetJIT(jit);
+    parser.parse();
+    GTEST_ASSERT_EQ(jit->getNumCompiledFunctions(), 0u);
+
+    // the lookup only returns the stub of twice
+    auto address = jit->lookup("twice");
+    GTEST_ASSERT_TRUE(static_cast<bool>(address));
+    GTEST_ASSERT_EQ(jit->getNumCompiledFunctions(), 0u);
+
+    // twice and inc are compiled through their stubs when first called, unused never is
+    GTEST_ASSERT_EQ(address->toPtr<double (*)(double)>()(3.0), 8.0);
+    GTEST_ASSERT_EQ(jit->getNumCompiledFunctions(), 2u);
+}
+
+TEST(JITTests, EvaluatesEveryTopLevelExpression) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    std::stringstream output;
+    std::streambuf* previous = std::cout.rdbuf(output.rdbuf());
+    Parser parser("def inc(x) x + 1 inc(1); inc(2) def twice(x) x * 2 twice(inc(3))");
+    parser.SetJIT(jit);
+    parser.parse();
+    std::cout.rdbuf(previous);
+
+    std::string text = output.str();
+    GTEST_ASSERT_NE(text.find("Evaluated to 2\n"), std::string::npos);
+    GTEST_ASSERT_NE(text.find("Evaluated to 3\n"), std::string::npos);
+    GTEST_ASSERT_NE(text.find("Evaluated to 8\n"), std::string::npos);
+}
+
+TEST(JITTests, TopLevelExpressionsWithoutJITStayInTheModule) {
+    Parser parser("1 + 2 def inc(x) x + 1 inc(4)");
+    parser.parse();
+    llvm::Module& module = parser.GetIRConstructor()->getModule();
+    GTEST_ASSERT_NE(module.getFunction("__anon_expr"), nullptr);
+    GTEST_ASSERT_NE(module.getFunction("__anon_expr1"), nullptr);
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(parser.GetIRConstructor(), "__anon_expr1")), 5.0);
+}
+
+TEST(JITTests, TypedLookupCallsDirectly) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    Parser parser("def add(x y) x + y def one() 1");
+    parser.SetJIT(jit);
+    parser.parse();
+
+    auto add = jit->lookup<double(double, double)>("add");
+    GTEST_ASSERT_TRUE(static_cast<bool>(add));
+    GTEST_ASSERT_EQ((*add)(2.0, 3.5), 5.5);
+    auto one = jit->lookup<double()>("one");
+    GTEST_ASSERT_TRUE(static_cast<bool>(one));
+    GTEST_ASSERT_EQ((*one)(), 1.0);
+}
+
+TEST(JITTests, TypedLookupChecksTheSignature) {
+    JITOptions options;
+    options.lazy = true;
+    auto jit = JITSession::Create(options);
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+
+    Parser parser("def add(x y) x + y");
+    parser.parse();
+    GTEST_ASSERT_NE(parser.GetIRConstructor()->createBatchKernel("add"), nullptr);
+    GTEST_ASSERT_FALSE(LogIfError((*jit)->addModule(parser.GetIRConstructor()->takeModule())));
+
+    GTEST_ASSERT_TRUE(LogIfError((*jit)->lookup<double(double)>("add").takeError()));
+    GTEST_ASSERT_TRUE(LogIfError((*jit)->lookup<double(double, double, double)>("add").takeError()));
+    GTEST_ASSERT_TRUE(LogIfError((*jit)->lookup<double(double)>("unknown").takeError()));
+    // void add_batch(const double*, const double*, double*, size_t)
+    GTEST_ASSERT_TRUE(LogIfError((*jit)->lookup<double(double, double, double, double)>("add_batch").takeError()));
+    // Checked before anything is compiled
+    GTEST_ASSERT_EQ((*jit)->getNumCompiledFunctions(), 0u);
+
+    auto add = (*jit)->lookup<double(double, double)>("add");
+    GTEST_ASSERT_TRUE(static_cast<bool>(add));
+    GTEST_ASSERT_EQ((*add)(1.0, 2.0), 3.0);
+}
+
+TEST(JITTests, RunRejectsBadCallsBeforeTakingTheModule) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    Parser parser("def twice(x) x * 2 def five(a b c d e) a + e");
+    parser.parse();
+    auto irConst = parser.GetIRConstructor();
+    GTEST_ASSERT_TRUE(LogIfError(RunParsedFunction(*jit, irConst, "unknown", {1.0}).takeError()));
+    GTEST_ASSERT_TRUE(LogIfError(RunParsedFunction(*jit, irConst, "twice", {1.0, 2.0}).takeError()));
+    GTEST_ASSERT_TRUE(LogIfError(RunParsedFunction(*jit, irConst, "five", {1.0, 2.0, 3.0, 4.0, 5.0}).takeError()));
+
+    // Nothing reached the JIT, so the module can still be run
+    GTEST_ASSERT_NE(irConst->getModule().getFunction("twice"), nullptr);
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(*jit, irConst, "twice", {4.0})), 8.0);
+}
+
+// Object code carries no signature for lookup<Sig> to check against
+static bool AddAsObject(JITSession& jit, const std::string& source) {
+    Parser parser(source);
+    parser.parse();
+    llvm::SmallVector<char, 0> object;
+    if (CompileToObjectBuffer(parser.GetIRConstructor(), object) != 0) {
+        return false;
+    }
+    llvm::StringRef data(object.data(), object.size());
+    return !LogIfError(jit.addObject(llvm::MemoryBuffer::getMemBufferCopy(data)));
+}
+
+TEST(JITTests, TypedLookupForgetsRemovedFunctions) {
+    std::shared_ptr<JITSession> jit = TakeOrNull(JITSession::Create());
+    GTEST_ASSERT_NE(jit, nullptr);
+
+    // f goes with its own tracker, g with the one it was moved to
+    auto fTracker = jit->createResourceTracker();
+    auto gTracker = jit->createResourceTracker();
+    auto other = jit->createResourceTracker();
+    Parser f("def f(x) x + 1");
+    f.parse();
+    GTEST_ASSERT_FALSE(LogIfError(jit->addModule(f.GetIRConstructor()->takeModule(), fTracker)));
+    Parser g("def g(x) x - 1");
+    g.parse();
+    GTEST_ASSERT_FALSE(LogIfError(jit->addModule(g.GetIRConstructor()->takeModule(), gTracker)));
+    gTracker->transferTo(*other);
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit->lookup<double(double)>("f")));
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit->lookup<double(double)>("g")));
+    GTEST_ASSERT_FALSE(LogIfError(fTracker->remove()));
+    GTEST_ASSERT_FALSE(LogIfError(other->remove()));
+
+    // Redefined with two parameters, the old signatures must not apply
+    GTEST_ASSERT_TRUE(AddAsObject(*jit, "def f(x y) x + y def g(x y) x - y"));
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit->lookup("f")));
+    GTEST_ASSERT_TRUE(LogIfError(jit->lookup<double(double)>("f").takeError()));
+    GTEST_ASSERT_TRUE(LogIfError(jit->lookup<double(double)>("g").takeError()));
+}
@@ -0,0 +1,138 @@
+#include "gtest/gtest.h"
+
+#include <mutex>
+
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/LTO/LTO.h"
+#include "llvm/Support/Caching.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+
+// The callee and its caller live in separate modules, like a Kaleidoscope
+// object linked into a C++ host
+static const std::string calleeSource = "def test(x) (1+2+x)*(x+(1+2))";
+static const std::string callerSource = "extern test(x) def caller(x) test(x) * 2";
+
+static llvm::SmallVector<char, 0> Compile(const std::string& source, LTOMode mode) {
+    CompilerOptions options;
+    options.lto = mode;
+    Parser parser(source, options);
+    parser.parse();
+
+    llvm::SmallVector<char, 0> output;
+    EXPECT_EQ(CompileToObjectBuffer(parser.GetIRConstructor(), output), 0);
+    return output;
+}
+
+// A thin link tells modules apart by their buffer names
+static llvm::MemoryBufferRef AsBuffer(const llvm::SmallVector<char, 0>& data, llvm::StringRef name = "input") {
+    return llvm::MemoryBufferRef(llvm::StringRef(data.data(), data.size()), name);
+}
+
+static bool CallsTest(const llvm::Function& func) {
+    for (auto& inst : llvm::instructions(func)) {
+        auto* call = llvm::dyn_cast<llvm::CallInst>(&inst);
+        if (call && call->getCalledFunction() && call->getCalledFunction()->getName() == "test") {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Links both modules with LLVM's LTO, which is what lld runs for -flto. Only
+// caller is used by regular object code, test is internal to the link unit.
+// Returns whether caller still calls test right before code generation.
+static bool CallerCallsTestAfterLink(LTOMode mode) {
+    InitializeTargets();
+    auto callee = Compile(calleeSource, mode);
+    auto caller = Compile(callerSource, mode);
+
+    std::mutex mutex;
+    bool sawCaller = false;
+    bool callsTest = false;
+    llvm::lto::Config config;
+    // Backends run on several threads in a thin link
+    config.PreCodeGenModuleHook = [&](unsigned, const llvm::Module& module) {
+        if (const llvm::Function* func = module.getFunction("caller"); func && !func->isDeclaration()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            sawCaller = true;
+            callsTest = CallsTest(*func);
+        }
+        return false; // skip code generation
+    };
+    llvm::lto::LTO lto(std::move(config));
+
+    for (const auto& [name, bitcode] : {std::make_pair("callee.o", &callee), std::make_pair("caller.o", &caller)}) {
+        auto input = llvm::lto::InputFile::create(AsBuffer(*bitcode, name));
+        if (!input) {
+            ADD_FAILURE() << llvm::toString(input.takeError());
+            return true;
+        }
+        std::vector<llvm::lto::SymbolResolution> resolutions;
+        for (const auto& symbol : (*input)->symbols()) {
+            llvm::lto::SymbolResolution resolution;
+            resolution.Prevailing = !symbol.isUndefined();
+            resolution.FinalDefinitionInLinkageUnit = !symbol.isUndefined();
+            resolution.VisibleToRegularObj = symbol.getName() == "caller";
+            resolutions.push_back(resolution);
+        }
+        if (llvm::Error error = lto.add(std::move(*input), resolutions)) {
+            ADD_FAILURE() << llvm::toString(std::move(error));
+            return true;
+        }
+    }
+
+    std::vector<llvm::SmallVector<char, 0>> objects(lto.getMaxTasks());
+    auto addStream = [&](unsigned task,
+                         const llvm::Twine&) -> llvm::Expected<std::unique_ptr<llvm::CachedFileStream>> {
+        return std::make_unique<llvm::CachedFileStream>(
+            std::make_unique<llvm::raw_svector_ostream>(objects[task]));
+    };
+    if (llvm::Error error = lto.run(addStream)) {
+        ADD_FAILURE() << llvm::toString(std::move(error));
+        return true;
+    }
+    EXPECT_TRUE(sawCaller);
+    return callsTest;
+}
+
+TEST(LTOTests, ThinBitcodeHasSummary) {
+    auto bitcode = Compile(calleeSource, LTOMode::Thin);
+    auto info = llvm::getBitcodeLTOInfo(AsBuffer(bitcode));
+    GTEST_ASSERT_TRUE(static_cast<bool>(info));
+    GTEST_ASSERT_TRUE(info->IsThinLTO);
+    GTEST_ASSERT_TRUE(info->HasSummary);
+}
+
+TEST(LTOTests, FullBitcodeHasNoThinSummary) {
+    auto bitcode = Compile(calleeSource, LTOMode::Full);
+    auto info = llvm::getBitcodeLTOInfo(AsBuffer(bitcode));
+    GTEST_ASSERT_TRUE(static_cast<bool>(info));
+    GTEST_ASSERT_FALSE(info->IsThinLTO);
+}
+
+TEST(LTOTests, BitcodeKeepsDefinitions) {
+    llvm::LLVMContext context;
+    auto bitcode = Compile(calleeSource, LTOMode::Thin);
+    auto module = llvm::parseBitcodeFile(AsBuffer(bitcode), context);
+    GTEST_ASSERT_TRUE(static_cast<bool>(module));
+    GTEST_ASSERT_TRUE((*module)->getFunction("test") && !(*module)->getFunction("test")->isDeclaration());
+}
+
+TEST(LTOTests, ThinLinkInlinesAcrossModules) {
+    GTEST_ASSERT_FALSE(CallerCallsTestAfterLink(LTOMode::Thin));
+}
+
+TEST(LTOTests, FullLinkInlinesAcrossModules) {
+    GTEST_ASSERT_FALSE(CallerCallsTestAfterLink(LTOMode::Full));
+}
+
+TEST(LTOTests, ObjectFilesAreNotBitcode) {
+    auto object = Compile(calleeSource, LTOMode::None);
+    GTEST_ASSERT_FALSE(llvm::isBitcode(reinterpret_cast<const unsigned char*>(object.data()),
+                                       reinterpret_cast<const unsigned char*>(object.data() + object.size())));
+}
@@ -0,0 +1,90 @@
+#include "gtest/gtest.h"
+
+#include <filesystem>
+#include <fstream>
+
+#include "llvm/Support/FileSystem.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Lexer.hpp"
+#include "../../include/Parser.hpp"
+
+TEST(LexerTests, TokenSpans) {
+    const std::string source = "def test(x) x+1.5";
+    Lexer lexer(ViewSource(source));
+
+    Token tok = lexer.gettok();
+    GTEST_ASSERT_EQ(tok.type, tok_def);
+
+    tok = lexer.gettok();
+    GTEST_ASSERT_EQ(tok.type, tok_identifier);
+    GTEST_ASSERT_EQ(lexer.GetText(tok), "test");
+    // the token text points into the caller's buffer, nothing was copied
+    GTEST_ASSERT_EQ(lexer.GetText(tok).data(), source.data() + 4);
+
+    tok = lexer.gettok();
+    GTEST_ASSERT_EQ(tok.type, tok_unknown);
+    GTEST_ASSERT_EQ(lexer.GetText(tok), "(");
+
+    lexer.gettok(); // x
+    lexer.gettok(); // )
+    lexer.gettok(); // x
+    lexer.gettok(); // +
+
+    tok = lexer.gettok();
+    GTEST_ASSERT_EQ(tok.type, tok_number);
+    GTEST_ASSERT_EQ(tok.number_value, 1.5);
+    GTEST_ASSERT_EQ(lexer.GetText(tok), "1.5");
+
+    GTEST_ASSERT_EQ(lexer.gettok().type, tok_eof);
+    GTEST_ASSERT_EQ(lexer.gettok().type, tok_eof);
+}
+
+TEST(LexerTests, NumberAtEndOfUnterminatedView) {
+    // the view stops in the middle of the string, the lexer must not read past it
+    const std::string source = "42.5123";
+    Lexer lexer(ViewSource(std::string_view(source).substr(0, 4)));
+
+    Token tok = lexer.gettok();
+    GTEST_ASSERT_EQ(tok.type, tok_number);
+    GTEST_ASSERT_EQ(tok.number_value, 42.5);
+    GTEST_ASSERT_EQ(lexer.gettok().type, tok_eof);
+}
+
+TEST(LexerTests, IdentifiersAreInterned) {
+    auto symbols = std::make_shared<StringInterner>();
+    Lexer lexer(ViewSource("foo bar foo"), symbols);
+
+    Token foo = lexer.gettok();
+    Token bar = lexer.gettok();
+    GTEST_ASSERT_NE(foo.symbol, bar.symbol);
+    GTEST_ASSERT_EQ(lexer.gettok().symbol, foo.symbol);
+    GTEST_ASSERT_EQ(symbols->getName(foo.symbol), "foo");
+    GTEST_ASSERT_EQ(symbols->intern("bar"), bar.symbol);
+}
+
+TEST(LexerTests, SourcesBeyondTokenOffsetsAreRejected) {
+    std::string dir = std::string(TMP_OBJECT_FILES_DIR) + "/lexer";
+    llvm::sys::fs::create_directories(dir);
+    std::string path = dir + "/huge.ks";
+    std::ofstream(path) << "def f(x) x";
+    GTEST_ASSERT_NE(MapSourceFile(path), nullptr);
+
+    // Sparse, so it takes no disk space and mapping it reads nothing
+    std::filesystem::resize_file(path, MaxSourceSize + 1);
+    GTEST_ASSERT_EQ(MapSourceFile(path), nullptr);
+    auto huge = llvm::MemoryBuffer::getFile(path, /* IsText */ false, /* RequiresNullTerminator */ false);
+    GTEST_ASSERT_TRUE(static_cast<bool>(huge));
+    GTEST_ASSERT_EQ(ViewSource((*huge)->getBuffer()), nullptr);
+
+    // Handed over anyway, the parser stops without touching it
+    Parser parser(ViewSource((*huge)->getBuffer()));
+    GTEST_ASSERT_FALSE(parser.GetLexer().IsValid());
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    GTEST_ASSERT_FALSE(parser.ParseDefinitions(externs, definitions));
+    Lexer lexer(std::move(*huge));
+    GTEST_ASSERT_FALSE(lexer.IsValid());
+    GTEST_ASSERT_EQ(lexer.gettok().type, tok_eof);
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,97 @@
+#include "gtest/gtest.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "llvm/Support/FileSystem.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static std::string FreshCacheDir(const std::string& name) {
+    std::string dir = std::string(TMP_OBJECT_FILES_DIR) + "/" + name;
+    llvm::sys::fs::remove_directories(dir);
+    return dir;
+}
+
+static std::string ReadFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+TEST(ObjectCacheTests, CompileToObjectFileHitsOnSameModule) {
+    ObjectFileCache cache(FreshCacheDir("cache-aot"));
+    const std::string source = "def test(x) (1+2+x)*(x+(1+2))";
+    const std::string first = std::string(TMP_OBJECT_FILES_DIR) + "/first.o";
+    const std::string second = std::string(TMP_OBJECT_FILES_DIR) + "/second.o";
+
+    Parser parser(source);
+    parser.parse();
+    GTEST_ASSERT_EQ(CompileToObjectFile(parser.GetIRConstructor(), first, &cache), 0);
+    GTEST_ASSERT_EQ(cache.getMisses(), 1u);
+
+    Parser again(source);
+    again.parse();
+    GTEST_ASSERT_EQ(CompileToObjectFile(again.GetIRConstructor(), second, &cache), 0);
+    GTEST_ASSERT_EQ(cache.getHits(), 1u);
+    GTEST_ASSERT_EQ(ReadFile(first), ReadFile(second));
+
+    // a different module gets its own entry
+    Parser other("def test(x) x*2");
+    other.parse();
+    GTEST_ASSERT_EQ(CompileToObjectFile(other.GetIRConstructor(), second, &cache), 0);
+    GTEST_ASSERT_EQ(cache.getMisses(), 2u);
+}
+
+TEST(ObjectCacheTests, JITReusesObjectsAcrossSessions) {
+    auto cache = std::make_shared<ObjectFileCache>(FreshCacheDir("cache-jit"));
+    const std::string source = "def square(x) x * x";
+
+    JITOptions options;
+    options.objectCache = cache;
+
+    for (int run = 0; run < 2; run++) {
+        auto jit = JITSession::Create(options);
+        GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+        Parser parser(source);
+        parser.parse();
+        GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(**jit, parser.GetIRConstructor(), "square", {3.0})), 9.0);
+    }
+    GTEST_ASSERT_EQ(cache->getMisses(), 1u);
+    GTEST_ASSERT_EQ(cache->getHits(), 1u);
+}
+
+TEST(ObjectCacheTests, EvictsLeastRecentlyUsed) {
+    ObjectFileCache cache(FreshCacheDir("cache-lru"), /* maxSizeBytes */ 2500);
+    const std::string object(1000, 'o');
+
+    cache.store("a", object);
+    cache.store("b", object);
+    GTEST_ASSERT_NE(cache.lookup("a"), nullptr); // a is now more recent than b
+    cache.store("c", object);
+
+    GTEST_ASSERT_EQ(cache.lookup("b"), nullptr);
+    GTEST_ASSERT_NE(cache.lookup("a"), nullptr);
+    GTEST_ASSERT_NE(cache.lookup("c"), nullptr);
+}
+
+TEST(ObjectCacheTests, CountsEntriesAlreadyOnDisk) {
+    std::string dir = FreshCacheDir("cache-reopen");
+    const std::string object(1000, 'o');
+    {
+        ObjectFileCache cache(dir, /* maxSizeBytes */ 2500);
+        cache.store("a", object);
+        cache.store("b", object);
+    }
+
+    ObjectFileCache cache(dir, /* maxSizeBytes */ 2500);
+    GTEST_ASSERT_NE(cache.lookup("a"), nullptr);
+    cache.store("c", object);
+    GTEST_ASSERT_EQ(cache.lookup("b"), nullptr);
+    GTEST_ASSERT_NE(cache.lookup("a"), nullptr);
+    GTEST_ASSERT_NE(cache.lookup("c"), nullptr);
+}
@@ -0,0 +1,53 @@
+#include "gtest/gtest.h"
+
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static const std::string source = "def inc(x) x + 1 def twice(x) inc(x) * 2";
+
+static bool HasCalls(const llvm::Function& func) {
+    for (auto& inst : llvm::instructions(func)) {
+        if (llvm::isa<llvm::CallInst>(inst)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool TwiceCallsInc(OptLevel level) {
+    CompilerOptions options;
+    options.optLevel = level;
+    Parser parser(source, options);
+    parser.parse();
+
+    llvm::Module& module = parser.GetIRConstructor()->getModule();
+    OptimizeModule(module, options);
+    return HasCalls(*module.getFunction("twice"));
+}
+
+TEST(OptimizationTests, O0KeepsCalls) {
+    GTEST_ASSERT_TRUE(TwiceCallsInc(OptLevel::O0));
+}
+
+TEST(OptimizationTests, InlinesAcrossDefinitions) {
+    GTEST_ASSERT_FALSE(TwiceCallsInc(OptLevel::O1));
+    GTEST_ASSERT_FALSE(TwiceCallsInc(OptLevel::O2));
+    GTEST_ASSERT_FALSE(TwiceCallsInc(OptLevel::O3));
+}
+
+TEST(OptimizationTests, EveryLevelRunsInTheJIT) {
+    for (OptLevel level : {OptLevel::O0, OptLevel::O1, OptLevel::O2, OptLevel::O3}) {
+        JITOptions options;
+        options.compilerOptions.optLevel = level;
+        auto jit = JITSession::Create(options);
+        GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+
+        Parser parser(source, options.compilerOptions);
+        parser.parse();
+        GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(**jit, parser.GetIRConstructor(), "twice", {3.0})), 8.0);
+    }
+}
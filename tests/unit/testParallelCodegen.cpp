@@ -0,0 +1,59 @@
+#include "gtest/gtest.h"
+
+#include <set>
+
+#include "llvm/Object/Archive.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+// A chain of definitions, each calling the previous one
+static std::string GenerateSource(int numFunctions) {
+    std::string source = "def f0(x) x + 1 ";
+    for (int i = 1; i < numFunctions; i++) {
+        source += "def f" + std::to_string(i) + "(x) f" + std::to_string(i - 1) + "(x) * 2 ";
+    }
+    return source;
+}
+
+static std::string CompileWithThreads(const std::string& source, unsigned numThreads) {
+    llvm::sys::fs::create_directories(TMP_OBJECT_FILES_DIR);
+    std::string fileName = std::string(TMP_OBJECT_FILES_DIR) + "/parallel" + std::to_string(numThreads) + ".a";
+    Parser parser(source);
+    parser.parse();
+    if (CompileToArchive(parser.GetIRConstructor(), fileName, /* numPartitions */ 4, numThreads) != 0) {
+        return "";
+    }
+    auto buffer = llvm::MemoryBuffer::getFile(fileName);
+    return buffer ? (*buffer)->getBuffer().str() : "";
+}
+
+TEST(ParallelCodegenTests, OutputIndependentOfThreadCount) {
+    const std::string source = GenerateSource(64);
+    std::string serial = CompileWithThreads(source, 1);
+    std::string parallel = CompileWithThreads(source, 4);
+    GTEST_ASSERT_FALSE(serial.empty());
+    GTEST_ASSERT_EQ(serial, parallel);
+}
+
+TEST(ParallelCodegenTests, ArchiveDefinesEveryFunction) {
+    std::string archiveData = CompileWithThreads(GenerateSource(64), 0);
+    GTEST_ASSERT_FALSE(archiveData.empty());
+
+    GTEST_ASSERT_EQ(ArchiveMembers(archiveData).size(), 4u);
+
+    auto archive = llvm::object::Archive::create(llvm::MemoryBufferRef(archiveData, "parallel.a"));
+    GTEST_ASSERT_TRUE(static_cast<bool>(archive));
+
+    std::set<std::string> symbols;
+    for (auto& symbol : (*archive)->symbols()) {
+        symbols.insert(symbol.getName().str());
+    }
+    for (int i = 0; i < 64; i++) {
+        GTEST_ASSERT_EQ(symbols.count("f" + std::to_string(i)), 1u);
+    }
+}
@@ -0,0 +1,152 @@
+#include "gtest/gtest.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static bool Parses(const std::string& source) {
+    Parser parser(source);
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    return parser.ParseDefinitions(externs, definitions);
+}
+
+// Deep enough to overflow the native stack if any stage recursed per level
+static const size_t Depth = 100000;
+
+TEST(ParserTests, Precedence) {
+    GTEST_ASSERT_EQ(Evaluate("def f(a b c d) a - b * c + d", "f", {10, 2, 3, 4}), 8.0);
+    GTEST_ASSERT_EQ(Evaluate("def f(a b c d) a * b - c * d - a", "f", {10, 2, 3, 4}), -2.0);
+    GTEST_ASSERT_EQ(Evaluate("def f(a b c d) a < b + c * d", "f", {10, 2, 3, 4}), 1.0);
+    GTEST_ASSERT_EQ(Evaluate("def f(a b c d) (a - b) * (c + d) - (a - (b - c))", "f", {10, 2, 3, 4}), 45.0);
+    GTEST_ASSERT_EQ(Evaluate("def g(x y) x - y def f(a b c d) g(a + b, c) * 2 + (for i = 0, i < 1 in 0) - d", "f",
+                             {10, 2, 3, 4}),
+                    14.0);
+}
+
+TEST(ParserTests, LongOperatorChain) {
+    std::string source = "def f(x) x";
+    for (size_t i = 1; i < Depth; i++) {
+        source += i % 2 ? " + x" : " - 1";
+    }
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {3}), 3.0 + (Depth / 2) * 3.0 - (Depth - 1) / 2);
+}
+
+TEST(ParserTests, DeepParentheses) {
+    std::string source = "def f(x) ";
+    for (size_t i = 0; i < Depth; i++) {
+        source += "(x + ";
+    }
+    source += "1" + std::string(Depth, ')');
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {2}), 2.0 * Depth + 1);
+}
+
+TEST(ParserTests, DeepCalls) {
+    std::string source = "def g(x y) x + y def f(x) ";
+    for (size_t i = 0; i < Depth; i++) {
+        source += "g(1, ";
+    }
+    source += "x" + std::string(Depth, ')');
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {5}), 5.0 + Depth);
+}
+
+// Nested in the condition, in tail position and inside an operand
+static std::string NestedIfs(size_t depth) {
+    std::string conditions;
+    std::string tail;
+    for (size_t i = 0; i < depth; i++) {
+        conditions += "if ";
+        tail += "if x < " + std::to_string(i) + " then " + std::to_string(i) + " else ";
+    }
+    conditions += "x";
+    for (size_t i = 0; i < depth; i++) {
+        conditions += " then 1 else 0";
+    }
+    tail += "x";
+    return "def f(x) " + tail + " def g(x) (" + tail + ") + (" + conditions + ")";
+}
+
+static std::string NestedLoops(size_t depth) {
+    std::string loops;
+    for (size_t i = 0; i < depth; i++) {
+        loops += "for i = 0, i < 1 in ";
+    }
+    return "def f(x) " + loops + "x def g(x) (" + loops + "x) + x";
+}
+
+// Parses and emits every definition without running the LLVM backend, whose
+// time grows faster than linearly with the nesting of branches and loops
+static bool Emits(const std::string& source) {
+    Parser parser(source);
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    if (!parser.ParseDefinitions(externs, definitions)) {
+        return false;
+    }
+    for (FunctionAST* fnAST : definitions) {
+        llvm::Function* func = fnAST->codegen(*parser.GetIRConstructor());
+        if (!func || llvm::verifyFunction(*func, &llvm::errs())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+TEST(ParserTests, DeepIfs) {
+    GTEST_ASSERT_TRUE(Emits(NestedIfs(Depth)));
+    std::string source = NestedIfs(1000);
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {2.5}), 3.0);
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {1e9}), 1e9);
+    GTEST_ASSERT_EQ(Evaluate(source, "g", {2.5}), 4.0);
+}
+
+TEST(ParserTests, DeepLoops) {
+    GTEST_ASSERT_TRUE(Emits(NestedLoops(Depth)));
+    std::string source = NestedLoops(1000);
+    GTEST_ASSERT_EQ(Evaluate(source, "f", {2}), 0.0);
+    GTEST_ASSERT_EQ(Evaluate(source, "g", {2}), 2.0);
+}
+
+// Codegen of every definition, nullptr for those that failed
+static std::vector<llvm::Function*> EmitEach(Parser& parser) {
+    std::vector<PrototypeAST*> externs;
+    std::vector<FunctionAST*> definitions;
+    EXPECT_TRUE(parser.ParseDefinitions(externs, definitions));
+    std::vector<llvm::Function*> functions;
+    for (PrototypeAST* protoAST : externs) {
+        protoAST->codegen(*parser.GetIRConstructor());
+    }
+    for (FunctionAST* fnAST : definitions) {
+        functions.push_back(fnAST->codegen(*parser.GetIRConstructor()));
+    }
+    return functions;
+}
+
+TEST(ParserTests, CallsToAFailedDefinition) {
+    Parser parser("def f(x) y def g(x) f(x)");
+    std::vector<llvm::Function*> functions = EmitEach(parser);
+    GTEST_ASSERT_EQ(functions, (std::vector<llvm::Function*>{nullptr, nullptr}));
+    GTEST_ASSERT_EQ(parser.GetIRConstructor()->getModule().getFunction("f"), nullptr);
+
+    // Declared by the extern, so it stays callable
+    Parser withExtern("extern f(x) def f(x) y def g(x) f(x)");
+    functions = EmitEach(withExtern);
+    GTEST_ASSERT_EQ(functions[0], nullptr);
+    GTEST_ASSERT_NE(functions[1], nullptr);
+    llvm::Function* f = withExtern.GetIRConstructor()->getModule().getFunction("f");
+    GTEST_ASSERT_TRUE(f && f->isDeclaration());
+}
+
+TEST(ParserTests, Errors) {
+    GTEST_ASSERT_TRUE(Parses("def f(x) (x + 1) * g(x, (2))"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) (x + 1"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) x +"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) g(x 1)"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) g(x,)"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) if x then 1"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) if x else 1"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) for i = 0 in x"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) for i = 0, i < 1 x"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) for 1 = 0, i < 1 in x"));
+    GTEST_ASSERT_FALSE(Parses("def f(x) " + std::string(Depth, '(') + "x" + std::string(Depth - 1, ')')));
+}
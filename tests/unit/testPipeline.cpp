@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/Support/FileSystem.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Pipeline.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+// f0 .. f<n-1>, each one calls up to two earlier functions
+static std::string Program(size_t numFunctions) {
+    std::string source = "extern sin(x)\n";
+    for (size_t i = 0; i < numFunctions; i++) {
+        std::string name = "f" + std::to_string(i);
+        source += "def " + name + "(a b) (a + " + std::to_string(i) + ") * b";
+        if (i > 0) {
+            source += " + f" + std::to_string(i - 1) + "(b, a) * 0.5";
+        }
+        if (i > 3) {
+            source += " - f" + std::to_string(i / 2) + "(a, 1)";
+        }
+        source += "\n";
+    }
+    return source;
+}
+
+static std::vector<llvm::SmallVector<char, 0>> CompilePipelined(const std::string& source, PipelineOptions options) {
+    Pipeline pipeline(options);
+    if (!pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy(source, "<input>"))) {
+        return {};
+    }
+    return pipeline.getObjects();
+}
+
+TEST(PipelineTests, GroupsDefinitionsInInputOrder) {
+    PipelineOptions options;
+    options.definitionsPerModule = 4;
+    options.jobs = 4;
+    auto objects = CompilePipelined(Program(10), options);
+    GTEST_ASSERT_EQ(objects.size(), 3u);
+    std::vector<std::string> first = {"f0", "f1", "f2", "f3"};
+    std::vector<std::string> last = {"f8", "f9"};
+    GTEST_ASSERT_EQ(DefinedFunctions(llvm::StringRef(objects[0].data(), objects[0].size())), first);
+    GTEST_ASSERT_EQ(DefinedFunctions(llvm::StringRef(objects[2].data(), objects[2].size())), last);
+}
+
+TEST(PipelineTests, OutputDoesNotDependOnTheNumberOfWorkers) {
+    std::string source = Program(200);
+    PipelineOptions options;
+    options.definitionsPerModule = 8;
+    options.tokensPerChunk = 64;
+    options.queueCapacity = 2;
+
+    options.jobs = 1;
+    auto sequential = CompilePipelined(source, options);
+    GTEST_ASSERT_EQ(sequential.size(), 25u);
+    for (unsigned jobs : {2u, 4u, 8u}) {
+        options.jobs = jobs;
+        GTEST_ASSERT_EQ(CompilePipelined(source, options), sequential);
+    }
+}
+
+TEST(PipelineTests, MatchesTheSequentialParser) {
+    InitializeTargets();
+    std::string source = Program(40);
+    PipelineOptions options;
+    options.definitionsPerModule = 3;
+    auto objects = CompilePipelined(source, options);
+    GTEST_ASSERT_FALSE(objects.empty());
+
+    auto jit = llvm::orc::LLJITBuilder().create();
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+    for (const auto& object : objects) {
+        auto buffer = llvm::MemoryBuffer::getMemBufferCopy(llvm::StringRef(object.data(), object.size()));
+        GTEST_ASSERT_FALSE(LogIfError((*jit)->addObjectFile(std::move(buffer))));
+    }
+    auto address = (*jit)->lookup("f39");
+    GTEST_ASSERT_TRUE(static_cast<bool>(address));
+    double pipelined = address->toPtr<double (*)(double, double)>()(0.5, 2.0);
+
+    SilenceOutput silence;
+    Parser parser(source);
+    parser.parse();
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(parser.GetIRConstructor(), "f39", {0.5, 2.0})), pipelined);
+}
+
+TEST(PipelineTests, StopsAtTheFirstSyntaxError) {
+    std::string source = Program(20) + "def broken(a b (a + b)\n" + Program(500);
+    PipelineOptions options;
+    options.tokensPerChunk = 16;
+    options.queueCapacity = 1;
+    Pipeline pipeline(options);
+    // The lexer is far ahead and blocked on the full queue, it must not hang
+    GTEST_ASSERT_FALSE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy(source, "<input>")));
+    GTEST_ASSERT_TRUE(pipeline.getObjects().empty());
+}
+
+TEST(PipelineTests, ReportsCodegenErrors) {
+    Pipeline pipeline{PipelineOptions()};
+    GTEST_ASSERT_FALSE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy("def f(x) g(x)", "<input>")));
+    GTEST_ASSERT_FALSE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy("def f(x) x def f(x) x", "<input>")));
+    GTEST_ASSERT_FALSE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy("def f(x) x f(1)", "<input>")));
+    GTEST_ASSERT_TRUE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy("extern g(x) def f(x) g(x)", "<input>")));
+}
+
+TEST(PipelineTests, WritesAnArchive) {
+    PipelineOptions options;
+    options.definitionsPerModule = 5;
+    Pipeline pipeline(options);
+    GTEST_ASSERT_TRUE(pipeline.compile(llvm::MemoryBuffer::getMemBufferCopy(Program(12), "<input>")));
+    llvm::sys::fs::create_directories(TMP_OBJECT_FILES_DIR);
+    std::string fileName = std::string(TMP_OBJECT_FILES_DIR) + "/pipeline.a";
+    GTEST_ASSERT_EQ(pipeline.writeArchive(fileName), 0);
+    GTEST_ASSERT_TRUE(llvm::sys::fs::exists(fileName));
+}
@@ -0,0 +1,52 @@
+#include "gtest/gtest.h"
+
+#include "../../include/Parser.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+TEST(TargetConfigTests, HostCPUIsDetected) {
+    TargetConfig host;
+    GTEST_ASSERT_NE(host.getCPU(), "host");
+    GTEST_ASSERT_FALSE(host.getCPU().empty());
+
+    TargetConfig generic = TargetConfig::Generic();
+    GTEST_ASSERT_EQ(generic.getCPU(), "generic");
+    GTEST_ASSERT_TRUE(generic.getFeatures().empty());
+}
+
+TEST(TargetConfigTests, SettingsReachTheTargetMachine) {
+    InitializeTargets();
+    TargetConfig config = TargetConfig::Generic();
+    config.features = "+avx2";
+    config.codeGenOptLevel = llvm::CodeGenOptLevel::Aggressive;
+
+    auto targetMachine = config.createTargetMachine();
+    GTEST_ASSERT_TRUE(static_cast<bool>(targetMachine));
+    GTEST_ASSERT_EQ((*targetMachine)->getTargetCPU(), "generic");
+    GTEST_ASSERT_EQ((*targetMachine)->getTargetFeatureString(), "+avx2");
+    GTEST_ASSERT_EQ((*targetMachine)->getRelocationModel(), llvm::Reloc::PIC_);
+    GTEST_ASSERT_EQ((*targetMachine)->getOptLevel(), llvm::CodeGenOptLevel::Aggressive);
+}
+
+TEST(TargetConfigTests, ModulesKnowTheirTargetBeforeOptimization) {
+    Parser parser("def f(x) x * 2");
+    parser.parse();
+    llvm::Module& module = parser.GetIRConstructor()->getModule();
+    GTEST_ASSERT_EQ(module.getTargetTriple(), TargetConfig().getTriple());
+    GTEST_ASSERT_FALSE(module.getDataLayout().getStringRepresentation().empty());
+
+    // modules started after takeModule are configured the same way
+    parser.GetIRConstructor()->takeModule();
+    GTEST_ASSERT_EQ(parser.GetIRConstructor()->getModule().getTargetTriple(), TargetConfig().getTriple());
+}
+
+TEST(TargetConfigTests, JITUsesTheConfiguredTarget) {
+    JITOptions options;
+    options.compilerOptions.target = TargetConfig::Generic();
+    auto jit = JITSession::Create(options);
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+
+    Parser parser("def f(x) x * 2", options.compilerOptions);
+    parser.parse();
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(**jit, parser.GetIRConstructor(), "f", {4.0})), 8.0);
+}
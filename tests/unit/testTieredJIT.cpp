@@ -0,0 +1,154 @@
+#include "gtest/gtest.h"
+
+#include <cmath>
+#include <thread>
+
+#include "../../include/TieredJIT.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+using BinaryFn = double (*)(double, double);
+
+static TieredJITOptions WithThreshold(uint64_t hotThreshold) {
+    TieredJITOptions options;
+    options.hotThreshold = hotThreshold;
+    return options;
+}
+
+template <typename Fn>
+static Fn Lookup(TieredJIT& jit, llvm::StringRef name) {
+    auto address = jit.lookup(name);
+    if (!address) {
+        LogIfError(address.takeError());
+        return nullptr;
+    }
+    return address->toPtr<Fn>();
+}
+
+TEST(TieredJITTests, HotFunctionsMoveToTier1) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(10)));
+    GTEST_ASSERT_TRUE(jit != nullptr);
+    GTEST_ASSERT_TRUE(jit->addSource("def f(x y) if x < y then x * y else x + y def g(x y) x - y"));
+    auto f = Lookup<BinaryFn>(*jit, "f");
+    GTEST_ASSERT_TRUE(f != nullptr);
+    GTEST_ASSERT_EQ(jit->getTier("f"), 0);
+
+    for (int i = 0; i < 9; i++) {
+        GTEST_ASSERT_EQ(f(2, 3), 6.0);
+    }
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(jit->getTier("f"), 0);
+
+    // The same address runs tier 1 once it is installed
+    GTEST_ASSERT_EQ(f(3, 2), 5.0);
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(jit->getTier("f"), 1);
+    GTEST_ASSERT_EQ(jit->getTier("g"), 0);
+    GTEST_ASSERT_EQ(jit->getNumTierUps(), 1u);
+    GTEST_ASSERT_EQ(f(2, 3), 6.0);
+    GTEST_ASSERT_EQ(f(3, 2), 5.0);
+    GTEST_ASSERT_EQ(jit->getTier("unknown"), -1);
+}
+
+TEST(TieredJITTests, CountsCallsAndBranches) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(1000)));
+    GTEST_ASSERT_TRUE(jit->addSource("def f(x y) if x < y then x * y else x + y"));
+    auto f = Lookup<BinaryFn>(*jit, "f");
+    for (int i = 0; i < 3; i++) {
+        f(1, 2);
+    }
+    f(2, 1);
+
+    FunctionProfile profile = jit->getProfile("f");
+    GTEST_ASSERT_EQ(profile.calls, 4u);
+    GTEST_ASSERT_EQ(profile.branches.size(), 1u);
+    GTEST_ASSERT_EQ(profile.branches[0].first, 3u);
+    GTEST_ASSERT_EQ(profile.branches[0].second, 1u);
+}
+
+TEST(TieredJITTests, LoopIterationsCountTowardsTheThreshold) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(1000)));
+    GTEST_ASSERT_TRUE(jit->addSource("def sum(n acc) if n < 1 then acc else sum(n - 1, acc + n)"));
+    auto sum = Lookup<BinaryFn>(*jit, "sum");
+    GTEST_ASSERT_EQ(sum(100, 0), 5050.0);
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(jit->getTier("sum"), 0);
+
+    // One call, but its tail recursion loops past the threshold
+    GTEST_ASSERT_EQ(sum(2000, 0), 2001000.0);
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(jit->getTier("sum"), 1);
+    GTEST_ASSERT_EQ(jit->getProfile("sum").calls, 2u);
+    GTEST_ASSERT_EQ(sum(1e6, 0), 500000500000.0);
+}
+
+TEST(TieredJITTests, CallersSwitchToTheNewTier) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(50)));
+    GTEST_ASSERT_TRUE(jit->addSource("def leaf(x y) x * y + 1"));
+    GTEST_ASSERT_TRUE(jit->addSource("def caller(x y) leaf(x, y) + leaf(y, x) "
+                                     "def fib(n unused) if n < 2 then n else fib(n - 1, 0) + fib(n - 2, 0)"));
+    auto caller = Lookup<BinaryFn>(*jit, "caller");
+    auto fib = Lookup<BinaryFn>(*jit, "fib");
+    for (int i = 0; i < 25; i++) {
+        GTEST_ASSERT_EQ(caller(2, 3), 14.0);
+    }
+    jit->waitForTierUps();
+    // leaf was called 50 times from caller, caller itself only 25 times
+    GTEST_ASSERT_EQ(jit->getTier("leaf"), 1);
+    GTEST_ASSERT_EQ(jit->getTier("caller"), 0);
+    GTEST_ASSERT_EQ(caller(2, 3), 14.0);
+
+    // Recursive calls go through the stub as well
+    GTEST_ASSERT_EQ(fib(20, 0), 6765.0);
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(jit->getTier("fib"), 1);
+    GTEST_ASSERT_EQ(fib(20, 0), 6765.0);
+}
+
+TEST(TieredJITTests, WithoutProfile) {
+    TieredJITOptions options;
+    options.hotThreshold = 1;
+    options.profileGuided = false;
+    options.compilerOptions.optLevel = OptLevel::O3;
+    auto jit = TieredJIT::Create(options);
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+    GTEST_ASSERT_TRUE((*jit)->addSource("def f(x y) if x < y then x * y else x + y"));
+    auto f = Lookup<BinaryFn>(**jit, "f");
+    GTEST_ASSERT_EQ(f(2, 3), 6.0);
+    (*jit)->waitForTierUps();
+    GTEST_ASSERT_EQ((*jit)->getTier("f"), 1);
+    GTEST_ASSERT_EQ(f(2, 3), 6.0);
+}
+
+TEST(TieredJITTests, CalledFromSeveralThreads) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(500)));
+    GTEST_ASSERT_TRUE(jit->addSource("def g(x y) if x < y then y - x else x - y def f(x y) g(x, y) * 2"));
+    auto f = Lookup<BinaryFn>(*jit, "f");
+    std::vector<std::thread> threads;
+    std::atomic<int> wrong{0};
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for (int i = 0; i < 1000; i++) {
+                wrong += f(t, i) != 2.0 * std::abs(t - i);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    jit->waitForTierUps();
+    GTEST_ASSERT_EQ(wrong, 0);
+    // Exactly one request per function, however many threads crossed the threshold
+    GTEST_ASSERT_EQ(jit->getNumTierUps(), 2u);
+}
+
+TEST(TieredJITTests, Errors) {
+    auto jit = TakeOrNull(TieredJIT::Create(WithThreshold(10)));
+    GTEST_ASSERT_TRUE(jit->addSource("def f(x) x extern sin(x)"));
+    GTEST_ASSERT_FALSE(jit->addSource("def f(x) x"));
+    GTEST_ASSERT_FALSE(jit->addSource("def g(x) h(x)"));
+    GTEST_ASSERT_FALSE(jit->addSource("def g(x) f(x, x)"));
+    GTEST_ASSERT_FALSE(jit->addSource("1 + 2"));
+    GTEST_ASSERT_TRUE(jit->addSource("def g(x) f(x) + 1"));
+    GTEST_ASSERT_EQ(Lookup<double (*)(double)>(*jit, "g")(1), 2.0);
+}
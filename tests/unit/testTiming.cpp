@@ -0,0 +1,106 @@
+#include "gtest/gtest.h"
+
+#include <set>
+#include <sstream>
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include "../../include/Constants.hpp"
+#include "../../include/Parser.hpp"
+#include "../../include/Timing.hpp"
+#include "../../include/Utils.hpp"
+#include "../TestUtils.hpp"
+
+static std::set<std::string> Recorded() {
+    std::set<std::string> recorded;
+    for (const TimingEvent& event : GetTimingEvents()) {
+        recorded.insert(std::string(event.phase) + ":" + event.detail);
+    }
+    return recorded;
+}
+
+TEST(TimingTests, DisabledRecordsNothing) {
+    EnableTiming();
+    DisableTiming();
+    Parser parser("def f(x) x + 1");
+    parser.parse();
+    llvm::SmallVector<char, 0> object;
+    GTEST_ASSERT_EQ(CompileToObjectBuffer(parser.GetIRConstructor(), object), 0);
+    GTEST_ASSERT_TRUE(GetTimingEvents().empty());
+}
+
+TEST(TimingTests, RecordsEveryPhasePerFunction) {
+    EnableTiming();
+    Parser parser("def inc(x) x + 1 def twice(x) inc(x) * 2");
+    parser.parse();
+    llvm::SmallVector<char, 0> object;
+    GTEST_ASSERT_EQ(CompileToObjectBuffer(parser.GetIRConstructor(), object), 0);
+    DisableTiming();
+
+    std::set<std::string> recorded = Recorded();
+    for (const char* expected : {"Parse:inc", "Parse:twice", "ASTOptimize:inc", "Codegen:inc", "Codegen:twice",
+                                 "Optimize:jitcompile", "Emit:jitcompile"}) {
+        GTEST_ASSERT_EQ(recorded.count(expected), 1u) << expected;
+    }
+}
+
+TEST(TimingTests, RecordsJITMaterialization) {
+    auto jit = JITSession::Create();
+    GTEST_ASSERT_TRUE(static_cast<bool>(jit));
+
+    EnableTiming();
+    Parser parser("def square(x) x * x");
+    parser.parse();
+    GTEST_ASSERT_EQ(ValueOrNaN(RunParsedFunction(**jit, parser.GetIRConstructor(), "square", {3.0})), 9.0);
+    DisableTiming();
+
+    std::set<std::string> recorded = Recorded();
+    GTEST_ASSERT_EQ(recorded.count("JITLookup:square"), 1u);
+    GTEST_ASSERT_EQ(recorded.count("JITCodegen:square"), 1u);
+
+    // codegen happens inside the lookup
+    std::vector<TimingEvent> events = GetTimingEvents();
+    const TimingEvent* lookup = nullptr;
+    const TimingEvent* codegen = nullptr;
+    for (const TimingEvent& event : events) {
+        if (std::string(event.phase) == "JITLookup") {
+            lookup = &event;
+        } else if (std::string(event.phase) == "JITCodegen") {
+            codegen = &event;
+        }
+    }
+    GTEST_ASSERT_LE(lookup->startNanos, codegen->startNanos);
+    GTEST_ASSERT_GE(lookup->wallNanos, codegen->wallNanos);
+}
+
+TEST(TimingTests, WritesSummaryAndChromeTrace) {
+    EnableTiming();
+    Parser parser("def f(x) x * 2 + 1");
+    parser.parse();
+    llvm::SmallVector<char, 0> object;
+    GTEST_ASSERT_EQ(CompileToObjectBuffer(parser.GetIRConstructor(), object), 0);
+    DisableTiming();
+
+    std::ostringstream summary;
+    PrintTimingSummary(summary);
+    GTEST_ASSERT_NE(summary.str().find("Codegen"), std::string::npos);
+    GTEST_ASSERT_NE(summary.str().find("Emit"), std::string::npos);
+
+    llvm::sys::fs::create_directories(TMP_OBJECT_FILES_DIR);
+    std::string fileName = std::string(TMP_OBJECT_FILES_DIR) + "/trace.json";
+    GTEST_ASSERT_TRUE(WriteChromeTrace(fileName));
+
+    auto buffer = llvm::MemoryBuffer::getFile(fileName);
+    GTEST_ASSERT_TRUE(static_cast<bool>(buffer));
+    auto trace = llvm::json::parse((*buffer)->getBuffer());
+    GTEST_ASSERT_TRUE(static_cast<bool>(trace));
+    const llvm::json::Array* traceEvents = trace->getAsObject()->getArray("traceEvents");
+    GTEST_ASSERT_NE(traceEvents, nullptr);
+    GTEST_ASSERT_EQ(traceEvents->size(), GetTimingEvents().size());
+    for (const llvm::json::Value& event : *traceEvents) {
+        GTEST_ASSERT_EQ(event.getAsObject()->getString("ph"), llvm::StringRef("X"));
+        GTEST_ASSERT_TRUE(static_cast<bool>(event.getAsObject()->getNumber("dur")));
+    }
+}